@@ -0,0 +1,1135 @@
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include "BVH.h"
+#include "RayBatch.h"
+#include "WorkStealingPool.h"
+
+#if defined(_WIN32)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+/**
+ * @struct	BVHPrimitive
+ * @brief	A primitive as seen by the builder. The builder partitions these
+ * 			records themselves, rather than indices into the bounds, so that
+ * 			every pass over a node reads memory in order.
+ */
+
+struct BVHPrimitive {
+	AABB box;			//!< Bounds of the primitive.
+	glm::vec3 centroid;	//!< Center of box.
+	int index;			//!< The primitive's number.
+};
+
+/**
+ * @struct	BVHBin
+ * @brief	Accumulates the primitives whose centroids fall in one SAH bin.
+ */
+
+struct BVHBin {
+	AABB box;		//!< Bounds of the primitives in the bin.
+	int count;		//!< Number of primitives in the bin.
+	BVHBin() : count(0) {}
+};
+
+const char BVH_CACHE_MAGIC[8] = { 'B', 'V', 'H', 'C', 'A', 'C', 'H', 'E' };	//!< Start of every BVH cache file.
+const uint32_t BVH_CACHE_VERSION = 1;	//!< Changes whenever the layout of the nodes or the file changes.
+const int BVH_CACHE_HEADER_SIZE = 64;	//!< Bytes before the nodes, which keeps them cache line aligned.
+
+/**
+ * @struct	BVHCacheHeader
+ * @brief	The start of a BVH cache file (see SceneBVH::save).
+ */
+
+struct BVHCacheHeader {
+	char magic[8];			//!< BVH_CACHE_MAGIC.
+	uint32_t version;		//!< BVH_CACHE_VERSION.
+	uint32_t nodeSize;		//!< Size of each node; tells full precision from compressed nodes.
+	uint64_t sceneHash;		//!< SceneBVH::hashObjects of the objects.
+	int32_t numNodes;		//!< Nodes, which start at BVH_CACHE_HEADER_SIZE.
+	int32_t numIndices;		//!< Primitive indices, which follow the nodes.
+	uint64_t indexOffset;	//!< Where the primitive indices start.
+};
+
+static_assert(sizeof(BVHCacheHeader) <= BVH_CACHE_HEADER_SIZE, "BVHCacheHeader must fit before the nodes");
+
+/**
+ * @fn	BVH::BVH()
+ * @brief	Constructs an empty hierarchy.
+ */
+
+BVH::BVH()
+	: builtCost(0.0f), numRefits(0), buildSeconds(0.0f) {
+}
+
+/**
+ * @fn	void BVH::build(const std::vector<AABB> &primitiveBounds, WorkStealingPool *pool)
+ * @brief	Builds the hierarchy. Primitive i is the one bounded by primitiveBounds[i].
+ * 			With a pool, the top of the tree is split first, with the binning of
+ * 			large nodes spread over the threads, and the subtrees below are then
+ * 			built as independent tasks. Every subtree over n primitives owns a
+ * 			fixed range of 2n - 1 slots in the node array, so the tasks never
+ * 			contend; the unused slots are squeezed out at the end. The tree is
+ * 			the same whatever the number of threads. Must not be called from
+ * 			one of the pool's own tasks.
+ * @param	primitiveBounds	The bounds of each primitive.
+ * @param	pool		   	Threads to build with, or nullptr to build on this thread.
+ */
+
+void BVH::build(const std::vector<AABB> &primitiveBounds, WorkStealingPool *pool) {
+	const auto startTime = std::chrono::steady_clock::now();
+	const int N = (int)primitiveBounds.size();
+	clear();
+	if (N == 0) {
+		return;
+	}
+	if (pool != nullptr && pool->getNumThreads() == 1) {
+		pool = nullptr;
+	}
+
+	std::vector<BVHPrimitive> primitives(N);
+	for (int i = 0; i < N; i++) {
+		primitives[i].box = primitiveBounds[i];
+		primitives[i].centroid = primitiveBounds[i].center();
+		primitives[i].index = i;
+	}
+	nodes.resize(2 * N - 1);
+
+	// Subtrees still to be built, and the node slots of their roots.
+	struct Subtree {
+		int node, begin, end, depth;
+	};
+	std::vector<Subtree> subtrees = { { 0, 0, N, 0 } };
+	if (pool != nullptr) {
+		const int taskSize = std::max(BVH_MIN_TASK_SIZE, N / (BVH_TASKS_PER_THREAD * pool->getNumThreads()));
+		for (size_t i = 0; i < subtrees.size(); ) {
+			const Subtree t = subtrees[i];
+			if (t.end - t.begin <= taskSize) {
+				i++;
+				continue;
+			}
+			int mid = splitNode(primitives, t.begin, t.end, t.depth, nodes[t.node], pool);
+			if (mid < 0) {
+				subtrees[i] = subtrees.back();
+				subtrees.pop_back();
+				continue;
+			}
+			const int secondChild = t.node + 2 * (mid - t.begin);
+			nodes[t.node].offset = secondChild;
+			subtrees[i] = { t.node + 1, t.begin, mid, t.depth + 1 };
+			subtrees.push_back({ secondChild, mid, t.end, t.depth + 1 });
+		}
+		pool->parallelFor((int)subtrees.size(), [&](int i) {
+			const Subtree &t = subtrees[i];
+			buildSubtree(primitives, t.node, t.begin, t.end, t.depth);
+		});
+	} else {
+		buildSubtree(primitives, 0, 0, N, 0);
+	}
+
+	primitiveIndices.resize(N);
+	for (int i = 0; i < N; i++) {
+		primitiveIndices[i] = primitives[i].index;
+	}
+	compactNodes();
+	builtCost = cost();
+	buildSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+/**
+ * @fn	void BVH::buildSubtree(std::vector<BVHPrimitive> &primitives, int nodeIndex, int begin, int end, int depth)
+ * @brief	Builds the subtree over primitives[begin, end), rooted at node
+ * 			slot nodeIndex. Its first child's subtree takes the slots right
+ * 			after it, and its second child's those after the largest size the
+ * 			first could have.
+ * @param	primitives	The primitives, reordered by leaf as the tree is built.
+ * @param	nodeIndex	The node slot for the root of the subtree.
+ * @param	begin	 	First primitive of this subtree.
+ * @param	end		 	One past the last primitive of this subtree.
+ * @param	depth	 	Depth of this node.
+ */
+
+void BVH::buildSubtree(std::vector<BVHPrimitive> &primitives, int nodeIndex, int begin, int end, int depth) {
+	int mid = splitNode(primitives, begin, end, depth, nodes[nodeIndex], nullptr);
+	if (mid < 0) {
+		return;
+	}
+	const int secondChild = nodeIndex + 2 * (mid - begin);
+	nodes[nodeIndex].offset = secondChild;
+	buildSubtree(primitives, nodeIndex + 1, begin, mid, depth + 1);
+	buildSubtree(primitives, secondChild, mid, end, depth + 1);
+}
+
+/**
+ * @fn	void BVH::compactNodes()
+ * @brief	Squeezes the unused slots out of the node array, keeping the nodes
+ * 			in depth first order. Slots only move toward the front, and each
+ * 			is read before anything is written over it, so this is done in place.
+ */
+
+void BVH::compactNodes() {
+	std::vector<std::pair<int, int>> secondChildren;	// (old slot, new index of its parent)
+	int current = 0;
+	int parent = -1;
+	int numNodes = 0;
+	while (true) {
+		const BVHNode node = nodes[current];
+		if (parent >= 0) {
+			nodes[parent].offset = numNodes;
+		}
+		nodes[numNodes++] = node;
+		if (node.count == 0) {
+			secondChildren.push_back(std::make_pair(node.offset, numNodes - 1));
+			current = current + 1;
+			parent = -1;
+		} else if (!secondChildren.empty()) {
+			current = secondChildren.back().first;
+			parent = secondChildren.back().second;
+			secondChildren.pop_back();
+		} else {
+			break;
+		}
+	}
+	nodes.resize(numNodes);
+	nodes.shrink_to_fit();
+}
+
+/**
+ * @fn	int BVH::splitNode(std::vector<BVHPrimitive> &primitives, int begin, int end, int depth, BVHNode &node, WorkStealingPool *pool)
+ * @brief	Sets up the node over primitives[begin, end). The primitives
+ * 			are binned by centroid along the longest axis of the centroid
+ * 			bounds, and the bin boundary with the lowest surface area
+ * 			heuristic cost is used, unless a leaf is cheaper.
+ * @param [in,out]	primitives	The primitives; those of this node are
+ * 								partitioned between its children.
+ * @param 		  	begin	 	First primitive of this node.
+ * @param 		  	end		 	One past the last primitive of this node.
+ * @param 		  	depth	 	Depth of this node.
+ * @param [in,out]	node	 	The node. Its offset is left for the caller
+ * 								to set if it is an interior node.
+ * @param 		  	pool	 	Threads to bin large nodes with, or nullptr.
+ * @return	Where the primitives were partitioned between the two children,
+ * 			or -1 if the node is a leaf.
+ */
+
+int BVH::splitNode(std::vector<BVHPrimitive> &primitives, int begin, int end, int depth,
+					BVHNode &node, WorkStealingPool *pool) {
+	const int count = end - begin;
+	// Huge nodes are scanned in one chunk per thread. Boxes only take mins and
+	// maxes, so merging the chunks gives exactly the serial result.
+	const int numChunks = (pool != nullptr && count > BVH_PARALLEL_BIN_SIZE) ? pool->getNumThreads() : 1;
+	auto forEachChunk = [&](auto body) {
+		if (numChunks == 1) {
+			body(0, begin, end);
+		} else {
+			pool->parallelFor(numChunks, [&](int chunk) {
+				body(chunk, begin + (int)((long long)count * chunk / numChunks),
+							begin + (int)((long long)count * (chunk + 1) / numChunks));
+			});
+		}
+	};
+
+	AABB localBoxes[2];
+	std::vector<AABB> chunkBoxes(numChunks > 1 ? 2 * numChunks : 0);
+	AABB *boxes = numChunks > 1 ? &chunkBoxes[0] : localBoxes;
+	forEachChunk([&](int chunk, int first, int last) {
+		AABB &box = boxes[2 * chunk];
+		AABB &centroidBox = boxes[2 * chunk + 1];
+		for (int i = first; i < last; i++) {
+			box.expand(primitives[i].box);
+			centroidBox.expand(primitives[i].centroid);
+		}
+	});
+	AABB box, centroidBox;
+	for (int chunk = 0; chunk < numChunks; chunk++) {
+		box.expand(boxes[2 * chunk]);
+		centroidBox.expand(boxes[2 * chunk + 1]);
+	}
+	node.box = box;
+
+	const int axis = centroidBox.longestAxis();
+	const float axisLow = centroidBox.lower[axis];
+	const float axisExtent = centroidBox.upper[axis] - axisLow;
+
+	if (count == 1 || (count <= BVH_MAX_LEAF_SIZE && axisExtent <= 0.0f)) {
+		node.offset = begin;
+		node.count = count;
+		return -1;
+	}
+
+	int mid = begin;
+	if (axisExtent > 0.0f && depth < BVH_MAX_DEPTH) {
+		BVHBin localBins[BVH_NUM_BINS];
+		std::vector<BVHBin> chunkBins(numChunks > 1 ? numChunks * BVH_NUM_BINS : 0);
+		BVHBin *bins = numChunks > 1 ? &chunkBins[0] : localBins;
+		const float scale = BVH_NUM_BINS / axisExtent;
+		auto binOf = [&](const BVHPrimitive &prim) {
+			int b = (int)((prim.centroid[axis] - axisLow) * scale);
+			return std::min(b, BVH_NUM_BINS - 1);
+		};
+		forEachChunk([&](int chunk, int first, int last) {
+			BVHBin *chunkBin = &bins[chunk * BVH_NUM_BINS];
+			for (int i = first; i < last; i++) {
+				BVHBin &bin = chunkBin[binOf(primitives[i])];
+				bin.box.expand(primitives[i].box);
+				bin.count++;
+			}
+		});
+		for (int chunk = 1; chunk < numChunks; chunk++) {
+			for (int b = 0; b < BVH_NUM_BINS; b++) {
+				bins[b].box.expand(bins[chunk * BVH_NUM_BINS + b].box);
+				bins[b].count += bins[chunk * BVH_NUM_BINS + b].count;
+			}
+		}
+
+		// Sweep from the right to get the cost of everything above each boundary.
+		float rightArea[BVH_NUM_BINS];
+		int rightCount[BVH_NUM_BINS];
+		AABB rightBox;
+		int numRight = 0;
+		for (int b = BVH_NUM_BINS - 1; b > 0; b--) {
+			rightBox.expand(bins[b].box);
+			numRight += bins[b].count;
+			rightArea[b] = rightBox.surfaceArea();
+			rightCount[b] = numRight;
+		}
+
+		// Cost of a split relative to intersecting one primitive; traversing a node costs 1.
+		float bestCost = FLT_MAX;
+		int bestSplit = -1;
+		AABB leftBox;
+		int numLeft = 0;
+		for (int b = 0; b < BVH_NUM_BINS - 1; b++) {
+			leftBox.expand(bins[b].box);
+			numLeft += bins[b].count;
+			if (numLeft == 0 || rightCount[b + 1] == 0) {
+				continue;
+			}
+			float cost = 1.0f + (numLeft * leftBox.surfaceArea() +
+								rightCount[b + 1] * rightArea[b + 1]) / box.surfaceArea();
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestSplit = b;
+			}
+		}
+
+		if (count <= BVH_MAX_LEAF_SIZE && (float)count <= bestCost) {
+			node.offset = begin;
+			node.count = count;
+			return -1;
+		}
+		if (bestSplit >= 0) {
+			mid = (int)(std::partition(primitives.begin() + begin, primitives.begin() + end,
+										[&](const BVHPrimitive &prim) { return binOf(prim) <= bestSplit; })
+						- primitives.begin());
+		}
+	}
+
+	// All centroids coincide, or the tree is already deep: split at the median.
+	if (mid == begin || mid == end) {
+		mid = (begin + end) / 2;
+		std::nth_element(primitives.begin() + begin, primitives.begin() + mid, primitives.begin() + end,
+						[&](const BVHPrimitive &p1, const BVHPrimitive &p2) {
+							return p1.centroid[axis] < p2.centroid[axis];
+						});
+	}
+
+	node.count = 0;
+	node.axis = axis;
+	return mid;
+}
+
+/**
+ * @fn	void BVH::refit(const std::vector<AABB> &primitiveBounds)
+ * @brief	Recomputes every node's box from new primitive bounds, keeping the
+ * 			tree's structure. Much cheaper than a rebuild, but the tree gets
+ * 			worse as primitives drift away from the ones they were grouped
+ * 			with; compare cost() with builtCost to decide when to rebuild.
+ * @param	primitiveBounds	The bounds of each primitive; the same primitives,
+ * 							in the same order, as the last build.
+ */
+
+void BVH::refit(const std::vector<AABB> &primitiveBounds) {
+	// Children always follow their parent, so a backward sweep sees them first.
+	for (int i = (int)nodes.size() - 1; i >= 0; i--) {
+		BVHNode &node = nodes[i];
+		node.box = AABB();
+		if (node.count > 0) {
+			for (int j = 0; j < node.count; j++) {
+				node.box.expand(primitiveBounds[primitiveIndices[node.offset + j]]);
+			}
+		} else {
+			node.box.expand(nodes[i + 1].box);
+			node.box.expand(nodes[node.offset].box);
+		}
+	}
+	numRefits++;
+}
+
+/**
+ * @fn	float BVH::cost() const
+ * @brief	Computes the surface area heuristic cost of the tree: the expected
+ * 			number of node visits and primitive tests for a random ray that
+ * 			hits the root, using the same costs as the builder.
+ * @return	The cost; 0 for an empty tree.
+ */
+
+float BVH::cost() const {
+	if (nodes.empty() || nodes[0].box.surfaceArea() <= 0.0f) {
+		return 0.0f;
+	}
+	float total = 0.0f;
+	for (const BVHNode &node : nodes) {
+		total += (node.count > 0 ? node.count : 1.0f) * node.box.surfaceArea();
+	}
+	return total / nodes[0].box.surfaceArea();
+}
+
+/**
+ * @fn	BVHStats BVH::getStats() const
+ * @brief	Measures the size and quality of the hierarchy.
+ * @return	The statistics.
+ */
+
+BVHStats BVH::getStats() const {
+	BVHStats stats;
+	stats.numNodes = (int)nodes.size();
+	stats.numLeaves = 0;
+	stats.maxDepth = 0;
+	stats.memoryBytes = nodes.capacity() * sizeof(BVHNode) + primitiveIndices.capacity() * sizeof(int);
+	stats.sahCost = cost();
+	stats.buildSeconds = buildSeconds;
+
+	// Depth first order: a node's depth is one more than its parent's.
+	std::vector<int> depths(nodes.size(), 0);
+	for (size_t i = 0; i < nodes.size(); i++) {
+		const BVHNode &node = nodes[i];
+		if (node.count > 0) {
+			stats.numLeaves++;
+			stats.maxDepth = std::max(stats.maxDepth, depths[i]);
+		} else {
+			depths[i + 1] = depths[node.offset] = depths[i] + 1;
+		}
+	}
+	return stats;
+}
+
+/**
+ * @fn	std::ostream &operator << (std::ostream &os, const BVHStats &stats)
+ * @brief	Output stream for BVH statistics.
+ * @param [in,out]	os   	The output stream.
+ * @param 		  	stats	The statistics.
+ * @return	The output stream.
+ */
+
+std::ostream &operator << (std::ostream &os, const BVHStats &stats) {
+	os << stats.buildSeconds * 1000.0f << " ms, " << stats.numNodes << " nodes ("
+		<< stats.numLeaves << " leaves, depth " << stats.maxDepth << "), "
+		<< stats.memoryBytes / (1024.0f * 1024.0f) << " MB, SAH cost " << stats.sahCost;
+	return os;
+}
+
+/**
+ * @fn	std::ostream &operator << (std::ostream &os, const BVHTraversalStats &stats)
+ * @brief	Output stream for traversal statistics, as averages per ray.
+ * @param [in,out]	os   	The output stream.
+ * @param 		  	stats	The statistics.
+ * @return	The output stream.
+ */
+
+std::ostream &operator << (std::ostream &os, const BVHTraversalStats &stats) {
+	const double numRays = (double)std::max(stats.numRays, 1LL);
+	os << stats.numNodes / numRays << " nodes and " << stats.numPrimitives / numRays
+		<< " primitives per ray (" << stats.numRays << " rays)";
+	return os;
+}
+
+/**
+ * @fn	void BVH::clear()
+ * @brief	Removes all nodes and primitives.
+ */
+
+void BVH::clear() {
+	nodes.clear();
+	primitiveIndices.clear();
+	builtCost = 0.0f;
+	numRefits = 0;
+	buildSeconds = 0.0f;
+}
+
+/**
+ * @fn	void QBVH::build(const BVH &bvh)
+ * @brief	Builds the 4-wide hierarchy by collapsing a binary one. The leaves
+ * 			and primitive order are those of the binary tree.
+ * @param	bvh	The binary hierarchy.
+ */
+
+void QBVH::build(const BVH &bvh) {
+	clear();
+	if (bvh.isEmpty()) {
+		return;
+	}
+	primitiveIndices = bvh.primitiveIndices;
+	nodes.reserve(bvh.nodes.size() / (QBVH_WIDTH - 1) + 1);
+	collapse(bvh, 0);
+	nodes.shrink_to_fit();
+	useOwnArrays();
+}
+
+/**
+ * @fn	int QBVH::collapse(const BVH &bvh, int binaryNode)
+ * @brief	Appends the node that replaces a binary node, then the nodes below
+ * 			it. Starting from the binary node's children, the interior child
+ * 			with the largest surface area, which rays are most likely to enter,
+ * 			is replaced by its own two children until there are four.
+ * @param	bvh		  	The binary hierarchy.
+ * @param	binaryNode	Index of the binary node; a leaf only for the root.
+ * @return	The index of the new node.
+ */
+
+int QBVH::collapse(const BVH &bvh, int binaryNode) {
+	int children[QBVH_WIDTH];
+	int numChildren = 0;
+	const BVHNode &binary = bvh.nodes[binaryNode];
+	if (binary.count > 0) {
+		children[numChildren++] = binaryNode;
+	} else {
+		children[numChildren++] = binaryNode + 1;
+		children[numChildren++] = binary.offset;
+	}
+	while (numChildren < QBVH_WIDTH) {
+		int largest = -1;
+		float largestArea = -1.0f;
+		for (int i = 0; i < numChildren; i++) {
+			const BVHNode &child = bvh.nodes[children[i]];
+			if (child.count == 0 && child.box.surfaceArea() > largestArea) {
+				largest = i;
+				largestArea = child.box.surfaceArea();
+			}
+		}
+		if (largest < 0) {
+			break;
+		}
+		const int opened = children[largest];
+		children[largest] = opened + 1;
+		children[numChildren++] = bvh.nodes[opened].offset;
+	}
+
+	const int index = (int)nodes.size();
+	nodes.push_back(QBVHNode());
+	for (int i = 0; i < QBVH_WIDTH; i++) {
+		QBVHNode &node = nodes[index];
+		if (i >= numChildren) {
+			for (int axis = 0; axis < 3; axis++) {
+				node.lower[axis][i] = node.upper[axis][i] = 0.0f;
+			}
+			node.children[i] = -1;
+			node.counts[i] = -1;
+			continue;
+		}
+		const BVHNode &child = bvh.nodes[children[i]];
+		for (int axis = 0; axis < 3; axis++) {
+			node.lower[axis][i] = child.box.lower[axis];
+			node.upper[axis][i] = child.box.upper[axis];
+		}
+		node.counts[i] = child.count;
+		if (child.count > 0) {
+			node.children[i] = child.offset;
+		} else {
+			// Collapsing the child appends to nodes, so node may move.
+			const int childIndex = collapse(bvh, children[i]);
+			nodes[index].children[i] = childIndex;
+		}
+	}
+	return index;
+}
+
+/**
+ * @fn	void CompressedQBVHNode::set(const QBVHNode &node)
+ * @brief	Compresses a node. Along each axis, the step is the smallest power of
+ * 			2 that spans the node's box in 255 steps. Each child's lower corner
+ * 			is then rounded down to a step and its upper corner up, checking
+ * 			the result with the same arithmetic the slab test uses, so that no
+ * 			box ever shrinks.
+ * @param	node	The full precision node.
+ */
+
+void CompressedQBVHNode::set(const QBVHNode &node) {
+	for (int axis = 0; axis < 3; axis++) {
+		float boxLower = FLT_MAX;
+		float boxUpper = -FLT_MAX;
+		for (int i = 0; i < QBVH_WIDTH; i++) {
+			if (node.isUsed(i)) {
+				boxLower = std::min(boxLower, node.lower[axis][i]);
+				boxUpper = std::max(boxUpper, node.upper[axis][i]);
+			}
+		}
+		int exponent;
+		std::frexp((boxUpper - boxLower) / 255.0f, &exponent);
+		float step = std::ldexp(1.0f, exponent);
+		while (boxLower + 255.0f * step < boxUpper) {
+			step *= 2.0f;
+		}
+		origin[axis] = boxLower;
+		scale[axis] = step;
+
+		for (int i = 0; i < QBVH_WIDTH; i++) {
+			if (!node.isUsed(i)) {
+				lower[axis][i] = upper[axis][i] = 0;
+				continue;
+			}
+			int low = (int)std::floor((node.lower[axis][i] - boxLower) / step);
+			lower[axis][i] = (unsigned char)std::min(std::max(low, 0), 255);
+			while (lower[axis][i] > 0 && lowerBound(axis, i) > node.lower[axis][i]) {
+				lower[axis][i]--;
+			}
+			int high = (int)std::ceil((node.upper[axis][i] - boxLower) / step);
+			upper[axis][i] = (unsigned char)std::min(std::max(high, 0), 255);
+			while (upper[axis][i] < 255 && upperBound(axis, i) < node.upper[axis][i]) {
+				upper[axis][i]++;
+			}
+		}
+	}
+
+	for (int i = 0; i < QBVH_WIDTH; i++) {
+		if (!node.isUsed(i)) {
+			children[i] = -1;
+		} else if (node.counts[i] > 0) {
+			children[i] = -1 - (node.children[i] * 8 + node.counts[i]);
+		} else {
+			children[i] = node.children[i];
+		}
+	}
+}
+
+/**
+ * @fn	void CompressedQBVH::build(const QBVH &qbvh)
+ * @brief	Compresses every node of a 4-wide hierarchy, keeping its layout.
+ * @param	qbvh	The full precision hierarchy.
+ */
+
+void CompressedQBVH::build(const QBVH &qbvh) {
+	clear();
+	primitiveIndices.assign(qbvh.indexArray, qbvh.indexArray + qbvh.numIndices);
+	nodes.resize(qbvh.numNodes);
+	for (int i = 0; i < qbvh.numNodes; i++) {
+		nodes[i].set(qbvh.nodeArray[i]);
+	}
+	useOwnArrays();
+}
+
+/**
+ * @fn	SceneBVH::SceneBVH()
+ * @brief	Constructs an empty, unbuilt hierarchy.
+ */
+
+SceneBVH::SceneBVH()
+	: isBuilt(false), countTraversals(false), compressed(false),
+	numRaysTraversed(0), numNodesVisited(0), numPrimitivesTested(0) {
+}
+
+/**
+ * @fn	void SceneBVH::build(const std::vector<VisibleIShapePtr> &objects, WorkStealingPool *pool)
+ * @brief	Builds the hierarchy over a list of objects, using each object's
+ * 			cached bounds.
+ * @param	objects	The objects.
+ * @param	pool   	Threads to build with, or nullptr (see BVH::build).
+ */
+
+void SceneBVH::build(const std::vector<VisibleIShapePtr> &objects, WorkStealingPool *pool) {
+	std::vector<AABB> bounds;
+	clear();
+	setObjects(objects, bounds);
+	bvh.build(bounds, pool);
+	qbvh.build(bvh);
+	if (compressed) {
+		compressedQBVH.build(qbvh);
+		bvh = BVH();
+		qbvh = QBVH();
+	}
+	isBuilt = true;
+}
+
+/**
+ * @fn	void SceneBVH::setObjects(const std::vector<VisibleIShapePtr> &objects, std::vector<AABB> &bounds)
+ * @brief	Sorts the objects into bounded and unbounded ones, and compiles
+ * 			each list into ShapePools.
+ * @param 		  	objects	The objects.
+ * @param [in,out]	bounds 	The bounds of each bounded object.
+ */
+
+void SceneBVH::setObjects(const std::vector<VisibleIShapePtr> &objects, std::vector<AABB> &bounds) {
+	for (VisibleIShapePtr obj : objects) {
+		if (obj->bounded) {
+			bounds.push_back(obj->bounds);
+			boundedObjects.push_back(obj);
+		} else {
+			unboundedObjects.push_back(obj);
+		}
+	}
+	boundedPools.compile(boundedObjects);
+	unboundedPools.compile(unboundedObjects);
+}
+
+/**
+ * @fn	bool SceneBVH::buildCached(const std::vector<VisibleIShapePtr> &objects, const std::string &cacheDirectory, WorkStealingPool *pool)
+ * @brief	Maps the 4-wide tree for these objects from a cache file, if one
+ * 			exists; otherwise builds the hierarchy and saves it there for the
+ * 			next run. Files are named after hashObjects.
+ * @param	objects		  	The objects.
+ * @param	cacheDirectory	The directory holding the cache files.
+ * @param	pool		  	Threads to build with, or nullptr (see BVH::build).
+ * @return	True if the tree was mapped from the cache; false if it was built.
+ */
+
+bool SceneBVH::buildCached(const std::vector<VisibleIShapePtr> &objects, const std::string &cacheDirectory,
+							WorkStealingPool *pool) {
+	const uint64_t hash = hashObjects(objects);
+	std::ostringstream fileName;
+	fileName << cacheDirectory << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bvh";
+	if (load(objects, fileName.str(), hash)) {
+		return true;
+	}
+	build(objects, pool);
+	save(fileName.str(), hash);
+	return false;
+}
+
+/**
+ * @fn	uint64_t SceneBVH::hashObjects(const std::vector<VisibleIShapePtr> &objects) const
+ * @brief	Hashes (64 bit FNV-1a) everything the hierarchy is built from: which
+ * 			objects are bounded, their bounds in order, and whether the tree is
+ * 			compressed. Scenes that differ only in materials or in the shapes
+ * 			within the bounds share a hierarchy.
+ * @param	objects	The objects.
+ * @return	The hash.
+ */
+
+uint64_t SceneBVH::hashObjects(const std::vector<VisibleIShapePtr> &objects) const {
+	uint64_t hash = 14695981039346656037ULL;
+	auto add = [&](const void *bytes, size_t size) {
+		for (size_t i = 0; i < size; i++) {
+			hash = (hash ^ ((const unsigned char *)bytes)[i]) * 1099511628211ULL;
+		}
+	};
+	const int numObjects = (int)objects.size();
+	const char isCompressed = compressed;
+	add(&numObjects, sizeof(numObjects));
+	add(&isCompressed, sizeof(isCompressed));
+	for (VisibleIShapePtr obj : objects) {
+		const char isBounded = obj->bounded;
+		add(&isBounded, sizeof(isBounded));
+		if (obj->bounded) {
+			add(&obj->bounds.lower[0], 3 * sizeof(float));
+			add(&obj->bounds.upper[0], 3 * sizeof(float));
+		}
+	}
+	return hash;
+}
+
+/**
+ * @fn	bool SceneBVH::load(const std::vector<VisibleIShapePtr> &objects, const std::string &fileName, uint64_t hash)
+ * @brief	Maps a 4-wide tree saved by save, read-only, in place of building
+ * 			one. The nodes are used where they lie in the mapping; pages are
+ * 			read on demand and shared with other processes that map the file.
+ * @param	objects 	The objects, which must be the ones the file was saved for.
+ * @param	fileName	Name of the cache file.
+ * @param	hash		hashObjects(objects).
+ * @return	False, leaving the hierarchy empty and unbuilt, if the file is
+ * 			missing or was saved by another version, for other objects or in
+ * 			the other mode, or if it is truncated or damaged so that its nodes
+ * 			would lead outside it (see WideBVH::isValid).
+ */
+
+bool SceneBVH::load(const std::vector<VisibleIShapePtr> &objects, const std::string &fileName, uint64_t hash) {
+	clear();
+	if (!cacheFile.open(fileName) || cacheFile.getSize() < BVH_CACHE_HEADER_SIZE) {
+		cacheFile.close();
+		return false;
+	}
+	BVHCacheHeader header;
+	std::memcpy(&header, cacheFile.getData(), sizeof(header));
+	const uint32_t nodeSize = compressed ? sizeof(CompressedQBVHNode) : sizeof(QBVHNode);
+	const int numBounded = (int)std::count_if(objects.begin(), objects.end(),
+												[](VisibleIShapePtr obj) { return obj->bounded; });
+	const uint64_t indexOffset = BVH_CACHE_HEADER_SIZE + (uint64_t)header.numNodes * nodeSize;
+	if (std::memcmp(header.magic, BVH_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != BVH_CACHE_VERSION || header.nodeSize != nodeSize ||
+		header.sceneHash != hash || header.numIndices != numBounded ||
+		header.indexOffset != indexOffset || header.numNodes < 0 ||
+		cacheFile.getSize() < indexOffset + (uint64_t)header.numIndices * sizeof(int)) {
+		cacheFile.close();
+		return false;
+	}
+
+	const char *data = cacheFile.getData();
+	const int *indices = (const int *)(data + indexOffset);
+	bool valid;
+	if (compressed) {
+		compressedQBVH.setArrays((const CompressedQBVHNode *)(data + BVH_CACHE_HEADER_SIZE), header.numNodes,
+								indices, header.numIndices);
+		valid = compressedQBVH.isValid(numBounded);
+	} else {
+		qbvh.setArrays((const QBVHNode *)(data + BVH_CACHE_HEADER_SIZE), header.numNodes,
+						indices, header.numIndices);
+		valid = qbvh.isValid(numBounded);
+	}
+	if (!valid) {
+		clear();
+		return false;
+	}
+
+	std::vector<AABB> bounds;
+	setObjects(objects, bounds);
+	isBuilt = true;
+	return true;
+}
+
+/**
+ * @fn	bool SceneBVH::save(const std::string &fileName, uint64_t hash) const
+ * @brief	Saves the 4-wide tree for load: a header, then the nodes exactly
+ * 			as they lie in memory, then the primitive indices. The file is
+ * 			written under a temporary name unique to this process and call,
+ * 			and renamed into place, so processes saving the same scene at once
+ * 			never write to the same file, and none maps a partial one.
+ * @param	fileName	Name of the cache file.
+ * @param	hash		hashObjects of the objects the hierarchy was built over.
+ * @return	True iff the file was written.
+ */
+
+bool SceneBVH::save(const std::string &fileName, uint64_t hash) const {
+	const char *nodeData;
+	uint32_t nodeSize;
+	int numNodes;
+	const int *indices;
+	int numIndices;
+	if (compressed) {
+		nodeData = (const char *)compressedQBVH.nodeArray;
+		nodeSize = sizeof(CompressedQBVHNode);
+		numNodes = compressedQBVH.numNodes;
+		indices = compressedQBVH.indexArray;
+		numIndices = compressedQBVH.numIndices;
+	} else {
+		nodeData = (const char *)qbvh.nodeArray;
+		nodeSize = sizeof(QBVHNode);
+		numNodes = qbvh.numNodes;
+		indices = qbvh.indexArray;
+		numIndices = qbvh.numIndices;
+	}
+
+	BVHCacheHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, BVH_CACHE_MAGIC, sizeof(header.magic));
+	header.version = BVH_CACHE_VERSION;
+	header.nodeSize = nodeSize;
+	header.sceneHash = hash;
+	header.numNodes = numNodes;
+	header.numIndices = numIndices;
+	header.indexOffset = BVH_CACHE_HEADER_SIZE + (uint64_t)numNodes * nodeSize;
+
+	static std::atomic<int> numSaves(0);
+	std::ostringstream tempStream;
+	tempStream << fileName << "." << getpid() << "." << numSaves++ << ".tmp";
+	const std::string tempName = tempStream.str();
+	std::ofstream out(tempName, std::ios::binary);
+	char padding[BVH_CACHE_HEADER_SIZE] = {};
+	out.write((const char *)&header, sizeof(header));
+	out.write(padding, BVH_CACHE_HEADER_SIZE - sizeof(header));
+	out.write(nodeData, (std::streamsize)numNodes * nodeSize);
+	out.write((const char *)indices, (std::streamsize)numIndices * sizeof(int));
+	out.close();
+	if (!out) {
+		std::remove(tempName.c_str());
+		return false;
+	}
+	if (std::rename(tempName.c_str(), fileName.c_str()) != 0) {
+		// Windows will not rename over an existing file.
+		std::remove(fileName.c_str());
+		if (std::rename(tempName.c_str(), fileName.c_str()) != 0) {
+			std::remove(tempName.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	bool SceneBVH::refit(const std::vector<VisibleIShapePtr> &objects)
+ * @brief	Updates the hierarchy after objects have moved or changed shape,
+ * 			using each object's cached bounds (see VisibleIShape::updateBounds).
+ * 			The boxes are refit in place, unless the objects are no longer the
+ * 			ones it was built over, or refitting has raised its SAH cost by
+ * 			more than BVH_MAX_COST_GROWTH; then it is rebuilt. Either way the
+ * 			4-wide tree is collapsed again from the binary one. In compressed
+ * 			mode, or after load, there is no binary tree to refit, so it is
+ * 			always rebuilt.
+ * @param	objects	The objects, as passed to build.
+ * @return	True if the hierarchy was rebuilt.
+ */
+
+bool SceneBVH::refit(const std::vector<VisibleIShapePtr> &objects) {
+	std::vector<AABB> bounds;
+	bounds.reserve(boundedObjects.size());
+	size_t numUnbounded = 0;
+	bool sameObjects = isBuilt;
+	for (size_t i = 0; i < objects.size() && sameObjects; i++) {
+		VisibleIShapePtr obj = objects[i];
+		if (obj->bounded) {
+			sameObjects = bounds.size() < boundedObjects.size() && boundedObjects[bounds.size()] == obj;
+			bounds.push_back(obj->bounds);
+		} else {
+			sameObjects = numUnbounded < unboundedObjects.size() && unboundedObjects[numUnbounded] == obj;
+			numUnbounded++;
+		}
+	}
+	if (!sameObjects || bounds.size() != boundedObjects.size() || numUnbounded != unboundedObjects.size() ||
+		(bvh.isEmpty() && !boundedObjects.empty())) {
+		build(objects);
+		return true;
+	}
+
+	bvh.refit(bounds);
+	if (bvh.cost() > BVH_MAX_COST_GROWTH * bvh.builtCost) {
+		build(objects);
+		return true;
+	}
+	qbvh.build(bvh);
+	boundedPools.update();
+	unboundedPools.update();
+	return false;
+}
+
+/**
+ * @fn	void SceneBVH::clear()
+ * @brief	Removes all objects.
+ */
+
+void SceneBVH::clear() {
+	bvh.clear();
+	qbvh.clear();
+	compressedQBVH.clear();
+	cacheFile.close();
+	boundedObjects.clear();
+	unboundedObjects.clear();
+	boundedPools.clear();
+	unboundedPools.clear();
+	isBuilt = false;
+}
+
+/**
+ * @fn	template <class IntersectPrimitive> void SceneBVH::traverse(const Ray &ray, float &tMax, IntersectPrimitive intersectPrimitive) const
+ * @brief	Traverses whichever 4-wide hierarchy is kept, tallying the work if
+ * 			countTraversals is set (see WideBVH::traverse).
+ * @tparam	IntersectPrimitive	Callable as bool(int primitive, float &tMax).
+ * @param 		  	ray					The ray.
+ * @param [in,out]	tMax				The farthest t of interest.
+ * @param 		  	intersectPrimitive	Intersects a single primitive.
+ */
+
+template <class IntersectPrimitive>
+void SceneBVH::traverse(const Ray &ray, float &tMax, IntersectPrimitive intersectPrimitive) const {
+	BVHTraversalStats stats;
+	BVHTraversalStats *counted = countTraversals ? &stats : nullptr;
+	if (compressed) {
+		compressedQBVH.traverse(ray, tMax, intersectPrimitive, counted);
+	} else {
+		qbvh.traverse(ray, tMax, intersectPrimitive, counted);
+	}
+	if (countTraversals) {
+		tally(stats);
+	}
+}
+
+/**
+ * @fn	HitRecord SceneBVH::findIntersection(const Ray &ray) const
+ * @brief	Finds the closest intersection in front of the ray's origin. Gives the
+ * 			same answer as VisibleIShape::findIntersection over all the objects.
+ * @param	ray	The ray.
+ * @return	The closest hit, if any.
+ */
+
+HitRecord SceneBVH::findIntersection(const Ray &ray) const {
+	ClosestHit closest;
+	findClosestHit(ray, closest);
+
+	HitRecord theHit;
+	closest.complete(ray, theHit);
+	return theHit;
+}
+
+/**
+ * @fn	void SceneBVH::findClosestHit(const Ray &ray, ClosestHit &closest) const
+ * @brief	Searches the objects for the closest hit in front of the ray's
+ * 			origin, without computing its hit record.
+ * @param 		  	ray	   	The ray.
+ * @param [in,out]	closest	The closest hit so far; replaced by any closer one.
+ */
+
+void SceneBVH::findClosestHit(const Ray &ray, ClosestHit &closest) const {
+	unboundedPools.updateClosestHit(ray, closest);
+
+	float tMax = closest.t;
+	traverse(ray, tMax, [&](int prim, float &tMax) {
+		if (boundedPools.updateClosestHit(prim, ray, closest)) {
+			tMax = closest.t;
+		}
+		return false;
+	});
+}
+
+/**
+ * @fn	void SceneBVH::findIntersections(const RayPacket &packet, HitRecord hits[MAX_PACKET_SIZE]) const
+ * @brief	Finds the closest object hit by each ray in a packet, traversing
+ * 			the hierarchy once for the whole packet.
+ * @param 		  	packet	The packet.
+ * @param [in,out]	hits  	The closest hit for each ray.
+ */
+
+void SceneBVH::findIntersections(const RayPacket &packet, HitRecord hits[MAX_PACKET_SIZE]) const {
+	PacketHits closest;
+	for (VisibleIShapePtr obj : unboundedObjects) {
+		obj->updateClosestHits(packet, closest);
+	}
+
+	auto intersectPrimitive = [&](int prim) {
+		boundedObjects[prim]->updateClosestHits(packet, closest);
+	};
+	if (!bvh.isEmpty()) {
+		bvh.traverse(packet, closest.t, intersectPrimitive);
+	} else if (compressed) {
+		compressedQBVH.traverse(packet, closest.t, intersectPrimitive);
+	} else {
+		qbvh.traverse(packet, closest.t, intersectPrimitive);
+	}
+	closest.complete(packet, hits);
+}
+
+/**
+ * @fn	void SceneBVH::intersect(const RayBatch &rays, HitBatch &hits) const
+ * @brief	Finds the closest object hit by each active ray in a batch. The rays
+ * 			need not be coherent: each one traverses the hierarchy on its own,
+ * 			and meets the objects through their ShapePools.
+ * @param 		  	rays	The rays.
+ * @param [in,out]	hits	The closest hits so far; replaced by closer ones.
+ */
+
+void SceneBVH::intersect(const RayBatch &rays, HitBatch &hits) const {
+	for (int i = 0; i < rays.size(); i++) {
+		if (rays.active[i]) {
+			ClosestHit closest(hits.t[i] - rays.tMin[i]);
+			findClosestHit(rays.getRay(i), closest);
+			if (closest.object != nullptr) {
+				hits.t[i] = rays.tMin[i] + closest.t;
+				hits.objects[i] = closest.object;
+				hits.primitives[i] = closest.primitive;
+			}
+		}
+	}
+}
+
+/**
+ * @fn	bool SceneBVH::occluded(const Ray &ray, float tMax) const
+ * @brief	Determines if any object blocks the ray in (0, tMax). The traversal
+ * 			stops at the first blocker found, in whatever order.
+ * @param	ray 	The ray.
+ * @param	tMax	The farthest t of interest (e.g., the distance to a light).
+ * @return	True iff some object blocks the ray.
+ */
+
+bool SceneBVH::occluded(const Ray &ray, float tMax) const {
+	if (unboundedPools.occluded(ray, tMax)) {
+		return true;
+	}
+
+	bool blocked = false;
+	traverse(ray, tMax, [&](int prim, float &tMax) {
+		blocked = boundedPools.occludes(prim, ray, tMax);
+		return blocked;
+	});
+	return blocked;
+}
+
+/**
+ * @fn	void SceneBVH::occlude(RayBatch &rays) const
+ * @brief	Clears the active flag of every active ray in a batch that some
+ * 			object blocks between its tMin and tMax.
+ * @param [in,out]	rays	The rays.
+ */
+
+void SceneBVH::occlude(RayBatch &rays) const {
+	for (int i = 0; i < rays.size(); i++) {
+		if (rays.active[i] && occluded(rays.getRay(i), rays.getLength(i))) {
+			rays.active[i] = 0;
+		}
+	}
+}
+
+/**
+ * @fn	void SceneBVH::findAllIntersections(const Ray &ray, float tMax, std::vector<HitRecord> &hits) const
+ * @brief	Collects the closest hit on each object that lies in (0, tMax), in a
+ * 			single traversal. The hits are appended in no particular order.
+ * @param 		  	ray 	The ray.
+ * @param 		  	tMax	The farthest t of interest.
+ * @param [in,out]	hits	The hits found.
+ */
+
+void SceneBVH::findAllIntersections(const Ray &ray, float tMax, std::vector<HitRecord> &hits) const {
+	VisibleIShape::findAllIntersections(ray, tMax, unboundedObjects, hits);
+
+	traverse(ray, tMax, [&](int prim, float &tMax) {
+		ClosestHit closest(tMax);
+		if (boundedPools.updateClosestHit(prim, ray, closest)) {
+			hits.push_back(HitRecord());
+			closest.complete(ray, hits.back());
+		}
+		return false;
+	});
+}
+
+/**
+ * @fn	BVHTraversalStats SceneBVH::getTraversalStats() const
+ * @brief	Gets the work done by single ray traversals while countTraversals
+ * 			was set, since the last resetTraversalStats.
+ * @return	The totals.
+ */
+
+BVHTraversalStats SceneBVH::getTraversalStats() const {
+	BVHTraversalStats stats;
+	stats.numRays = numRaysTraversed;
+	stats.numNodes = numNodesVisited;
+	stats.numPrimitives = numPrimitivesTested;
+	return stats;
+}
+
+/**
+ * @fn	void SceneBVH::resetTraversalStats()
+ * @brief	Zeroes the traversal tallies.
+ */
+
+void SceneBVH::resetTraversalStats() {
+	numRaysTraversed = 0;
+	numNodesVisited = 0;
+	numPrimitivesTested = 0;
+}
+
+/**
+ * @fn	void SceneBVH::tally(const BVHTraversalStats &stats) const
+ * @brief	Adds the work of one traversal to the tallies. Called from every
+ * 			rendering thread, which is why counting is off by default.
+ * @param	stats	The work done.
+ */
+
+void SceneBVH::tally(const BVHTraversalStats &stats) const {
+	numRaysTraversed.fetch_add(stats.numRays, std::memory_order_relaxed);
+	numNodesVisited.fetch_add(stats.numNodes, std::memory_order_relaxed);
+	numPrimitivesTested.fetch_add(stats.numPrimitives, std::memory_order_relaxed);
+}
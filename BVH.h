@@ -0,0 +1,707 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include "Defs.h"
+#include "IShape.h"
+#include "ShapePools.h"
+#include "MappedFile.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SSE		//!< The QBVH slab test uses SSE2, which every x86-64 CPU has.
+#include <emmintrin.h>
+#endif
+
+const int BVH_NUM_BINS = 16;		//!< Number of bins used to evaluate SAH splits.
+const int BVH_MAX_LEAF_SIZE = 4;	//!< Largest number of primitives placed in one leaf.
+const int BVH_MAX_DEPTH = 64;		//!< Depth after which nodes are split at the median.
+const int BVH_STACK_SIZE = 128;		//!< Size of the traversal stack.
+const float BVH_MAX_COST_GROWTH = 1.5f;	//!< Refitting gives way to a rebuild once the SAH cost has grown by this factor.
+const int BVH_PARALLEL_BIN_SIZE = 65536;	//!< Nodes with more primitives than this are binned by all threads.
+const int BVH_MIN_TASK_SIZE = 4096;		//!< Subtrees at least this large are built as separate tasks.
+const int BVH_TASKS_PER_THREAD = 8;		//!< Subtree tasks per thread in a parallel build.
+const int QBVH_WIDTH = 4;				//!< Children per QBVH node: one SSE register of each coordinate.
+const int QBVH_STACK_SIZE = (QBVH_WIDTH - 1) * BVH_STACK_SIZE;	//!< Size of the QBVH traversal stack.
+
+struct WorkStealingPool;
+struct BVHPrimitive;
+
+/**
+ * @struct	BVHNode
+ * @brief	One node of a flattened bounding volume hierarchy. An interior
+ * 			node's first child immediately follows it in the node array; the
+ * 			second child is at 'offset'. A leaf references 'count' primitives
+ * 			starting at 'offset' in BVH::primitiveIndices.
+ */
+
+struct BVHNode {
+	AABB box;		//!< Bounds of everything below this node.
+	int offset;		//!< Leaf: first primitive. Interior: index of second child.
+	int count;		//!< Number of primitives in a leaf; 0 for interior nodes.
+	int axis;		//!< Axis the primitives were split along (interior only).
+};
+
+/**
+ * @struct	BVHStats
+ * @brief	Size and quality of a built hierarchy.
+ */
+
+struct BVHStats {
+	int numNodes;			//!< Interior nodes and leaves.
+	int numLeaves;			//!< Leaves.
+	int maxDepth;			//!< Depth of the deepest leaf; the root is at depth 0.
+	size_t memoryBytes;		//!< Memory held by the nodes and primitive indices.
+	float sahCost;			//!< Surface area heuristic cost (see BVH::cost).
+	float buildSeconds;		//!< Time taken by the last build.
+	friend std::ostream &operator << (std::ostream &os, const BVHStats &stats);
+};
+
+/**
+ * @struct	BVHTraversalStats
+ * @brief	Work done by ray traversals, for tuning the hierarchy.
+ */
+
+struct BVHTraversalStats {
+	long long numRays;			//!< Traversals.
+	long long numNodes;			//!< Nodes whose children were tested against a ray.
+	long long numPrimitives;	//!< Primitives tested against a ray.
+	BVHTraversalStats() : numRays(0), numNodes(0), numPrimitives(0) {}
+	friend std::ostream &operator << (std::ostream &os, const BVHTraversalStats &stats);
+};
+
+/**
+ * @struct	BVH
+ * @brief	A bounding volume hierarchy over a set of primitives, each described
+ * 			only by its bounding box. Built top-down with binned SAH. The
+ * 			hierarchy knows nothing about what the primitives are; callers
+ * 			supply a function that intersects primitive i.
+ */
+
+struct BVH {
+	std::vector<BVHNode> nodes;			//!< Nodes in depth first order; 0 is the root.
+	std::vector<int> primitiveIndices;	//!< Primitive numbers, grouped by leaf.
+	float builtCost;					//!< SAH cost right after the last build.
+	int numRefits;						//!< Refits since the last build.
+	float buildSeconds;					//!< Time taken by the last build.
+	BVH();
+	void build(const std::vector<AABB> &primitiveBounds, WorkStealingPool *pool = nullptr);
+	void refit(const std::vector<AABB> &primitiveBounds);
+	float cost() const;
+	BVHStats getStats() const;
+	void clear();
+	bool isEmpty() const { return nodes.empty(); }
+	template <class IntersectPrimitive>
+	void traverse(const Ray &ray, float &tMax, IntersectPrimitive intersectPrimitive) const;
+	template <class IntersectPrimitive>
+	void traverse(const RayPacket &packet, const float tMax[MAX_PACKET_SIZE], IntersectPrimitive intersectPrimitive) const;
+protected:
+	int splitNode(std::vector<BVHPrimitive> &primitives, int begin, int end, int depth,
+					BVHNode &node, WorkStealingPool *pool);
+	void buildSubtree(std::vector<BVHPrimitive> &primitives, int nodeIndex, int begin, int end, int depth);
+	void compactNodes();
+};
+
+/**
+ * @fn	template <class IntersectPrimitive> void BVH::traverse(const Ray &ray, float &tMax, IntersectPrimitive intersectPrimitive) const
+ * @brief	Visits every leaf whose box the ray enters before tMax, nearer child
+ * 			first. intersectPrimitive(i, tMax) is called for each primitive in
+ * 			those leaves; it may lower tMax to cull farther nodes, and returns
+ * 			true to stop the traversal altogether.
+ * @tparam	IntersectPrimitive	Callable as bool(int primitive, float &tMax).
+ * @param 		  	ray					The ray.
+ * @param [in,out]	tMax				The farthest t of interest.
+ * @param 		  	intersectPrimitive	Intersects a single primitive.
+ */
+
+template <class IntersectPrimitive>
+void BVH::traverse(const Ray &ray, float &tMax, IntersectPrimitive intersectPrimitive) const {
+	if (nodes.empty()) {
+		return;
+	}
+	const glm::vec3 invDirection = 1.0f / ray.direction;
+	const bool directionIsNegative[3] = { invDirection.x < 0, invDirection.y < 0, invDirection.z < 0 };
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	int current = 0;
+
+	while (true) {
+		const BVHNode &node = nodes[current];
+		if (node.box.intersects(ray.origin, invDirection, tMax)) {
+			if (node.count > 0) {
+				for (int i = 0; i < node.count; i++) {
+					if (intersectPrimitive(primitiveIndices[node.offset + i], tMax)) {
+						return;
+					}
+				}
+			} else if (directionIsNegative[node.axis]) {
+				stack[stackSize++] = current + 1;
+				current = node.offset;
+				continue;
+			} else {
+				stack[stackSize++] = node.offset;
+				current = current + 1;
+				continue;
+			}
+		}
+		if (stackSize == 0) {
+			return;
+		}
+		current = stack[--stackSize];
+	}
+}
+
+/**
+ * @fn	template <class IntersectPrimitive> void BVH::traverse(const RayPacket &packet, const float tMax[MAX_PACKET_SIZE], IntersectPrimitive intersectPrimitive) const
+ * @brief	Packet version of traverse. A node is visited if any ray in the
+ * 			packet enters its box before that ray's tMax. Children are ordered
+ * 			by the direction of the first ray, which suits coherent packets.
+ * @tparam	IntersectPrimitive	Callable as void(int primitive).
+ * @param	packet				The packet.
+ * @param	tMax				The farthest t of interest for each ray; the
+ * 								caller may lower these from intersectPrimitive.
+ * @param	intersectPrimitive	Intersects a single primitive with the packet.
+ */
+
+template <class IntersectPrimitive>
+void BVH::traverse(const RayPacket &packet, const float tMax[MAX_PACKET_SIZE], IntersectPrimitive intersectPrimitive) const {
+	if (nodes.empty()) {
+		return;
+	}
+	const bool directionIsNegative[3] = { packet.ix[0] < 0, packet.iy[0] < 0, packet.iz[0] < 0 };
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	int current = 0;
+
+	while (true) {
+		const BVHNode &node = nodes[current];
+		if (intersectBoxPacket(packet, &node.box.lower[0], &node.box.upper[0], tMax) != 0) {
+			if (node.count > 0) {
+				for (int i = 0; i < node.count; i++) {
+					intersectPrimitive(primitiveIndices[node.offset + i]);
+				}
+			} else if (directionIsNegative[node.axis]) {
+				stack[stackSize++] = current + 1;
+				current = node.offset;
+				continue;
+			} else {
+				stack[stackSize++] = node.offset;
+				current = current + 1;
+				continue;
+			}
+		}
+		if (stackSize == 0) {
+			return;
+		}
+		current = stack[--stackSize];
+	}
+}
+
+/**
+ * @struct	QBVHRay
+ * @brief	A ray set up for QBVH slab tests, with each coordinate of its origin
+ * 			and inverse direction repeated across the four children.
+ */
+
+struct QBVHRay {
+#if defined(BVH_SSE)
+	__m128 origin[3];		//!< Origin, one coordinate per register.
+	__m128 invDirection[3];	//!< 1/direction, one coordinate per register.
+	QBVHRay(const Ray &ray) {
+		const glm::vec3 inv = 1.0f / ray.direction;
+		for (int i = 0; i < 3; i++) {
+			origin[i] = _mm_set1_ps(ray.origin[i]);
+			invDirection[i] = _mm_set1_ps(inv[i]);
+		}
+	}
+#else
+	glm::vec3 origin;		//!< Origin.
+	glm::vec3 invDirection;	//!< 1/direction.
+	QBVHRay(const Ray &ray) : origin(ray.origin), invDirection(1.0f / ray.direction) {}
+#endif
+};
+
+/**
+ * @struct	QBVHNode
+ * @brief	One node of a 4-wide BVH. The bounds of the children are stored one
+ * 			coordinate per array, so that a single SSE slab test checks all
+ * 			four. A node fills exactly two cache lines.
+ */
+
+struct alignas(64) QBVHNode {
+	alignas(16) float lower[3][QBVH_WIDTH];	//!< lower[axis][i]: lower corner of child i.
+	alignas(16) float upper[3][QBVH_WIDTH];	//!< upper[axis][i]: upper corner of child i.
+	alignas(16) int children[QBVH_WIDTH];	//!< Interior child: its node. Leaf: its first primitive.
+	alignas(16) int counts[QBVH_WIDTH];		//!< Primitives in a leaf child; 0 for an interior child; -1 for an unused slot.
+	int intersect(const QBVHRay &ray, float tMax, float tNear[QBVH_WIDTH]) const;
+	void getChild(int i, int &child, int &count) const { child = children[i]; count = counts[i]; }
+	bool isUsed(int i) const { return counts[i] >= 0; }
+	void getBounds(int i, float childLower[3], float childUpper[3]) const;
+};
+
+static_assert(sizeof(QBVHNode) == 128, "QBVHNode should fill two cache lines");
+
+/**
+ * @fn	inline int QBVHNode::intersect(const QBVHRay &ray, float tMax, float tNear[QBVH_WIDTH]) const
+ * @brief	Slab test of a ray against the boxes of all the children at once.
+ * 			The arithmetic matches AABB::intersects, so a child passes exactly
+ * 			when its box would.
+ * @param 		  	ray  	The ray.
+ * @param 		  	tMax 	The farthest t of interest.
+ * @param [out]		tNear	Where the ray enters each child's box, clipped to 0.
+ * @return	A mask with bit i set iff the ray passes through child i within [0, tMax].
+ */
+
+inline int QBVHNode::intersect(const QBVHRay &ray, float tMax, float tNear[QBVH_WIDTH]) const {
+#if defined(BVH_SSE)
+	__m128 tEntry = _mm_setzero_ps();
+	__m128 tExit = _mm_set1_ps(tMax);
+	for (int i = 0; i < 3; i++) {
+		const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(lower[i]), ray.origin[i]), ray.invDirection[i]);
+		const __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(upper[i]), ray.origin[i]), ray.invDirection[i]);
+		// Operand order matches std::min and std::max when a t is NaN
+		tEntry = _mm_max_ps(_mm_min_ps(t2, t1), tEntry);
+		tExit = _mm_min_ps(_mm_mul_ps(_mm_max_ps(t2, t1), _mm_set1_ps(SLAB_EXIT_SCALE)), tExit);
+	}
+	_mm_storeu_ps(tNear, tEntry);
+	const __m128i used = _mm_cmpgt_epi32(_mm_load_si128((const __m128i *)counts), _mm_set1_epi32(-1));
+	return _mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(tEntry, tExit), _mm_castsi128_ps(used)));
+#else
+	int mask = 0;
+	for (int c = 0; c < QBVH_WIDTH; c++) {
+		float tEntry = 0.0f;
+		float tExit = tMax;
+		for (int i = 0; i < 3; i++) {
+			float t1 = (lower[i][c] - ray.origin[i]) * ray.invDirection[i];
+			float t2 = (upper[i][c] - ray.origin[i]) * ray.invDirection[i];
+			tEntry = std::max(tEntry, std::min(t1, t2));
+			tExit = std::min(tExit, std::max(t1, t2) * SLAB_EXIT_SCALE);
+		}
+		tNear[c] = tEntry;
+		if (tEntry <= tExit && counts[c] >= 0) {
+			mask |= 1 << c;
+		}
+	}
+	return mask;
+#endif
+}
+
+/**
+ * @fn	inline void QBVHNode::getBounds(int i, float childLower[3], float childUpper[3]) const
+ * @brief	Gets the box of one child.
+ * @param 	  	i		  	The child.
+ * @param [out]	childLower	The box's lower corner.
+ * @param [out]	childUpper	The box's upper corner.
+ */
+
+inline void QBVHNode::getBounds(int i, float childLower[3], float childUpper[3]) const {
+	for (int axis = 0; axis < 3; axis++) {
+		childLower[axis] = lower[axis][i];
+		childUpper[axis] = upper[axis][i];
+	}
+}
+
+/**
+ * @struct	CompressedQBVHNode
+ * @brief	A QBVHNode in half the space, for large scenes. The children's
+ * 			bounds are stored in 8 bits per coordinate, as steps from the lower
+ * 			corner of the node's own box, rounded outward so that each
+ * 			child's box only grows. A leaf child's first primitive and count
+ * 			are packed into its child reference. A node fills one cache line.
+ */
+
+struct alignas(64) CompressedQBVHNode {
+	float origin[3];						//!< Lower corner of the node's box.
+	float scale[3];							//!< Length of one step along each axis; a power of 2.
+	unsigned char lower[3][QBVH_WIDTH];		//!< lower[axis][i]: lower corner of child i, in steps from origin.
+	unsigned char upper[3][QBVH_WIDTH];		//!< upper[axis][i]: upper corner of child i, in steps from origin.
+	alignas(16) int children[QBVH_WIDTH];	//!< Interior child: its node. Leaf: -1 - (first primitive * 8 + count). -1 for an unused slot.
+	int intersect(const QBVHRay &ray, float tMax, float tNear[QBVH_WIDTH]) const;
+	void getChild(int i, int &child, int &count) const;
+	bool isUsed(int i) const { return children[i] != -1; }
+	void getBounds(int i, float childLower[3], float childUpper[3]) const;
+	void set(const QBVHNode &node);
+	float lowerBound(int axis, int i) const { return origin[axis] + lower[axis][i] * scale[axis]; }
+	float upperBound(int axis, int i) const { return origin[axis] + upper[axis][i] * scale[axis]; }
+};
+
+static_assert(sizeof(CompressedQBVHNode) == 64, "CompressedQBVHNode should fill one cache line");
+static_assert(BVH_MAX_LEAF_SIZE < 8, "Leaf counts are packed into 3 bits");
+
+/**
+ * @fn	inline int CompressedQBVHNode::intersect(const QBVHRay &ray, float tMax, float tNear[QBVH_WIDTH]) const
+ * @brief	Slab test of a ray against the boxes of all the children at once,
+ * 			as for QBVHNode::intersect. Each corner is computed as
+ * 			origin + steps * scale; the product is exact, since scale is a power
+ * 			of 2, so this gives the same boxes as lowerBound and upperBound.
+ * @param 		  	ray  	The ray.
+ * @param 		  	tMax 	The farthest t of interest.
+ * @param [out]		tNear	Where the ray enters each child's box, clipped to 0.
+ * @return	A mask with bit i set iff the ray passes through child i within [0, tMax].
+ */
+
+inline int CompressedQBVHNode::intersect(const QBVHRay &ray, float tMax, float tNear[QBVH_WIDTH]) const {
+#if defined(BVH_SSE)
+	const __m128i zero = _mm_setzero_si128();
+	auto unpack = [&](const unsigned char steps[QBVH_WIDTH], int axis) {
+		int packed;
+		std::memcpy(&packed, steps, sizeof(packed));
+		const __m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+		return _mm_add_ps(_mm_set1_ps(origin[axis]), _mm_mul_ps(_mm_cvtepi32_ps(wide), _mm_set1_ps(scale[axis])));
+	};
+	__m128 tEntry = _mm_setzero_ps();
+	__m128 tExit = _mm_set1_ps(tMax);
+	for (int i = 0; i < 3; i++) {
+		const __m128 t1 = _mm_mul_ps(_mm_sub_ps(unpack(lower[i], i), ray.origin[i]), ray.invDirection[i]);
+		const __m128 t2 = _mm_mul_ps(_mm_sub_ps(unpack(upper[i], i), ray.origin[i]), ray.invDirection[i]);
+		// Operand order matches std::min and std::max when a t is NaN
+		tEntry = _mm_max_ps(_mm_min_ps(t2, t1), tEntry);
+		tExit = _mm_min_ps(_mm_mul_ps(_mm_max_ps(t2, t1), _mm_set1_ps(SLAB_EXIT_SCALE)), tExit);
+	}
+	_mm_storeu_ps(tNear, tEntry);
+	const __m128i unused = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *)children), _mm_set1_epi32(-1));
+	return _mm_movemask_ps(_mm_andnot_ps(_mm_castsi128_ps(unused), _mm_cmple_ps(tEntry, tExit)));
+#else
+	int mask = 0;
+	for (int c = 0; c < QBVH_WIDTH; c++) {
+		float tEntry = 0.0f;
+		float tExit = tMax;
+		for (int i = 0; i < 3; i++) {
+			float t1 = (lowerBound(i, c) - ray.origin[i]) * ray.invDirection[i];
+			float t2 = (upperBound(i, c) - ray.origin[i]) * ray.invDirection[i];
+			tEntry = std::max(tEntry, std::min(t1, t2));
+			tExit = std::min(tExit, std::max(t1, t2) * SLAB_EXIT_SCALE);
+		}
+		tNear[c] = tEntry;
+		if (tEntry <= tExit && isUsed(c)) {
+			mask |= 1 << c;
+		}
+	}
+	return mask;
+#endif
+}
+
+/**
+ * @fn	inline void CompressedQBVHNode::getChild(int i, int &child, int &count) const
+ * @brief	Unpacks a child reference.
+ * @param 	  	i	 	The child.
+ * @param [out]	child	Interior child: its node. Leaf: its first primitive.
+ * @param [out]	count	Primitives in a leaf; 0 for an interior child.
+ */
+
+inline void CompressedQBVHNode::getChild(int i, int &child, int &count) const {
+	if (children[i] >= 0) {
+		child = children[i];
+		count = 0;
+	} else {
+		const int leaf = -1 - children[i];
+		child = leaf >> 3;
+		count = leaf & 7;
+	}
+}
+
+/**
+ * @fn	inline void CompressedQBVHNode::getBounds(int i, float childLower[3], float childUpper[3]) const
+ * @brief	Gets the (slightly enlarged) box of one child.
+ * @param 	  	i		  	The child.
+ * @param [out]	childLower	The box's lower corner.
+ * @param [out]	childUpper	The box's upper corner.
+ */
+
+inline void CompressedQBVHNode::getBounds(int i, float childLower[3], float childUpper[3]) const {
+	for (int axis = 0; axis < 3; axis++) {
+		childLower[axis] = lowerBound(axis, i);
+		childUpper[axis] = upperBound(axis, i);
+	}
+}
+
+/**
+ * @struct	WideBVH
+ * @brief	A 4-wide bounding volume hierarchy. Nodes are stored contiguously
+ * 			in depth first order, and each leaf references a contiguous run of
+ * 			primitive indices. Single rays traverse it with one slab test per
+ * 			node instead of one per child. Traversals read the nodes and indices
+ * 			through nodeArray and indexArray, which point either at this
+ * 			hierarchy's own vectors or at a read-only mapped cache file.
+ * @tparam	Node	QBVHNode or CompressedQBVHNode.
+ */
+
+template <class Node>
+struct WideBVH {
+	std::vector<Node> nodes;			//!< Nodes built in memory, in depth first order; 0 is the root.
+	std::vector<int> primitiveIndices;	//!< Primitive numbers, grouped by leaf.
+	const Node *nodeArray;				//!< The nodes traversed: nodes, or nodes in a mapped file.
+	const int *indexArray;				//!< The primitive indices used: primitiveIndices, or indices in a mapped file.
+	int numNodes;						//!< Number of nodes in nodeArray.
+	int numIndices;						//!< Number of indices in indexArray.
+	WideBVH() : nodeArray(nullptr), indexArray(nullptr), numNodes(0), numIndices(0) {}
+	void clear() { nodes.clear(); primitiveIndices.clear(); setArrays(nullptr, 0, nullptr, 0); }
+	bool isEmpty() const { return numNodes == 0; }
+	bool isMapped() const { return numNodes > 0 && nodeArray != nodes.data(); }
+	size_t memoryBytes() const { return nodes.capacity() * sizeof(Node) + primitiveIndices.capacity() * sizeof(int); }
+	void setArrays(const Node *theNodes, int nodeCount, const int *theIndices, int indexCount) {
+		nodeArray = theNodes;
+		numNodes = nodeCount;
+		indexArray = theIndices;
+		numIndices = indexCount;
+	}
+	void useOwnArrays() { setArrays(nodes.data(), (int)nodes.size(), primitiveIndices.data(), (int)primitiveIndices.size()); }
+	bool isValid(int numPrimitives) const;
+	template <class IntersectPrimitive>
+	void traverse(const Ray &ray, float &tMax, IntersectPrimitive intersectPrimitive,
+					BVHTraversalStats *stats = nullptr) const;
+	template <class IntersectPrimitive>
+	void traverse(const RayPacket &packet, const float tMax[MAX_PACKET_SIZE], IntersectPrimitive intersectPrimitive) const;
+};
+
+/**
+ * @struct	QBVH
+ * @brief	A 4-wide hierarchy made by collapsing a binary BVH: each node takes
+ * 			the place of up to three levels of binary nodes.
+ */
+
+struct QBVH : WideBVH<QBVHNode> {
+	void build(const BVH &bvh);
+protected:
+	int collapse(const BVH &bvh, int binaryNode);
+};
+
+/**
+ * @struct	CompressedQBVH
+ * @brief	A QBVH with compressed nodes: the same tree in half the memory, in
+ * 			exchange for decoding the child bounds at every node and visiting
+ * 			a few more nodes and primitives through the enlarged boxes. The
+ * 			closest hits found are the same.
+ */
+
+struct CompressedQBVH : WideBVH<CompressedQBVHNode> {
+	void build(const QBVH &qbvh);
+};
+
+/**
+ * @fn	template <class Node> template <class IntersectPrimitive> void WideBVH<Node>::traverse(const Ray &ray, float &tMax, IntersectPrimitive intersectPrimitive, BVHTraversalStats *stats) const
+ * @brief	Visits every leaf whose box the ray enters before tMax, nearest box
+ * 			first. intersectPrimitive(i, tMax) is called for each primitive in
+ * 			those leaves; it may lower tMax to cull farther boxes, including
+ * 			those already on the stack, and returns true to stop the traversal
+ * 			altogether.
+ * @tparam	IntersectPrimitive	Callable as bool(int primitive, float &tMax).
+ * @param 		  	ray					The ray.
+ * @param [in,out]	tMax				The farthest t of interest.
+ * @param 		  	intersectPrimitive	Intersects a single primitive.
+ * @param [in,out]	stats				If not nullptr, the work done is added to it.
+ */
+
+template <class Node>
+template <class IntersectPrimitive>
+void WideBVH<Node>::traverse(const Ray &ray, float &tMax, IntersectPrimitive intersectPrimitive,
+							BVHTraversalStats *stats) const {
+	if (numNodes == 0) {
+		return;
+	}
+	struct Entry {
+		int child, count;
+		float tNear;
+	};
+	const QBVHRay qray(ray);
+	Entry stack[QBVH_STACK_SIZE];
+	int stackSize = 0;
+	Entry current = { 0, 0, 0.0f };
+	int nodesVisited = 0;
+	int primitivesTested = 0;
+	bool stopped = false;
+
+	while (!stopped) {
+		if (current.tNear <= tMax) {
+			if (current.count > 0) {
+				for (int i = 0; i < current.count && !stopped; i++) {
+					primitivesTested++;
+					stopped = intersectPrimitive(indexArray[current.child + i], tMax);
+				}
+			} else {
+				const Node &node = nodeArray[current.child];
+				float tNear[QBVH_WIDTH];
+				const int mask = node.intersect(qray, tMax, tNear);
+				nodesVisited++;
+				// Push the children hit farthest first, so the nearest is popped next.
+				const int first = stackSize;
+				for (int c = 0; c < QBVH_WIDTH; c++) {
+					if ((mask & (1 << c)) != 0) {
+						int j = stackSize++;
+						for (; j > first && stack[j - 1].tNear < tNear[c]; j--) {
+							stack[j] = stack[j - 1];
+						}
+						stack[j].tNear = tNear[c];
+						node.getChild(c, stack[j].child, stack[j].count);
+					}
+				}
+			}
+		}
+		if (stackSize == 0) {
+			break;
+		}
+		current = stack[--stackSize];
+	}
+
+	if (stats != nullptr) {
+		stats->numRays++;
+		stats->numNodes += nodesVisited;
+		stats->numPrimitives += primitivesTested;
+	}
+}
+
+/**
+ * @fn	template <class Node> template <class IntersectPrimitive> void WideBVH<Node>::traverse(const RayPacket &packet, const float tMax[MAX_PACKET_SIZE], IntersectPrimitive intersectPrimitive) const
+ * @brief	Packet version of traverse. A child is visited if any ray in the
+ * 			packet enters its box before that ray's tMax. Each child is tested
+ * 			separately with the packet slab test; the hierarchy is only
+ * 			traversed this way when the binary tree has been discarded.
+ * @tparam	IntersectPrimitive	Callable as void(int primitive).
+ * @param	packet				The packet.
+ * @param	tMax				The farthest t of interest for each ray; the
+ * 								caller may lower these from intersectPrimitive.
+ * @param	intersectPrimitive	Intersects a single primitive with the packet.
+ */
+
+template <class Node>
+template <class IntersectPrimitive>
+void WideBVH<Node>::traverse(const RayPacket &packet, const float tMax[MAX_PACKET_SIZE], IntersectPrimitive intersectPrimitive) const {
+	if (numNodes == 0) {
+		return;
+	}
+	int stack[QBVH_STACK_SIZE];
+	int stackSize = 0;
+	int current = 0;
+
+	while (true) {
+		const Node &node = nodeArray[current];
+		for (int c = QBVH_WIDTH - 1; c >= 0; c--) {
+			float childLower[3], childUpper[3];
+			int child, count;
+			if (!node.isUsed(c)) {
+				continue;
+			}
+			node.getBounds(c, childLower, childUpper);
+			if (intersectBoxPacket(packet, childLower, childUpper, tMax) == 0) {
+				continue;
+			}
+			node.getChild(c, child, count);
+			if (count > 0) {
+				for (int i = 0; i < count; i++) {
+					intersectPrimitive(indexArray[child + i]);
+				}
+			} else {
+				stack[stackSize++] = child;
+			}
+		}
+		if (stackSize == 0) {
+			return;
+		}
+		current = stack[--stackSize];
+	}
+}
+
+/**
+ * @fn	template <class Node> bool WideBVH<Node>::isValid(int numPrimitives) const
+ * @brief	Checks that traversing the hierarchy stays within its arrays, for
+ * 			nodes and indices read from a file: every interior child is a later
+ * 			node that no other node references, no path is deep enough to
+ * 			overflow the traversal stack, every leaf lies within indexArray and
+ * 			every index names one of the primitives.
+ * @param	numPrimitives	Number of primitives the hierarchy was built over.
+ * @return	True iff the hierarchy can be traversed safely.
+ */
+
+template <class Node>
+bool WideBVH<Node>::isValid(int numPrimitives) const {
+	if (numNodes == 0) {
+		return numIndices == 0;
+	}
+	// Each level leaves at most QBVH_WIDTH - 1 siblings on the stack.
+	const int maxDepth = QBVH_STACK_SIZE / (QBVH_WIDTH - 1) - 2;
+	std::vector<int> depth(numNodes, -1);
+	depth[0] = 0;
+	for (int n = 0; n < numNodes; n++) {
+		if (depth[n] < 0) {
+			return false;
+		}
+		const Node &node = nodeArray[n];
+		for (int c = 0; c < QBVH_WIDTH; c++) {
+			int child, count;
+			if (!node.isUsed(c)) {
+				continue;
+			}
+			node.getChild(c, child, count);
+			if (count > 0) {
+				if (child < 0 || child > numIndices - count) {
+					return false;
+				}
+			} else if (child <= n || child >= numNodes || depth[child] >= 0 || depth[n] >= maxDepth) {
+				return false;
+			} else {
+				depth[child] = depth[n] + 1;
+			}
+		}
+	}
+	for (int i = 0; i < numIndices; i++) {
+		if (indexArray[i] < 0 || indexArray[i] >= numPrimitives) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @struct	SceneBVH
+ * @brief	A BVH over a list of visible implicit shapes. Shapes that cannot be
+ * 			bounded, like planes, are kept in a separate list and tested
+ * 			against every ray. The binary tree is built and refit, and packets
+ * 			traverse it; single rays traverse its 4-wide collapse. In compressed
+ * 			mode only a CompressedQBVH is kept, which every ray traverses, and
+ * 			refitting gives way to rebuilding. The same holds for a 4-wide tree
+ * 			mapped from a cache file, which has no binary tree either. Single
+ * 			rays intersect the objects through their ShapePools.
+ */
+
+struct SceneBVH {
+	BVH bvh;										//!< Hierarchy over boundedObjects.
+	QBVH qbvh;										//!< bvh collapsed to 4-wide nodes, for single rays.
+	CompressedQBVH compressedQBVH;					//!< Replaces both of the above in compressed mode.
+	MappedFile cacheFile;							//!< The cache file the 4-wide tree is mapped from, if any.
+	std::vector<VisibleIShapePtr> boundedObjects;	//!< Bounded shapes; the BVH primitives.
+	std::vector<VisibleIShapePtr> unboundedObjects;	//!< Shapes tested against every ray.
+	ShapePools boundedPools;						//!< boundedObjects compiled for intersection; indexed like them.
+	ShapePools unboundedPools;						//!< unboundedObjects compiled for intersection.
+	bool isBuilt;									//!< True once build has been called.
+	bool countTraversals;							//!< Tally the work of single ray traversals (see getTraversalStats).
+	bool compressed;								//!< Keep only compressedQBVH, to save memory. Takes effect at the next build.
+	SceneBVH();
+	void build(const std::vector<VisibleIShapePtr> &objects, WorkStealingPool *pool = nullptr);
+	bool buildCached(const std::vector<VisibleIShapePtr> &objects, const std::string &cacheDirectory,
+					WorkStealingPool *pool = nullptr);
+	bool refit(const std::vector<VisibleIShapePtr> &objects);
+	void clear();
+	bool isMapped() const { return cacheFile.isOpen(); }
+	uint64_t hashObjects(const std::vector<VisibleIShapePtr> &objects) const;
+	HitRecord findIntersection(const Ray &ray) const;
+	void findClosestHit(const Ray &ray, ClosestHit &closest) const;
+	void findIntersections(const RayPacket &packet, HitRecord hits[MAX_PACKET_SIZE]) const;
+	void intersect(const RayBatch &rays, HitBatch &hits) const;
+	bool occluded(const Ray &ray, float tMax) const;
+	void occlude(RayBatch &rays) const;
+	void findAllIntersections(const Ray &ray, float tMax, std::vector<HitRecord> &hits) const;
+	BVHTraversalStats getTraversalStats() const;
+	void resetTraversalStats();
+protected:
+	mutable std::atomic<long long> numRaysTraversed;	//!< Tallies kept when countTraversals is set.
+	mutable std::atomic<long long> numNodesVisited;
+	mutable std::atomic<long long> numPrimitivesTested;
+	void tally(const BVHTraversalStats &stats) const;
+	void setObjects(const std::vector<VisibleIShapePtr> &objects, std::vector<AABB> &bounds);
+	bool load(const std::vector<VisibleIShapePtr> &objects, const std::string &fileName, uint64_t hash);
+	bool save(const std::string &fileName, uint64_t hash) const;
+	template <class IntersectPrimitive>
+	void traverse(const Ray &ray, float &tMax, IntersectPrimitive intersectPrimitive) const;
+};
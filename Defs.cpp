@@ -1,4 +1,5 @@
 #include <iostream>
+#include <algorithm>
 #include "Defs.h"
 #include "Utilities.h"
 
@@ -85,6 +86,116 @@ float BoundingBox3D::depth() const {
 	return lz - rz;
 }
 
+/**
+ * @fn	AABB::AABB()
+ * @brief	Constructs an empty box.
+ */
+
+AABB::AABB()
+	: lower(FLT_MAX, FLT_MAX, FLT_MAX), upper(-FLT_MAX, -FLT_MAX, -FLT_MAX) {
+}
+
+/**
+ * @fn	AABB::AABB(const glm::vec3 &lo, const glm::vec3 &hi)
+ * @brief	Constructs a box from two opposite corners.
+ * @param	lo	The lower corner.
+ * @param	hi	The upper corner.
+ */
+
+AABB::AABB(const glm::vec3 &lo, const glm::vec3 &hi)
+	: lower(glm::min(lo, hi)), upper(glm::max(lo, hi)) {
+}
+
+/**
+ * @fn	bool AABB::isEmpty() const
+ * @brief	Determines if the box contains no points.
+ * @return	True iff the box is empty.
+ */
+
+bool AABB::isEmpty() const {
+	return lower.x > upper.x || lower.y > upper.y || lower.z > upper.z;
+}
+
+/**
+ * @fn	glm::vec3 AABB::center() const
+ * @brief	Gets the center of the box.
+ * @return	The center point.
+ */
+
+glm::vec3 AABB::center() const {
+	return 0.5f * (lower + upper);
+}
+
+/**
+ * @fn	glm::vec3 AABB::extent() const
+ * @brief	Gets the size of the box along each axis.
+ * @return	(width, height, depth)
+ */
+
+glm::vec3 AABB::extent() const {
+	return upper - lower;
+}
+
+/**
+ * @fn	float AABB::surfaceArea() const
+ * @brief	Computes the surface area of the box. 0 for an empty box.
+ * @return	The surface area.
+ */
+
+float AABB::surfaceArea() const {
+	if (isEmpty()) {
+		return 0.0f;
+	}
+	glm::vec3 d = extent();
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+/**
+ * @fn	int AABB::longestAxis() const
+ * @brief	Finds the axis along which the box is the longest.
+ * @return	0, 1, or 2 for x, y, or z.
+ */
+
+int AABB::longestAxis() const {
+	glm::vec3 d = extent();
+	if (d.x >= d.y && d.x >= d.z) {
+		return 0;
+	}
+	return d.y >= d.z ? 1 : 2;
+}
+
+/**
+ * @fn	void AABB::pad(float amount)
+ * @brief	Grows the box by amount in every direction.
+ * @param	amount	The amount.
+ */
+
+void AABB::pad(float amount) {
+	lower -= glm::vec3(amount, amount, amount);
+	upper += glm::vec3(amount, amount, amount);
+}
+
+/**
+ * @fn	bool AABB::intersects(const glm::vec3 &origin, const glm::vec3 &invDirection, float tMax) const
+ * @brief	Slab test: determines if a ray hits the box somewhere in [0, tMax].
+ * @param	origin			The ray's origin.
+ * @param	invDirection	1/direction, computed once per ray.
+ * @param	tMax			The farthest t of interest.
+ * @return	True iff the ray passes through the box within [0, tMax].
+ */
+
+bool AABB::intersects(const glm::vec3 &origin, const glm::vec3 &invDirection, float tMax) const {
+	float tNear = 0.0f;
+	float tFar = tMax;
+	for (int i = 0; i < 3; i++) {
+		float t1 = (lower[i] - origin[i]) * invDirection[i];
+		float t2 = (upper[i] - origin[i]) * invDirection[i];
+		tNear = std::max(tNear, std::min(t1, t2));
+		tFar = std::min(tFar, std::max(t1, t2) * SLAB_EXIT_SCALE);
+	}
+	return tNear <= tFar;
+}
+
 /**
  * @fn	void Frame::setInverse()
  * @brief	Sets the inverse based on the current parameters.
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <cfloat>
 #include <memory>
 
 // Glut takes care of all the system-specific chores required for creating windows, 
@@ -17,6 +18,7 @@
 #include <glm/gtx/rotate_vector.hpp>
 
 const float EPSILON = 1.0E-3f;		//!< default value used for "SMALL" tolerances.
+const float SLAB_EXIT_SCALE = 1.0f + 3.0f * FLT_EPSILON;	//!< Slab tests scale where a ray leaves each slab by this, covering their rounding error, so a ray aimed exactly at a shared edge still enters the box.
 
 const int TIME_INTERVAL = 100;		//!< default time interval used timers.
 const int WINDOW_WIDTH = 500;		//!< default window width.
@@ -103,6 +105,52 @@ struct BoundingBox3D {
 	float depth() const;
 };
 
+/**
+ * @struct	AABB
+ * @brief	An axis-aligned box in 3D, stored as its lower and upper corners.
+ * 			Used to bound the shapes being ray traced. A default AABB is empty,
+ * 			and becomes valid once a point or box is added to it.
+ */
+
+struct AABB {
+	glm::vec3 lower;	//!< (min x, min y, min z)
+	glm::vec3 upper;	//!< (max x, max y, max z)
+	AABB();
+	AABB(const glm::vec3 &lo, const glm::vec3 &hi);
+	bool isEmpty() const;
+	glm::vec3 center() const;
+	glm::vec3 extent() const;
+	float surfaceArea() const;
+	int longestAxis() const;
+	void expand(const glm::vec3 &pt);
+	void expand(const AABB &box);
+	void pad(float amount);
+	bool intersects(const glm::vec3 &origin, const glm::vec3 &invDirection, float tMax) const;
+};
+
+/**
+ * @fn	inline void AABB::expand(const glm::vec3 &pt)
+ * @brief	Grows the box so that it contains pt. Inline, since BVH builds and
+ * 			refits call it for every primitive at every level.
+ * @param	pt	The point.
+ */
+
+inline void AABB::expand(const glm::vec3 &pt) {
+	lower = glm::min(lower, pt);
+	upper = glm::max(upper, pt);
+}
+
+/**
+ * @fn	inline void AABB::expand(const AABB &box)
+ * @brief	Grows the box so that it contains another box.
+ * @param	box	The other box.
+ */
+
+inline void AABB::expand(const AABB &box) {
+	lower = glm::min(lower, box.lower);
+	upper = glm::max(upper, box.upper);
+}
+
 /**
  * @struct	Frame
  * @brief	Represents a coordinate frame
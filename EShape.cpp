@@ -266,3 +266,31 @@ static std::vector<VertexData> createSidePanel(const Material &mat, const glm::v
 	std::vector<VertexData> verts;
 	return verts;
 }
+
+/**
+ * @fn	EShapeData EShape::createEMesh(const Material &mat, const MeshData &mesh)
+ * @brief	Creates the triangles of an indexed mesh, such as one loaded by
+ * 			MeshImporter. Each triangle gets its own copies of its vertices;
+ * 			without vertex normals, each triangle is shaded flat.
+ * @param	mat 	Material.
+ * @param	mesh	The mesh.
+ * @return	The mesh's triangles.
+ */
+
+EShapeData EShape::createEMesh(const Material &mat, const MeshData &mesh) {
+	EShapeData result;
+	result.reserve(mesh.indices.size());
+	for (int i = 0; i < mesh.getNumTriangles(); i++) {
+		const int *corners = &mesh.indices[3 * i];
+		if (mesh.hasNormals()) {
+			for (int j = 0; j < 3; j++) {
+				result.push_back(VertexData(glm::vec4(mesh.positions[corners[j]], 1.0f), mesh.normals[corners[j]], mat));
+			}
+		} else {
+			VertexData::addTriVertsAndComputeNormal(result, glm::vec4(mesh.positions[corners[0]], 1.0f),
+													glm::vec4(mesh.positions[corners[1]], 1.0f),
+													glm::vec4(mesh.positions[corners[2]], 1.0f), mat);
+		}
+	}
+	return result;
+}
@@ -5,6 +5,7 @@
 #include "VertexData.h"
 #include "FrameBuffer.h"
 #include "Light.h"
+#include "MeshData.h"
 
 typedef std::vector<VertexData> EShapeData;
 
@@ -27,4 +28,5 @@ struct EShape {
 	static EShapeData createELines(const Material &mat, const std::vector<glm::vec4> &corners);
 	static EShapeData createECheckerBoard(const Material &mat1, const Material &mat2, float WIDTH, float HEIGHT, int DIV);
 	static EShapeData createExtrusion(const Material &mat, const std::vector<glm::vec2> &V);
+	static EShapeData createEMesh(const Material &mat, const MeshData &mesh);
 };
@@ -1,3 +1,5 @@
+#include <fstream>
+#include <algorithm>
 #include "Utilities.h"
 #include "FrameBuffer.h"
 
@@ -8,7 +10,8 @@
  * @param	height	The height.
  */
 
-FrameBuffer::FrameBuffer(const int width, const int height) : window(width, height) {
+FrameBuffer::FrameBuffer(const int width, const int height)
+	: window(width, height), colorBuffer(nullptr), depthBuffer(nullptr), headless(false) {
 	setFrameBufferSize(width, height);
 }
 
@@ -27,15 +30,11 @@ FrameBuffer::~FrameBuffer() {
  * @brief	Sets frame buffer size
  * @param	width 	The width.
  * @param	height	The height.
- * @see https://www.opengl.org/archives/resources/features/KilgardTechniques/oglpitfall/
  */
 
 void FrameBuffer::setFrameBufferSize(int width, int height) {
 	window = Window(width, height);
 
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glPixelStorei(GL_PACK_ALIGNMENT, 1);
-
 	delete [] colorBuffer;
 	delete [] depthBuffer;
 
@@ -73,15 +72,88 @@ void FrameBuffer::clearColorAndDepthBuffers() {
 
 /**
  * @fn	void FrameBuffer::showColorBuffer() const
- * @brief	Shows the contents of the color buffer to screen.
+ * @brief	Shows the contents of the color buffer to screen. Does nothing if the
+ * 			framebuffer is headless.
+ * @see https://www.opengl.org/archives/resources/features/KilgardTechniques/oglpitfall/
  */
 
 void FrameBuffer::showColorBuffer() const {
+	if (headless) {
+		return;
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
 	glRasterPos2d(-1, -1);
 	glDrawPixels(window.width, window.height, GL_RGB, GL_UNSIGNED_BYTE, colorBuffer);
 	glFlush();
 }
 
+/**
+ * @fn	bool FrameBuffer::writeColorBuffer(const std::string &ppmFileName) const
+ * @brief	Writes the color buffer to a binary (P6) PPM file. PPM rows run top
+ * 			to bottom, so the rows are written in reverse.
+ * @param	ppmFileName	Name of the file.
+ * @return	True iff the file was written.
+ */
+
+bool FrameBuffer::writeColorBuffer(const std::string &ppmFileName) const {
+	std::ofstream output(ppmFileName, std::ios::binary);
+	if (!output) {
+		std::cerr << "Cannot write to: " << ppmFileName << std::endl;
+		return false;
+	}
+	output << "P6\n" << window.width << " " << window.height << "\n255\n";
+	const int rowSize = window.width * BYTES_PER_PIXEL;
+	for (int y = window.height - 1; y >= 0; y--) {
+		output.write((const char *)(colorBuffer + y * rowSize), rowSize);
+	}
+	return (bool)output;
+}
+
+/**
+ * @fn	bool FrameBuffer::writeDepthBuffer(const std::string &pamFileName) const
+ * @brief	Writes the depth buffer to a 16 bit grayscale PAM file. Depths are
+ * 			scaled so that the nearest pixel is black and the farthest is white.
+ * 			Pixels where nothing was hit (depth FLT_MAX) are also white.
+ * @param	pamFileName	Name of the file.
+ * @return	True iff the file was written.
+ */
+
+bool FrameBuffer::writeDepthBuffer(const std::string &pamFileName) const {
+	std::ofstream output(pamFileName, std::ios::binary);
+	if (!output) {
+		std::cerr << "Cannot write to: " << pamFileName << std::endl;
+		return false;
+	}
+	const int SZ = window.area();
+	float nearest = FLT_MAX;
+	float farthest = -FLT_MAX;
+	for (int i = 0; i < SZ; i++) {
+		if (depthBuffer[i] < FLT_MAX) {
+			nearest = std::min(nearest, depthBuffer[i]);
+			farthest = std::max(farthest, depthBuffer[i]);
+		}
+	}
+	const float range = farthest > nearest ? farthest - nearest : 1.0f;
+
+	output << "P7\nWIDTH " << window.width << "\nHEIGHT " << window.height
+		<< "\nDEPTH 1\nMAXVAL 65535\nTUPLTYPE GRAYSCALE\nENDHDR\n";
+	std::vector<unsigned char> row(2 * window.width);
+	for (int y = window.height - 1; y >= 0; y--) {
+		for (int x = 0; x < window.width; x++) {
+			float depth = depthBuffer[y * window.width + x];
+			unsigned int gray = 65535;
+			if (depth < FLT_MAX) {
+				gray = (unsigned int)(65535.0f * glm::clamp((depth - nearest) / range, 0.0f, 1.0f));
+			}
+			row[2 * x] = (unsigned char)(gray >> 8);
+			row[2 * x + 1] = (unsigned char)(gray & 0xFF);
+		}
+		output.write((const char *)row.data(), row.size());
+	}
+	return (bool)output;
+}
+
 /**
  * @fn	void FrameBuffer::setColor(int x, int y, const color &rgb)
  * @brief	Sets a color at (x, y)
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <string>
 #include "defs.h"
 #include "ColorAndMaterials.h"
 
@@ -9,7 +10,8 @@ const int BYTES_PER_PIXEL = 3;			//!< RGB requires 3 bytes.
  * @struct	FrameBuffer
  * @brief	Represents a framebuffer. Two identically sized 2D arrays. The color
  * 			buffer stores the colors and the depth buffer stores the corresponding
- * 			depth at each pixel.
+ * 			depth at each pixel. A headless framebuffer never touches OpenGL,
+ * 			so it can be rendered into and written to a file without a window.
  */
 
 struct FrameBuffer {
@@ -22,6 +24,10 @@ struct FrameBuffer {
 
 	void clearColorAndDepthBuffers();
 	void showColorBuffer() const;
+	void setHeadless(bool isHeadless) { headless = isHeadless; }
+	bool isHeadless() const { return headless; }
+	bool writeColorBuffer(const std::string &ppmFileName) const;
+	bool writeDepthBuffer(const std::string &pamFileName) const;
 	int getWindowWidth() const { return window.width; }
 	int getWindowHeight() const { return window.height; }
 
@@ -37,4 +43,5 @@ protected:
 	GLubyte clearColorUB[BYTES_PER_PIXEL];	//!< Clear color
 	GLubyte *colorBuffer;					//!< 2D array for holding colors
 	float *depthBuffer;						//!< 2D array for holding depths
+	bool headless;							//!< True if there is no window to show the colors in
 };
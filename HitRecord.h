@@ -26,6 +26,7 @@ struct HitRecord {
 
 	HitRecord() {
 		t = FLT_MAX;
+		interceptPoint = surfaceNormal = glm::vec3(0.0f, 0.0f, 0.0f);
 		texture = nullptr; 
 	}
 
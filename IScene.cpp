@@ -1,4 +1,6 @@
+#include <algorithm>
 #include "IScene.h"
+#include "RayBatch.h"
 
 /**
  * @fn	IScene::IScene(RaytracingCamera *theCamera ,bool showAxis)
@@ -9,6 +11,7 @@
 
 IScene::IScene(RaytracingCamera *theCamera, bool showAxis) {
 	camera = theCamera;
+	version = 0;
 
 	const float L = 20.0f;
 	const float L2 = L / 2.0f;
@@ -32,6 +35,171 @@ IScene::IScene(RaytracingCamera *theCamera, bool showAxis) {
 
 void IScene::addObject(const VisibleIShapePtr &obj) {
 	visibleObjects.push_back(obj);
+	visibleBVH.clear();
+	markChanged();
+}
+
+/**
+ * @fn	void IScene::buildBVH(WorkStealingPool *pool)
+ * @brief	Builds the acceleration structures over the visible and transparent
+ * 			objects, or maps them from bvhCacheDirectory if they were saved
+ * 			there by an earlier run (see SceneBVH::buildCached). Must be called
+ * 			again after objects are added; until then the objects are searched
+ * 			one by one.
+ * @param	pool	Threads to build with, or nullptr to build on this thread.
+ */
+
+void IScene::buildBVH(WorkStealingPool *pool) {
+	if (bvhCacheDirectory.empty()) {
+		visibleBVH.build(visibleObjects, pool);
+		transparentBVH.build(transparentObjects, pool);
+	} else {
+		visibleBVH.buildCached(visibleObjects, bvhCacheDirectory, pool);
+		transparentBVH.buildCached(transparentObjects, bvhCacheDirectory, pool);
+	}
+}
+
+/**
+ * @fn	bool IScene::refitBVH()
+ * @brief	Updates the scene after objects have moved or changed shape (e.g.,
+ * 			new shape parameters or instance transforms). Every object's bounds
+ * 			are recomputed and the acceleration structures refit, which is far
+ * 			cheaper than buildBVH; they are rebuilt only once refitting has
+ * 			degraded them too much (see SceneBVH::refit).
+ * @return	True if either acceleration structure was rebuilt.
+ */
+
+bool IScene::refitBVH() {
+	for (VisibleIShapePtr obj : visibleObjects) {
+		obj->updateBounds();
+	}
+	for (VisibleIShapePtr obj : transparentObjects) {
+		obj->updateBounds();
+	}
+	bool rebuilt = false;
+	if (visibleBVH.isBuilt) {
+		rebuilt = visibleBVH.refit(visibleObjects);
+	}
+	if (transparentBVH.isBuilt) {
+		rebuilt = transparentBVH.refit(transparentObjects) || rebuilt;
+	}
+	markChanged();
+	return rebuilt;
+}
+
+/**
+ * @fn	HitRecord IScene::findIntersection(const Ray &ray) const
+ * @brief	Finds the closest visible object hit by the ray.
+ * @param	ray	The ray.
+ * @return	The closest intersection that is in front of the ray's origin.
+ */
+
+HitRecord IScene::findIntersection(const Ray &ray) const {
+	if (visibleBVH.isBuilt) {
+		return visibleBVH.findIntersection(ray);
+	}
+	return VisibleIShape::findIntersection(ray, visibleObjects);
+}
+
+/**
+ * @fn	void IScene::findIntersections(const std::vector<Ray> &rays, std::vector<HitRecord> &hits, int packetWidth) const
+ * @brief	Finds the closest visible object hit by each of a batch of rays. The
+ * 			rays are intersected in packets of packetWidth, so neighboring
+ * 			rays should be coherent (e.g., camera rays for adjacent pixels).
+ * 			The hits are identical to those from findIntersection.
+ * @param 		  	rays	   	The rays.
+ * @param [in,out]	hits	   	Set to the closest hit for each ray.
+ * @param 		  	packetWidth	4 or 8 to use SIMD packets; 1 for single rays.
+ */
+
+void IScene::findIntersections(const std::vector<Ray> &rays, std::vector<HitRecord> &hits, int packetWidth) const {
+	const int N = (int)rays.size();
+	hits.resize(N);
+	if (packetWidth <= 1) {
+		for (int i = 0; i < N; i++) {
+			hits[i] = findIntersection(rays[i]);
+		}
+		return;
+	}
+
+	RayPacket packet;
+	for (int first = 0; first < N; first += packetWidth) {
+		packet.set(&rays[first], std::min(packetWidth, N - first), packetWidth);
+		if (visibleBVH.isBuilt) {
+			visibleBVH.findIntersections(packet, &hits[first]);
+		} else {
+			VisibleIShape::findIntersections(packet, visibleObjects, &hits[first]);
+		}
+	}
+}
+
+/**
+ * @fn	bool IScene::occluded(const Ray &ray, float tMax) const
+ * @brief	Determines if any visible object blocks the ray before tMax. Cheaper
+ * 			than findIntersection for shadow rays, since it stops at the first
+ * 			blocker and builds no hit record.
+ * @param	ray 	The ray.
+ * @param	tMax	The farthest t of interest (e.g., the distance to a light).
+ * @return	True iff some visible object blocks the ray in (0, tMax).
+ */
+
+bool IScene::occluded(const Ray &ray, float tMax) const {
+	if (visibleBVH.isBuilt) {
+		return visibleBVH.occluded(ray, tMax);
+	}
+	return VisibleIShape::occluded(ray, tMax, visibleObjects);
+}
+
+/**
+ * @fn	void IScene::intersect(const RayBatch &rays, HitBatch &hits) const
+ * @brief	Finds the closest visible object hit by each active ray in a batch.
+ * 			The hits are identical to those from findIntersection.
+ * @param 		  	rays	The rays.
+ * @param [in,out]	hits	Set to the closest hit for each ray.
+ */
+
+void IScene::intersect(const RayBatch &rays, HitBatch &hits) const {
+	hits.reset(rays);
+	if (visibleBVH.isBuilt) {
+		visibleBVH.intersect(rays, hits);
+	} else {
+		VisibleIShape::intersect(rays, visibleObjects, hits);
+	}
+}
+
+/**
+ * @fn	void IScene::occlude(RayBatch &rays) const
+ * @brief	Batch version of occluded, for shadow rays: clears the active flag
+ * 			of every active ray that a visible object blocks between its tMin
+ * 			and tMax.
+ * @param [in,out]	rays	The rays.
+ */
+
+void IScene::occlude(RayBatch &rays) const {
+	if (visibleBVH.isBuilt) {
+		visibleBVH.occlude(rays);
+	} else {
+		VisibleIShape::occlude(rays, visibleObjects);
+	}
+}
+
+/**
+ * @fn	void IScene::findTransparentHits(const Ray &ray, float tMax, std::vector<HitRecord> &hits) const
+ * @brief	Finds every transparent object the ray passes through before tMax.
+ * @param 		  	ray 	The ray.
+ * @param 		  	tMax	The farthest t of interest (e.g., the closest opaque hit).
+ * @param [in,out]	hits	Set to the hits, sorted front to back.
+ */
+
+void IScene::findTransparentHits(const Ray &ray, float tMax, std::vector<HitRecord> &hits) const {
+	hits.clear();
+	if (transparentBVH.isBuilt) {
+		transparentBVH.findAllIntersections(ray, tMax, hits);
+	} else {
+		VisibleIShape::findAllIntersections(ray, tMax, transparentObjects, hits);
+	}
+	std::sort(hits.begin(), hits.end(),
+				[](const HitRecord &a, const HitRecord &b) { return a.t < b.t; });
 }
 
 /**
@@ -44,6 +212,8 @@ void IScene::addObject(const VisibleIShapePtr &obj) {
 void IScene::addTransparentObject(const VisibleIShapePtr &obj, float alpha) {
 	obj->material.alpha = alpha;
 	transparentObjects.push_back(obj);
+	transparentBVH.clear();
+	markChanged();
 }
 
 /**
@@ -54,6 +224,7 @@ void IScene::addTransparentObject(const VisibleIShapePtr &obj, float alpha) {
 
 void IScene::addObject(const PositionalLightPtr &light) {
 	lights.push_back(light);
+	markChanged();
 }
 
 /**
@@ -64,4 +235,16 @@ void IScene::addObject(const PositionalLightPtr &light) {
 
 void IScene::changeCamera(RaytracingCamera *cam) {
 	camera = cam;
+	markChanged();
+}
+
+/**
+ * @fn	void IScene::markChanged()
+ * @brief	Records that objects in the scene were added, moved or altered, so
+ * 			that anything computed from the old scene (e.g., accumulated
+ * 			samples) is discarded. Call it after modifying objects directly.
+ */
+
+void IScene::markChanged() {
+	version++;
 }
@@ -7,6 +7,7 @@
 #include "Light.h"
 #include "EShape.h"
 #include "IShape.h"
+#include "BVH.h"
 
 /**
  * @struct	IScene
@@ -18,9 +19,22 @@ struct IScene {
 	std::vector<VisibleIShapePtr> visibleObjects;		//!< All the visible objects in the scene
 	std::vector<VisibleIShapePtr> transparentObjects;	//!< All the transparent objects in the scene
 	RaytracingCamera *camera;							//!< The one camera in the scene
+	SceneBVH visibleBVH;								//!< Acceleration structure over visibleObjects
+	SceneBVH transparentBVH;							//!< Acceleration structure over transparentObjects
+	int version;										//!< Incremented whenever the objects in the scene change
+	std::string bvhCacheDirectory;						//!< If not empty, buildBVH maps hierarchies cached here, and saves those it builds
 	IScene(RaytracingCamera *theCamera, bool withAxis = false);
+	void buildBVH(WorkStealingPool *pool = nullptr);
+	bool refitBVH();
+	HitRecord findIntersection(const Ray &ray) const;
+	void findIntersections(const std::vector<Ray> &rays, std::vector<HitRecord> &hits, int packetWidth) const;
+	bool occluded(const Ray &ray, float tMax) const;
+	void intersect(const RayBatch &rays, HitBatch &hits) const;
+	void occlude(RayBatch &rays) const;
+	void findTransparentHits(const Ray &ray, float tMax, std::vector<HitRecord> &hits) const;
 	void addObject(const VisibleIShapePtr &obj);
 	void addTransparentObject(const VisibleIShapePtr &obj, float alpha);
 	void addObject(const PositionalLightPtr &light);
 	void changeCamera(RaytracingCamera *cam);
+	void markChanged();
 };
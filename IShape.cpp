@@ -1,5 +1,7 @@
 #include <vector>
+#include <algorithm>
 #include "IShape.h"
+#include "RayBatch.h"
 
 /**
  * @fn	IShape::IShape()
@@ -22,6 +24,133 @@ void IShape::getTexCoords(const glm::vec3 &pt, float &u, float &v) const {
 	u = v = 0;
 }
 
+/**
+ * @fn	bool IShape::getBounds(AABB &box) const
+ * @brief	Computes a world space box that contains the whole shape. Shapes
+ * 			that extend forever, like planes, cannot be bounded.
+ * @param [in,out]	box	The bounding box, if there is one.
+ * @return	True iff the shape is bounded. The default is false.
+ */
+
+bool IShape::getBounds(AABB &/*box*/) const {
+	return false;
+}
+
+/**
+ * @fn	bool IShape::isBounded() const
+ * @brief	Determines if the shape has a finite extent.
+ * @return	True iff getBounds can produce a box for this shape.
+ */
+
+bool IShape::isBounded() const {
+	AABB box;
+	return getBounds(box);
+}
+
+/**
+ * @fn	float IShape::findClosestT(const Ray &ray, int &primitive) const
+ * @brief	Finds only the t of the closest intersection, for use while searching
+ * 			for the closest object; completeHit fills in the rest for the
+ * 			winner. This default computes the whole hit; shapes that can find t
+ * 			more cheaply override it.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Set to the part of the shape that was hit, for
+ * 								shapes made of several parts. Otherwise 0.
+ * @return	The closest t, or FLT_MAX if the ray misses.
+ */
+
+float IShape::findClosestT(const Ray &ray, int &primitive) const {
+	HitRecord hit;
+	findClosestIntersection(ray, hit);
+	primitive = 0;
+	return hit.t;
+}
+
+/**
+ * @fn	void IShape::completeHit(const Ray &ray, int primitive, HitRecord &hit) const
+ * @brief	Computes the intercept and normal for a ray known to hit the shape,
+ * 			giving the same result as findClosestIntersection.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	primitive	The part hit, as reported by findClosestT.
+ * @param [in,out]	hit		 	The hit; t must be FLT_MAX on entry.
+ */
+
+void IShape::completeHit(const Ray &ray, int /*primitive*/, HitRecord &hit) const {
+	findClosestIntersection(ray, hit);
+}
+
+/**
+ * @fn	bool IShape::occludes(const Ray &ray, float tMax) const
+ * @brief	Determines if the shape blocks the ray somewhere in (0, tMax). Used
+ * 			for shadow rays, which only need a yes/no answer. This default
+ * 			uses findClosestT; shapes that can answer more cheaply override it.
+ * @param	ray 	The ray.
+ * @param	tMax	The farthest t of interest (e.g., the distance to a light).
+ * @return	True iff the ray hits the shape in (0, tMax).
+ */
+
+bool IShape::occludes(const Ray &ray, float tMax) const {
+	int primitive;
+	float t = findClosestT(ray, primitive);
+	return t > 0 && t < tMax;
+}
+
+/**
+ * @fn	void IShape::findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int primitives[MAX_PACKET_SIZE]) const
+ * @brief	Finds the closest intersection of each ray in a packet. This default
+ * 			intersects the rays one at a time; shapes with a SIMD kernel
+ * 			override it.
+ * @param 		  	packet	  	The packet.
+ * @param [in,out]	t		  	The closest t for each ray, or FLT_MAX.
+ * @param [in,out]	primitives	The part of the shape hit by each ray.
+ */
+
+void IShape::findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int primitives[MAX_PACKET_SIZE]) const {
+	for (int i = 0; i < packet.size; i++) {
+		t[i] = findClosestT(*packet.rays[i], primitives[i]);
+	}
+}
+
+/**
+ * @fn	void IShape::intersect(const RayBatch &rays, const VisibleIShape *object, HitBatch &hits) const
+ * @brief	Intersects every active ray in a batch with the shape, and records
+ * 			the hits that are closer than each ray's closest hit so far. This
+ * 			default intersects the rays one at a time with findClosestT; shapes
+ * 			that can do better override it.
+ * @param 		  	rays  	The rays.
+ * @param 		  	object	The object this shape belongs to, recorded for its hits.
+ * @param [in,out]	hits  	The closest hits so far.
+ */
+
+void IShape::intersect(const RayBatch &rays, const VisibleIShape *object, HitBatch &hits) const {
+	for (int i = 0; i < rays.size(); i++) {
+		if (rays.active[i]) {
+			int primitive = 0;
+			float t = findClosestT(rays.getRay(i), primitive);
+			// A hit, and in front of the ray's start, as in updateClosestHit.
+			if (t < FLT_MAX && t > 0) {
+				hits.update(i, rays.tMin[i] + t, object, primitive);
+			}
+		}
+	}
+}
+
+/**
+ * @fn	void IShape::occlude(RayBatch &rays) const
+ * @brief	Batch version of occludes: clears the active flag of every active
+ * 			ray that the shape blocks between its tMin and tMax. This default
+ * 			tests the rays one at a time.
+ * @param [in,out]	rays	The rays.
+ */
+
+void IShape::occlude(RayBatch &rays) const {
+	for (int i = 0; i < rays.size(); i++) {
+		if (rays.active[i] && occludes(rays.getRay(i), rays.getLength(i))) {
+			rays.active[i] = 0;
+		}
+	}
+}
+
 /**
  * @fn	glm::vec3 IShape::movePointOffSurface(const glm::vec3 &pt, const glm::vec3 &n)
  * @brief	Compute point that is slightly off surface.
@@ -46,6 +175,56 @@ VisibleIShape::VisibleIShape(IShapePtr shapePtr, const Material &mat)
 	texture = nullptr;
 	lu = lv = 0.0f;
 	ru = rv = 1.0f;
+	updateBounds();
+}
+
+/**
+ * @fn	void VisibleIShape::updateBounds()
+ * @brief	Recomputes the cached bounds. Must be called after the underlying
+ * 			shape is moved or resized. The box is padded by EPSILON so that
+ * 			intercepts computed with floating point error still lie inside it.
+ */
+
+void VisibleIShape::updateBounds() {
+	bounded = shape->getBounds(bounds);
+	if (bounded) {
+		bounds.pad(EPSILON);
+	}
+}
+
+/**
+ * @fn	bool VisibleIShape::mightIntersect(const Ray &ray, float tMax) const
+ * @brief	Cheap test against the cached bounds, used to skip the full
+ * 			intersection test for shapes the ray clearly misses.
+ * @param	ray 	The ray.
+ * @param	tMax	The farthest t of interest.
+ * @return	False if the ray cannot hit the shape before tMax.
+ */
+
+bool VisibleIShape::mightIntersect(const Ray &ray, float tMax) const {
+	return !bounded || bounds.intersects(ray.origin, 1.0f / ray.direction, tMax);
+}
+
+/**
+ * @fn	bool VisibleIShape::mightIntersect(const RayBatch &rays, const std::vector<float> &tMax) const
+ * @brief	Batch version of mightIntersect, used to skip the shape for a whole
+ * 			batch when none of its active rays comes near it.
+ * @param	rays	The rays.
+ * @param	tMax	The farthest t of interest for each ray, from its origin.
+ * @return	False if no active ray can hit the shape before its tMax.
+ */
+
+bool VisibleIShape::mightIntersect(const RayBatch &rays, const std::vector<float> &tMax) const {
+	if (!bounded) {
+		return true;
+	}
+	for (int i = 0; i < rays.size(); i++) {
+		const glm::vec3 invDirection(1.0f / rays.dx[i], 1.0f / rays.dy[i], 1.0f / rays.dz[i]);
+		if (rays.active[i] && bounds.intersects(glm::vec3(rays.ox[i], rays.oy[i], rays.oz[i]), invDirection, tMax[i])) {
+			return true;
+		}
+	}
+	return false;
 }
 
 /**
@@ -56,6 +235,10 @@ VisibleIShape::VisibleIShape(IShapePtr shapePtr, const Material &mat)
  */
 
 void VisibleIShape::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
+	if (!mightIntersect(ray, FLT_MAX)) {
+		hit.t = FLT_MAX;
+		return;
+	}
 	shape->findClosestIntersection(ray, hit);
 	if (hit.t < FLT_MAX) {
 		hit.material = material;
@@ -99,23 +282,281 @@ void VisibleIShape::setTexture(Image *tex) {
  */
 
 HitRecord VisibleIShape::findIntersection(const Ray &ray, const std::vector<VisibleIShapePtr> &surfaces) {
+	ClosestHit closest;
+	for (int i = 0; i < surfaces.size(); i++) {
+		surfaces[i]->updateClosestHit(ray, closest);
+	}
+
 	HitRecord theHit;
-	theHit.t = FLT_MAX;
+	closest.complete(ray, theHit);
+	return theHit;
+}
 
-	for (int i = 0; i < surfaces.size(); i++) {
-		HitRecord thisHit;
-		surfaces[i]->findClosestIntersection(ray, thisHit);
-		if (thisHit.t < theHit.t && thisHit.t > 0) {
-			theHit = thisHit;
-			theHit.material = surfaces[i]->material;
-			theHit.texture = surfaces[i]->texture;
-			if (theHit.texture != nullptr) {
-				surfaces[i]->shape->getTexCoords(theHit.interceptPoint, theHit.u, theHit.v);
-			}
+/**
+ * @fn	bool VisibleIShape::occluded(const Ray &ray, float tMax, const std::vector<VisibleIShapePtr> &surfaces)
+ * @brief	Determines if any of the surfaces blocks the ray in (0, tMax),
+ * 			stopping at the first one that does.
+ * @param	ray			The ray.
+ * @param	tMax		The farthest t of interest.
+ * @param	surfaces	The surfaces.
+ * @return	True iff some surface blocks the ray.
+ */
+
+bool VisibleIShape::occluded(const Ray &ray, float tMax, const std::vector<VisibleIShapePtr> &surfaces) {
+	for (unsigned int i = 0; i < surfaces.size(); i++) {
+		if (surfaces[i]->occludes(ray, tMax)) {
+			return true;
 		}
 	}
-	return theHit;
+	return false;
+}
+
+/**
+ * @fn	void VisibleIShape::findAllIntersections(const Ray &ray, float tMax, const std::vector<VisibleIShapePtr> &surfaces, std::vector<HitRecord> &hits)
+ * @brief	Collects the closest hit on each surface that lies in (0, tMax).
+ * 			The hits are appended in no particular order.
+ * @param 		  	ray			The ray.
+ * @param 		  	tMax		The farthest t of interest.
+ * @param 		  	surfaces	The surfaces.
+ * @param [in,out]	hits		The hits found.
+ */
+
+void VisibleIShape::findAllIntersections(const Ray &ray, float tMax, const std::vector<VisibleIShapePtr> &surfaces,
+											std::vector<HitRecord> &hits) {
+	for (unsigned int i = 0; i < surfaces.size(); i++) {
+		ClosestHit closest(tMax);
+		if (surfaces[i]->updateClosestHit(ray, closest)) {
+			hits.push_back(HitRecord());
+			closest.complete(ray, hits.back());
+		}
+	}
+}
+
+/**
+ * @fn	void VisibleIShape::findIntersections(const RayPacket &packet, const std::vector<VisibleIShapePtr> &surfaces, HitRecord hits[MAX_PACKET_SIZE])
+ * @brief	Packet version of findIntersection.
+ * @param 		  	packet  	The packet.
+ * @param 		  	surfaces	The surfaces.
+ * @param [in,out]	hits		The closest hit for each ray in the packet.
+ */
+
+void VisibleIShape::findIntersections(const RayPacket &packet, const std::vector<VisibleIShapePtr> &surfaces,
+										HitRecord hits[MAX_PACKET_SIZE]) {
+	PacketHits closest;
+	for (unsigned int i = 0; i < surfaces.size(); i++) {
+		surfaces[i]->updateClosestHits(packet, closest);
+	}
+	closest.complete(packet, hits);
+}
+
+/**
+ * @fn	void VisibleIShape::intersect(const RayBatch &rays, const std::vector<VisibleIShapePtr> &surfaces, HitBatch &hits)
+ * @brief	Batch version of findIntersection: finds the closest object hit by
+ * 			each active ray. Each object intersects the whole batch in turn.
+ * @param 		  	rays		The rays.
+ * @param 		  	surfaces	The objects.
+ * @param [in,out]	hits		The closest hits; reset before the first call.
+ */
+
+void VisibleIShape::intersect(const RayBatch &rays, const std::vector<VisibleIShapePtr> &surfaces, HitBatch &hits) {
+	for (unsigned int i = 0; i < surfaces.size(); i++) {
+		surfaces[i]->intersect(rays, hits);
+	}
+}
+
+/**
+ * @fn	void VisibleIShape::occlude(RayBatch &rays, const std::vector<VisibleIShapePtr> &surfaces)
+ * @brief	Batch version of occluded: clears the active flag of every ray that
+ * 			some object blocks. Each object tests the rays still active in turn.
+ * @param [in,out]	rays		The rays.
+ * @param 		  	surfaces	The objects.
+ */
+
+void VisibleIShape::occlude(RayBatch &rays, const std::vector<VisibleIShapePtr> &surfaces) {
+	for (unsigned int i = 0; i < surfaces.size(); i++) {
+		surfaces[i]->occlude(rays);
+	}
+}
+
+/**
+ * @fn	PacketHits::PacketHits()
+ * @brief	Constructs a record of no hits.
+ */
+
+PacketHits::PacketHits() {
+	for (int i = 0; i < MAX_PACKET_SIZE; i++) {
+		t[i] = FLT_MAX;
+		objects[i] = nullptr;
+		primitives[i] = 0;
+	}
+}
+
+/**
+ * @fn	void PacketHits::complete(const RayPacket &packet, HitRecord hits[MAX_PACKET_SIZE]) const
+ * @brief	Computes full hit records (intercept, normal, material, texture
+ * 			coordinates) for the winning object of each ray.
+ * @param 		  	packet	The packet.
+ * @param [in,out]	hits  	The hit record for each ray.
+ */
+
+void PacketHits::complete(const RayPacket &packet, HitRecord hits[MAX_PACKET_SIZE]) const {
+	for (int i = 0; i < packet.size; i++) {
+		if (objects[i] == nullptr) {
+			hits[i] = HitRecord();
+		} else {
+			objects[i]->completeHit(*packet.rays[i], primitives[i], hits[i]);
+		}
+	}
+}
+
+/**
+ * @fn	bool VisibleIShape::updateClosestHit(const Ray &ray, ClosestHit &closest) const
+ * @brief	Intersects the ray with this shape, and replaces closest if this shape
+ * 			is hit in front of the ray's origin and closer than closest. Only t
+ * 			is computed; see completeHit.
+ * @param 		  	ray	   	The ray.
+ * @param [in,out]	closest	The closest hit found so far.
+ * @return	True iff closest was replaced.
+ */
+
+bool VisibleIShape::updateClosestHit(const Ray &ray, ClosestHit &closest) const {
+	if (!mightIntersect(ray, closest.t)) {
+		return false;
+	}
+	int primitive;
+	float t = shape->findClosestT(ray, primitive);
+	if (t < closest.t && t > 0) {
+		closest.t = t;
+		closest.object = this;
+		closest.primitive = primitive;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @fn	void VisibleIShape::completeHit(const Ray &ray, int primitive, HitRecord &hit) const
+ * @brief	Fills in the hit record for a ray known to hit this object first:
+ * 			intercept, normal, material, texture and texture coordinates.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	primitive	The part hit, as reported by updateClosestHit.
+ * @param [in,out]	hit		 	The hit record.
+ */
+
+void VisibleIShape::completeHit(const Ray &ray, int primitive, HitRecord &hit) const {
+	hit.t = FLT_MAX;
+	shape->completeHit(ray, primitive, hit);
+	hit.material = material;
+	hit.texture = texture;
+	if (hit.texture != nullptr) {
+		shape->getTexCoords(hit.interceptPoint, hit.u, hit.v);
+	}
+}
+
+/**
+ * @fn	void ClosestHit::complete(const Ray &ray, HitRecord &hit) const
+ * @brief	Computes the full hit record for the closest hit.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The hit record; a default ("no hit") record if nothing was hit.
+ */
+
+void ClosestHit::complete(const Ray &ray, HitRecord &hit) const {
+	if (object == nullptr) {
+		hit = HitRecord();
+	} else {
+		object->completeHit(ray, primitive, hit);
+	}
+}
+
+/**
+ * @fn	bool VisibleIShape::occludes(const Ray &ray, float tMax) const
+ * @brief	Determines if this object blocks the ray somewhere in (0, tMax).
+ * 			No hit record, material or texture work is done.
+ * @param	ray 	The ray.
+ * @param	tMax	The farthest t of interest.
+ * @return	True iff the object blocks the ray.
+ */
+
+bool VisibleIShape::occludes(const Ray &ray, float tMax) const {
+	return mightIntersect(ray, tMax) && shape->occludes(ray, tMax);
+}
+
+/**
+ * @fn	void VisibleIShape::updateClosestHits(const RayPacket &packet, PacketHits &closest) const
+ * @brief	Packet version of updateClosestHit: records this object for every
+ * 			ray that hits it closer than that ray's closest hit so far.
+ * @param 		  	packet 	The packet.
+ * @param [in,out]	closest	The closest hits so far.
+ */
+
+void VisibleIShape::updateClosestHits(const RayPacket &packet, PacketHits &closest) const {
+	const int mightHit = bounded ? intersectBoxPacket(packet, &bounds.lower[0], &bounds.upper[0], closest.t)
+									: (1 << packet.size) - 1;
+	if (mightHit == 0) {
+		return;
+	}
+
+	float t[MAX_PACKET_SIZE];
+	int primitives[MAX_PACKET_SIZE] = { 0 };
+	shape->findClosestIntersections(packet, t, primitives);
+	for (int i = 0; i < packet.size; i++) {
+		if ((mightHit & (1 << i)) != 0 && t[i] < closest.t[i] && t[i] > 0) {
+			closest.t[i] = t[i];
+			closest.objects[i] = this;
+			closest.primitives[i] = primitives[i];
+		}
+	}
+}
+
+/**
+ * @fn	void VisibleIShape::intersect(const RayBatch &rays, HitBatch &hits) const
+ * @brief	Batch version of updateClosestHit: records this object for every
+ * 			active ray that hits it closer than that ray's closest hit so far.
+ * @param 		  	rays	The rays.
+ * @param [in,out]	hits	The closest hits so far.
+ */
+
+void VisibleIShape::intersect(const RayBatch &rays, HitBatch &hits) const {
+	if (mightIntersect(rays, hits.t)) {
+		shape->intersect(rays, this, hits);
+	}
+}
+
+/**
+ * @fn	void VisibleIShape::occlude(RayBatch &rays) const
+ * @brief	Batch version of occludes: clears the active flag of every ray this
+ * 			object blocks.
+ * @param [in,out]	rays	The rays.
+ */
+
+void VisibleIShape::occlude(RayBatch &rays) const {
+	if (!bounded) {
+		shape->occlude(rays);
+		return;
+	}
 
+	// Rays that miss the bounds are set aside for the shape's test, so that it
+	// only sees the ones that might be blocked.
+	static thread_local std::vector<int> culled;
+	culled.clear();
+	int numCandidates = 0;
+	for (int i = 0; i < rays.size(); i++) {
+		if (rays.active[i]) {
+			const glm::vec3 invDirection(1.0f / rays.dx[i], 1.0f / rays.dy[i], 1.0f / rays.dz[i]);
+			if (bounds.intersects(glm::vec3(rays.ox[i], rays.oy[i], rays.oz[i]), invDirection, rays.tMax[i])) {
+				numCandidates++;
+			} else {
+				rays.active[i] = 0;
+				culled.push_back(i);
+			}
+		}
+	}
+	if (numCandidates > 0) {
+		shape->occlude(rays);
+	}
+	for (unsigned int i = 0; i < culled.size(); i++) {
+		rays.active[culled[i]] = 1;
+	}
 }
 
 /**
@@ -145,6 +586,23 @@ void IDisk::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
 	}
 }
 
+/**
+ * @fn	bool IDisk::getBounds(AABB &box) const
+ * @brief	Computes the box that bounds the disk. Along each axis the disk
+ * 			extends radius * sqrt(1 - n[i]^2) from its center.
+ * @param [in,out]	box	The bounding box.
+ * @return	True
+ */
+
+bool IDisk::getBounds(AABB &box) const {
+	glm::vec3 N = glm::normalize(n);
+	glm::vec3 halfSize(radius * std::sqrt(std::max(0.0f, 1.0f - N.x * N.x)),
+						radius * std::sqrt(std::max(0.0f, 1.0f - N.y * N.y)),
+						radius * std::sqrt(std::max(0.0f, 1.0f - N.z * N.z)));
+	box = AABB(center - halfSize, center + halfSize);
+	return true;
+}
+
 /**
  * @fn	ISphere::ISphere(const glm::vec3 & position, float radius)
  * @brief	Implicit representation of a 3D sphere.
@@ -169,55 +627,40 @@ void ISphere::getTexCoords(const glm::vec3 &pt, float &u, float &v) const {
 }
 
 /**
- * @fn	void ISphere::computeAqBqCq(const Ray &ray, float &Aq, float &Bq, float &Cq) const
- * @see textbook.
- * @brief	Calculates aq, bq, and cq that are used in the quadric equations. The 
- * 			values that are know to be zero are eliminated from the code.
- * @param 		  	ray	The ray.
- * @param [in,out]	Aq 	aq.
- * @param [in,out]	Bq 	bq.
- * @param [in,out]	Cq 	cq.
- */
-
-void ISphere::computeAqBqCq(const Ray &ray, float &Aq, float &Bq, float &Cq) const {
-	const float &A = qParams.A;
-	const float &B = qParams.B;
-	const float &C = qParams.C;
-	const float &D = qParams.D;
-	const float &E = qParams.E;
-	const float &F = qParams.F;
-	const float &G = qParams.G;
-	const float &H = qParams.H;
-	const float &I = qParams.I;
-	const float &J = qParams.J;
-
-	glm::vec3 Ro = ray.origin - center;
-	const glm::vec3 &Rd = ray.direction;
-
-	Aq = /*A * */ (Rd.x*Rd.x) +
-		/*B * */ (Rd.y*Rd.y) +
-		/*C * */ (Rd.z*Rd.z);
-		//D * (Rd.x * Rd.y) +
-		//E * (Rd.x * Rd.z) +
-		//F * (Rd.y * Rd.z);
-
-	Bq = 2 * /* A * */ Ro.x*Rd.x +
-		2 * /* B * */ Ro.y*Rd.y +
-		2 * /* C * */ Ro.z*Rd.z;
-		//D * (Ro.x * Rd.y + Ro.y * Rd.x) +
-		//E * (Ro.x * Rd.z + Ro.z * Rd.x) +
-		//F * (Ro.y * Rd.z + Ro.z * Rd.y) +
-		//G * Rd.x + H * Rd.y + I * Rd.z;
-
-	Cq = /* A * */ (Ro.x * Ro.x) +
-		/* B * */ (Ro.y * Ro.y) +
-		/* C * */ (Ro.z * Ro.z) +
-		//D * (Ro.x * Ro.y) +
-		//E * (Ro.x * Ro.z) +
-		//F * (Ro.y * Ro.z) +
-		//G * Ro.x +
-		//H * Ro.y +
-		I * Ro.z + J;
+ * @fn	void ISphere::intersect(const RayBatch &rays, const VisibleIShape *object, HitBatch &hits) const
+ * @brief	Intersects a batch of rays with the sphere, without a virtual call
+ * 			per ray.
+ * @param 		  	rays  	The rays.
+ * @param 		  	object	The object this shape belongs to, recorded for its hits.
+ * @param [in,out]	hits  	The closest hits so far.
+ */
+
+void ISphere::intersect(const RayBatch &rays, const VisibleIShape *object, HitBatch &hits) const {
+	intersectUnclipped(rays, object, hits);
+}
+
+/**
+ * @fn	void ISphere::occlude(RayBatch &rays) const
+ * @brief	Clears the active flag of every ray the sphere blocks, without a
+ * 			virtual call per ray.
+ * @param [in,out]	rays	The rays.
+ */
+
+void ISphere::occlude(RayBatch &rays) const {
+	occludeUnclipped(rays);
+}
+
+/**
+ * @fn	bool ISphere::getBounds(AABB &box) const
+ * @brief	Computes the box that bounds the sphere.
+ * @param [in,out]	box	The bounding box.
+ * @return	True
+ */
+
+bool ISphere::getBounds(AABB &box) const {
+	float R = std::sqrt(-qParams.J);
+	box = AABB(center - glm::vec3(R, R, R), center + glm::vec3(R, R, R));
+	return true;
 }
 
 /**
@@ -227,15 +670,8 @@ void ISphere::computeAqBqCq(const Ray &ray, float &Aq, float &Bq, float &Cq) con
  * @param	size  	The size of the box.
  */
 
-IBox::IBox(const glm::vec3 &center, const glm::vec3 &size) 
-		: IShape() {
-	glm::vec3 sizeDiv2 = 0.5f * size;
-	rects.push_back(IRect(center + glm::vec3(sizeDiv2.x, 0, 0), glm::vec3(1, 0, 0), size.y, size.z));
-	rects.push_back(IRect(center - glm::vec3(sizeDiv2.x, 0, 0), glm::vec3(-1, 0, 0), size.y, size.z));
-	rects.push_back(IRect(center + glm::vec3(0, sizeDiv2.y, 0), glm::vec3(0, 1, 0), size.x, size.z));
-	rects.push_back(IRect(center - glm::vec3(0, sizeDiv2.y, 0), glm::vec3(0, -1, 0), size.x, size.z));
-	rects.push_back(IRect(center + glm::vec3(0, 0, sizeDiv2.z), glm::vec3(0, 0, 1), size.x, size.y));
-	rects.push_back(IRect(center - glm::vec3(0, 0, sizeDiv2.z), glm::vec3(0, 0, -1), size.x, size.y));
+IBox::IBox(const glm::vec3 &center, const glm::vec3 &size)
+		: IShape(), lower(center - 0.5f * size), upper(center + 0.5f * size) {
 }
 
 /**
@@ -257,15 +693,118 @@ IBox::IBox(const glm::vec3 &center, float size)
  */
 
 void IBox::findClosestIntersection(const Ray &ray, HitRecord &theHit) const {
-	for (unsigned int i = 0; i < rects.size(); i++) {
-		HitRecord thisHit;
-		rects[i].findClosestIntersection(ray, thisHit);
-		if (thisHit.t < theHit.t) {
-			theHit = thisHit;
-		}
+	int face;
+	float t = findClosestT(ray, face);
+	if (t < theHit.t) {
+		theHit.t = t;
+		theHit.interceptPoint = ray.getPoint(t);
+		theHit.surfaceNormal = faceNormal(face);
+	}
+}
+
+/**
+ * @fn	float IBox::findClosestT(const Ray &ray, int &primitive) const
+ * @brief	Slab test. Along each axis the ray is inside the box between the
+ * 			t values of the two faces; it is inside the box where those
+ * 			intervals overlap. The intervals are combined with selects rather
+ * 			than branches, keeping track of the face each end lies on. From
+ * 			inside the box, the ray hits the face it leaves through.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Set to the Face hit.
+ * @return	The t of the closest intersection in front of the ray's origin, or
+ * 			FLT_MAX.
+ */
+
+float IBox::findClosestT(const Ray &ray, int &primitive) const {
+	float tNear = -FLT_MAX;
+	float tFar = FLT_MAX;
+	int nearFace = 0;
+	int farFace = 0;
+	for (int i = 0; i < 3; i++) {
+		const float tLower = (lower[i] - ray.origin[i]) / ray.direction[i];
+		const float tUpper = (upper[i] - ray.origin[i]) / ray.direction[i];
+		const bool lowerFirst = tLower < tUpper;
+		const float tEnter = lowerFirst ? tLower : tUpper;
+		const float tExit = lowerFirst ? tUpper : tLower;
+		const bool nearer = tEnter > tNear;
+		const bool farther = tExit < tFar;
+		tNear = nearer ? tEnter : tNear;
+		nearFace = nearer ? 2 * i + lowerFirst : nearFace;
+		tFar = farther ? tExit : tFar;
+		farFace = farther ? 2 * i + !lowerFirst : farFace;
+	}
+	const bool inFront = tNear > 0;
+	const float t = inFront ? tNear : tFar;
+	primitive = inFront ? nearFace : farFace;
+	return tNear <= tFar && t > 0 ? t : FLT_MAX;
+}
+
+/**
+ * @fn	void IBox::completeHit(const Ray &ray, int primitive, HitRecord &hit) const
+ * @brief	Completes the hit on the face that was hit.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	primitive	The Face, from findClosestT.
+ * @param [in,out]	hit		 	The hit.
+ */
+
+void IBox::completeHit(const Ray &ray, int primitive, HitRecord &hit) const {
+	const int axis = primitive / 2;
+	const float plane = primitive % 2 == 0 ? upper[axis] : lower[axis];
+	hit.t = (plane - ray.origin[axis]) / ray.direction[axis];
+	hit.interceptPoint = ray.getPoint(hit.t);
+	hit.surfaceNormal = faceNormal(primitive);
+}
+
+/**
+ * @fn	void IBox::getTexCoords(const glm::vec3 &pt, float &u, float &v) const
+ * @brief	Gets texture coordinates for a point on the surface. Each face is
+ * 			mapped onto the whole texture: x faces by (z, y), y faces by (x, z)
+ * 			and z faces by (x, y).
+ * @param 		  	pt	The point on the surface.
+ * @param [in,out]	u 	The u in the (u, v) texture coordinates.
+ * @param [in,out]	v 	The v in the (u, v) texture coordinates.
+ */
+
+void IBox::getTexCoords(const glm::vec3 &pt, float &u, float &v) const {
+	const glm::vec3 p = (pt - lower) / (upper - lower);
+	const glm::vec3 offFace = glm::min(p, 1.0f - p);
+	if (std::abs(offFace.x) <= std::abs(offFace.y) && std::abs(offFace.x) <= std::abs(offFace.z)) {
+		u = p.z;
+		v = p.y;
+	} else if (std::abs(offFace.y) <= std::abs(offFace.z)) {
+		u = p.x;
+		v = p.z;
+	} else {
+		u = p.x;
+		v = p.y;
 	}
 }
 
+/**
+ * @fn	glm::vec3 IBox::faceNormal(int face)
+ * @brief	The outward normal of a face.
+ * @param	face	The Face.
+ * @return	The normal.
+ */
+
+glm::vec3 IBox::faceNormal(int face) {
+	glm::vec3 normal(0, 0, 0);
+	normal[face / 2] = face % 2 == 0 ? 1.0f : -1.0f;
+	return normal;
+}
+
+/**
+ * @fn	bool IBox::getBounds(AABB &box) const
+ * @brief	Computes the box that bounds the box; itself.
+ * @param [in,out]	box	The bounding box.
+ * @return	True
+ */
+
+bool IBox::getBounds(AABB &box) const {
+	box = AABB(lower, upper);
+	return true;
+}
+
 /**
  * @fn	QuadricParameters::QuadricParameters() : QuadricParameters(std::vector<float> {1, 1, 1, 0, 0, 0, 0, 0, 0, -1})
  * @brief	Default constructor
@@ -367,6 +906,23 @@ QuadricParameters QuadricParameters::ellipsoidQParams(const glm::vec3 &sz) {
 	return QuadricParameters(size.x, size.y, size.z, 0, 0, 0, 0, 0, 0, -1);
 }
 
+/**
+ * @fn	int QuadricParameters::getTerms() const
+ * @brief	Finds the terms whose coefficients are not 0.
+ * @return	The QuadricTerms of the nonzero coefficients.
+ */
+
+int QuadricParameters::getTerms() const {
+	const float coefficients[10] = { A, B, C, D, E, F, G, H, I, J };
+	int terms = 0;
+	for (int i = 0; i < 10; i++) {
+		if (coefficients[i] != 0.0f) {
+			terms |= 1 << i;
+		}
+	}
+	return terms;
+}
+
 QuadricParameters QuadricParameters::coneYQParams(float R) {
 	float R2 = R * R;
 	return QuadricParameters(1.0f / R2, -1, 1.0f / R2, 0, 0, 0, 0, 0, 0, 0);
@@ -380,23 +936,56 @@ QuadricParameters QuadricParameters::coneYQParams(float R) {
  */
 
 void IPlane::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
-	float denom = glm::dot(ray.direction, n);
+	int primitive;
+	hit.t = IPlane::findClosestT(ray, primitive);
+	if (hit.t < FLT_MAX) {
+		hit.interceptPoint = ray.getPoint(hit.t);
+		hit.surfaceNormal = n;
+	}
+}
 
+/**
+ * @fn	float IPlane::findClosestT(const Ray &ray, int &primitive) const
+ * @brief	Finds where the ray meets the plane, without the intercept point.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Unchanged; a plane has one part.
+ * @return	The t of the intersection, or FLT_MAX if it is behind the ray or the
+ * 			ray is parallel to the plane.
+ */
+
+float IPlane::findClosestT(const Ray &ray, int &/*primitive*/) const {
+	float denom = glm::dot(ray.direction, n);
 	if (denom == 0) {
-		hit.t = FLT_MAX;
-	}
-	else {
-		float num = glm::dot(a - ray.origin, n);
-		hit.t = num / denom;
-		if (hit.t < 0) {
-			hit.t = FLT_MAX;
-		}
-		else {
-			hit.interceptPoint = ray.getPoint(hit.t);
-			hit.surfaceNormal = n;
-		}
+		return FLT_MAX;
 	}
+	float num = glm::dot(a - ray.origin, n);
+	float t = num / denom;
+	return t < 0 ? FLT_MAX : t;
+}
+
+/**
+ * @fn	void IPlane::findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int primitives[MAX_PACKET_SIZE]) const
+ * @brief	Intersects a packet of rays with the plane using the SIMD kernel.
+ * @param 		  	packet	  	The packet.
+ * @param [in,out]	t		  	The intercept for each ray, or FLT_MAX.
+ * @param [in,out]	primitives	Unchanged; a plane has one part.
+ */
 
+void IPlane::findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int /*primitives*/[MAX_PACKET_SIZE]) const {
+	const float point[3] = { a.x, a.y, a.z };
+	const float normal[3] = { n.x, n.y, n.z };
+	intersectPlanePacket(packet, point, normal, t);
+}
+
+/**
+ * @fn	bool IPlane::getBounds(AABB &box) const
+ * @brief	Planes are infinite, so they cannot be bounded.
+ * @param [in,out]	box	Unchanged.
+ * @return	False
+ */
+
+bool IPlane::getBounds(AABB &/*box*/) const {
+	return false;
 }
 
 /**
@@ -503,6 +1092,30 @@ void IRect::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
 	}
 }
 
+/**
+ * @fn	bool IRect::getBounds(AABB &box) const
+ * @brief	Computes the box that bounds the rectangle. Only axis-aligned
+ * 			rectangles are clipped to their width and height when intersected,
+ * 			so any other orientation is treated as an unbounded plane.
+ * @param [in,out]	box	The bounding box.
+ * @return	True iff the rectangle is axis-aligned.
+ */
+
+bool IRect::getBounds(AABB &box) const {
+	glm::vec3 halfSize;
+	if (std::abs(n[0]) == 1) {	// yz plane
+		halfSize = glm::vec3(0, W2, H2);
+	} else if (std::abs(n[1]) == 1) {	// xz plane
+		halfSize = glm::vec3(W2, 0, H2);
+	} else if (std::abs(n[2]) == 1) {	// xy plane
+		halfSize = glm::vec3(W2, H2, 0);
+	} else {
+		return false;
+	}
+	box = AABB(center - halfSize, center + halfSize);
+	return true;
+}
+
 /**
  * @fn	IConvexPolygon::IConvexPolygon(const std::vector<glm::vec3> &vertices)
  * @brief	Constructs a convex polygon, given the vector of vertices.
@@ -529,6 +1142,47 @@ void IConvexPolygon::findClosestIntersection(const Ray &ray, HitRecord &hit) con
 	}
 }
 
+/**
+ * @fn	float IConvexPolygon::findClosestT(const Ray &ray, int &primitive) const
+ * @brief	Polygons are clipped planes, so the plane's t is not necessarily a
+ * 			hit. Falls back on the closest intersection.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	The t of the closest intersection, or FLT_MAX.
+ */
+
+float IConvexPolygon::findClosestT(const Ray &ray, int &primitive) const {
+	return IShape::findClosestT(ray, primitive);
+}
+
+/**
+ * @fn	void IConvexPolygon::findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int primitives[MAX_PACKET_SIZE]) const
+ * @brief	Polygons are clipped planes, so the plane kernel does not apply.
+ * 			The rays are intersected one at a time.
+ * @param 		  	packet	  	The packet.
+ * @param [in,out]	t		  	The closest t for each ray, or FLT_MAX.
+ * @param [in,out]	primitives	The part of the shape hit by each ray.
+ */
+
+void IConvexPolygon::findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int primitives[MAX_PACKET_SIZE]) const {
+	IShape::findClosestIntersections(packet, t, primitives);
+}
+
+/**
+ * @fn	bool IConvexPolygon::getBounds(AABB &box) const
+ * @brief	Computes the box that bounds the polygon's vertices.
+ * @param [in,out]	box	The bounding box.
+ * @return	True
+ */
+
+bool IConvexPolygon::getBounds(AABB &box) const {
+	box = AABB();
+	for (unsigned int i = 0; i < v.size(); i++) {
+		box.expand(v[i]);
+	}
+	return true;
+}
+
 /**
  * @fn	bool IConvexPolygon::isInside(const glm::vec3 &point) const
  * @brief	Query if 'point' is inside
@@ -565,9 +1219,10 @@ bool IConvexPolygon::isInside(const glm::vec3 &point) const {
 IQuadricSurface::IQuadricSurface(const QuadricParameters &params,
 								const glm::vec3 &position)
 		: IShape(), qParams(params), center(position) {
-	twoA = 2.0f * qParams.A;
-	twoB = 2.0f * qParams.B;
-	twoC = 2.0f * qParams.C;
+	const QuadricParameters &q = qParams;
+	coefficients = { q.A, q.B, q.C, q.D, q.E, q.F, q.G, q.H, q.I, q.J,
+					2.0f * q.A, 2.0f * q.B, 2.0f * q.C };
+	kernel = &QuadricKernel::select(qParams.getTerms());
 }
 
 /**
@@ -594,7 +1249,8 @@ IQuadricSurface::IQuadricSurface(const glm::vec3 &position)
 
 /**
  * @fn	void IQuadricSurface::computeAqBqCq(const Ray &ray, float &Aq, float &Bq, float &Cq) const
- * @brief	Calculates the aq bq cq
+ * @brief	Calculates the aq bq cq, with the kernel chosen for this quadric's
+ * 			coefficients when it was constructed.
  * @param 		  	ray	The ray.
  * @param [in,out]	Aq 	The aq.
  * @param [in,out]	Bq 	The bq.
@@ -602,72 +1258,55 @@ IQuadricSurface::IQuadricSurface(const glm::vec3 &position)
  */
 
 void IQuadricSurface::computeAqBqCq(const Ray &ray, float &Aq, float &Bq, float &Cq) const {
-	glm::vec3 Ro = ray.origin - center;
-	const glm::vec3 &Rd = ray.direction;
-	const float &A = qParams.A;
-	const float &B = qParams.B;
-	const float &C = qParams.C;
-	const float &D = qParams.D;
-	const float &E = qParams.E;
-	const float &F = qParams.F;
-	const float &G = qParams.G;
-	const float &H = qParams.H;
-	const float &I = qParams.I;
-	const float &J = qParams.J;
-	Aq = A * (Rd.x*Rd.x) +
-		B * (Rd.y*Rd.y) +
-		C * (Rd.z*Rd.z) +
-		D * (Rd.x * Rd.y) +
-		E * (Rd.x * Rd.z) +
-		F * (Rd.y * Rd.z);
-
-	Bq = twoA * Ro.x*Rd.x +
-		twoB * Ro.y*Rd.y +
-		twoC * Ro.z*Rd.z +
-		D * (Ro.x * Rd.y + Ro.y * Rd.x) +
-		E * (Ro.x * Rd.z + Ro.z * Rd.x) +
-		F * (Ro.y * Rd.z + Ro.z * Rd.y) +
-		G * Rd.x + H * Rd.y + I * Rd.z;
-
-	Cq = A * (Ro.x * Ro.x) +
-		B * (Ro.y * Ro.y) +
-		C * (Ro.z * Ro.z) +
-		D * (Ro.x * Ro.y) +
-		E * (Ro.x * Ro.z) +
-		F * (Ro.y * Ro.z) +
-		G * Ro.x +
-		H * Ro.y +
-		I * Ro.z + J;
+	kernel->computeAqBqCq(coefficients, center, ray.origin, ray.direction, Aq, Bq, Cq);
 }
 
 /**
  * @fn	int IQuadricSurface::findIntersections(const Ray &ray, HitRecord hits[2]) const
- * @brief	Searches for the first intersections
+ * @brief	Searches for the first intersections. The results are written
+ * 			only to the caller's array, so this can run on many threads at once.
  * @param	ray 	The ray.
- * @param	hits	The hits.
+ * @param	hits	Caller-provided storage for up to two hits.
  * @return	The found intersections.
  */
 
 int IQuadricSurface::findIntersections(const Ray &ray, HitRecord hits[2]) const {
-	float Aq, Bq, Cq;
-	computeAqBqCq(ray, Aq, Bq, Cq);
 	float roots[2];
+	int numIntersections = findRoots(ray, roots);
+
+	for (int i = 0; i < numIntersections; i++) {
+		const float &t = roots[i];
+		hits[i].t = t;
+		hits[i].interceptPoint = ray.origin + t * ray.direction;
+		const glm::vec3 &intercept = hits[i].interceptPoint;
+		hits[i].surfaceNormal = normal(intercept);
+	}
+
+	return numIntersections;
+}
 
-	int numRoots = quadratic(Aq, Bq, Cq, roots);
-	int numIntersections = 0;
+/**
+ * @fn	int IQuadricSurface::findRoots(const Ray &ray, float roots[2]) const
+ * @brief	Finds the t values where the ray meets the quadric in front of its
+ * 			origin, without computing intercept points or normals.
+ * @param	ray  	The ray.
+ * @param	roots	Caller-provided storage for up to two roots, in increasing order.
+ * @return	The number of positive roots.
+ */
+
+int IQuadricSurface::findRoots(const Ray &ray, float roots[2]) const {
+	float Aq, Bq, Cq;
+	computeAqBqCq(ray, Aq, Bq, Cq);
+	float allRoots[2];
 
+	int numRoots = quadratic(Aq, Bq, Cq, allRoots);
+	int numPositive = 0;
 	for (int i = 0; i < numRoots; i++) {
-		if (roots[i] > 0) {
-			const float &t = roots[i];
-			hits[numIntersections].t = t;
-			hits[numIntersections].interceptPoint = ray.origin + t * ray.direction;
-			const glm::vec3 &intercept = hits[numIntersections].interceptPoint;
-			hits[numIntersections].surfaceNormal = normal(intercept);
-			numIntersections++;
+		if (allRoots[i] > 0) {
+			roots[numPositive++] = allRoots[i];
 		}
 	}
-
-	return numIntersections;
+	return numPositive;
 }
 
 /**
@@ -678,27 +1317,97 @@ int IQuadricSurface::findIntersections(const Ray &ray, HitRecord hits[2]) const
  */
 
 void IQuadricSurface::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
-	static HitRecord hits[2];
-	hit.t = FLT_MAX;
-
-	int numIntercepts = findIntersections(ray, hits);
-	if (numIntercepts == 1 && hits[0].t > 0) {
-		hit.t = hits[0].t;
-		hit.interceptPoint = hits[0].interceptPoint;
+	int primitive;
+	hit.t = IQuadricSurface::findClosestT(ray, primitive);
+	if (hit.t < FLT_MAX) {
+		hit.interceptPoint = ray.origin + hit.t * ray.direction;
 		hit.surfaceNormal = normal(hit.interceptPoint);
-	} else if (numIntercepts == 2) {
-		if (hits[0].t > 0) {
-			hit.t = hits[0].t;
-			hit.interceptPoint = hits[0].interceptPoint;
-			hit.surfaceNormal = normal(hit.interceptPoint);
-		} else if (hits[1].t > 0) {
-			hit.t = hits[1].t;
-			hit.interceptPoint = hits[1].interceptPoint;
-			hit.surfaceNormal = normal(hit.interceptPoint);
+	}
+}
+
+/**
+ * @fn	float IQuadricSurface::findClosestT(const Ray &ray, int &primitive) const
+ * @brief	Finds the smallest positive root. The intercept point and normal
+ * 			are left to findClosestIntersection, which only computes them for
+ * 			that root.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Unchanged; a quadric has one part.
+ * @return	The smallest positive root, or FLT_MAX.
+ */
+
+float IQuadricSurface::findClosestT(const Ray &ray, int &/*primitive*/) const {
+	float Aq, Bq, Cq;
+	computeAqBqCq(ray, Aq, Bq, Cq);
+	return closestQuadricRoot(Aq, Bq, Cq);
+}
+
+/**
+ * @fn	bool IQuadricSurface::occludes(const Ray &ray, float tMax) const
+ * @brief	Determines if the quadric blocks the ray in (0, tMax). Only the
+ * 			roots are needed; no intercept points or normals are computed.
+ * @param	ray 	The ray.
+ * @param	tMax	The farthest t of interest.
+ * @return	True iff a root lies in (0, tMax).
+ */
+
+bool IQuadricSurface::occludes(const Ray &ray, float tMax) const {
+	float Aq, Bq, Cq;
+	computeAqBqCq(ray, Aq, Bq, Cq);
+	return closestQuadricRoot(Aq, Bq, Cq) < tMax;
+}
+
+/**
+ * @fn	void IQuadricSurface::intersectUnclipped(const RayBatch &rays, const VisibleIShape *object, HitBatch &hits) const
+ * @brief	Batch version of IQuadricSurface::findClosestT, for quadrics that
+ * 			are not clipped. Calling it non-virtually lets the compiler inline
+ * 			the root finding into the loop.
+ * @param 		  	rays  	The rays.
+ * @param 		  	object	The object this shape belongs to, recorded for its hits.
+ * @param [in,out]	hits  	The closest hits so far.
+ */
+
+void IQuadricSurface::intersectUnclipped(const RayBatch &rays, const VisibleIShape *object, HitBatch &hits) const {
+	for (int i = 0; i < rays.size(); i++) {
+		if (rays.active[i]) {
+			int primitive = 0;
+			float t = IQuadricSurface::findClosestT(rays.getRay(i), primitive);
+			// A hit, and in front of the ray's start, as in updateClosestHit.
+			if (t < FLT_MAX && t > 0) {
+				hits.update(i, rays.tMin[i] + t, object, primitive);
+			}
 		}
 	}
 }
 
+/**
+ * @fn	void IQuadricSurface::occludeUnclipped(RayBatch &rays) const
+ * @brief	Batch version of IQuadricSurface::occludes, for quadrics that are
+ * 			not clipped.
+ * @param [in,out]	rays	The rays.
+ */
+
+void IQuadricSurface::occludeUnclipped(RayBatch &rays) const {
+	for (int i = 0; i < rays.size(); i++) {
+		if (rays.active[i] && IQuadricSurface::occludes(rays.getRay(i), rays.getLength(i))) {
+			rays.active[i] = 0;
+		}
+	}
+}
+
+/**
+ * @fn	void IQuadricSurface::findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int primitives[MAX_PACKET_SIZE]) const
+ * @brief	Intersects a packet of rays with the quadric using the SIMD kernel,
+ * 			which matches findClosestIntersection bit for bit.
+ * @param 		  	packet	  	The packet.
+ * @param [in,out]	t		  	The closest t for each ray, or FLT_MAX.
+ * @param [in,out]	primitives	Unchanged; a quadric has one part.
+ */
+
+void IQuadricSurface::findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int /*primitives*/[MAX_PACKET_SIZE]) const {
+	const float centerXYZ[3] = { center.x, center.y, center.z };
+	kernel->intersectPacket(packet, coefficients, centerXYZ, t);
+}
+
 /**
  * @fn	glm::vec3 IQuadricSurface::normal(const glm::vec3 &P) const
  * @brief	Normals the given p
@@ -707,21 +1416,7 @@ void IQuadricSurface::findClosestIntersection(const Ray &ray, HitRecord &hit) co
  */
 
 glm::vec3 IQuadricSurface::normal(const glm::vec3 &P) const {
-	const float &A = qParams.A;
-	const float &B = qParams.B;
-	const float &C = qParams.C;
-	const float &D = qParams.D;
-	const float &E = qParams.E;
-	const float &F = qParams.F;
-	const float &G = qParams.G;
-	const float &H = qParams.H;
-	const float &I = qParams.I;
-	const float &J = qParams.J;
-	glm::vec3 pt = P - center;
-	glm::vec3 normal(twoA * pt.x + D * pt.y + E * pt.z + G,
-					twoB * pt.y + D * pt.x + F * pt.z + H,
-					twoC * pt.z + E * pt.x + F * pt.y + I);
-	return glm::normalize(normal);
+	return glm::normalize(kernel->gradient(coefficients, P - center));
 }
 
 /**
@@ -739,52 +1434,29 @@ ICylinder::ICylinder(const glm::vec3 &pos, float R, float L,
 }
 
 /**
- * @fn	void ICylinder::computeAqBqCq(const Ray &ray, float &Aq, float &Bq, float &Cq) const
- * @brief	Calculates the aq bq cq
- * @param 		  	ray	The ray.
- * @param [in,out]	Aq 	The aq.
- * @param [in,out]	Bq 	The bq.
- * @param [in,out]	Cq 	The cq.
+ * @fn	bool ICylinder::occludes(const Ray &ray, float tMax) const
+ * @brief	Cylinders are clipped to their length, so a root of the quadric is
+ * 			not necessarily a hit. Falls back on the closest intersection.
+ * @param	ray 	The ray.
+ * @param	tMax	The farthest t of interest.
+ * @return	True iff the cylinder blocks the ray.
  */
 
-void ICylinder::computeAqBqCq(const Ray &ray, float &Aq, float &Bq, float &Cq) const {
-	const float &A = qParams.A;
-	const float &B = qParams.B;
-	const float &C = qParams.C;
-	const float &D = qParams.D;
-	const float &E = qParams.E;
-	const float &F = qParams.F;
-	const float &G = qParams.G;
-	const float &H = qParams.H;
-	const float &I = qParams.I;
-	const float &J = qParams.J;
-	glm::vec3 Ro = ray.origin - center;
-	const glm::vec3 &Rd = ray.direction;
-
-	Aq = A * (Rd.x*Rd.x) +
-		B * (Rd.y*Rd.y) +
-		C * (Rd.z*Rd.z);
-	//D * (Rd.x * Rd.y) +
-	//E * (Rd.x * Rd.z) +
-	//F * (Rd.y * Rd.z);
-
-	Bq = twoA * Ro.x*Rd.x +
-		twoB * Ro.y*Rd.y +
-		twoC * Ro.z*Rd.z;
-	//D * (Ro.x * Rd.y + Ro.y * Rd.x) +
-	//E * (Ro.x * Rd.z + Ro.z * Rd.x) +
-	//F * (Ro.y * Rd.z + Ro.z * Rd.y) +
-	//G * Rd.x + H * Rd.y + I * Rd.z;
-
-	Cq = A * (Ro.x * Ro.x) +
-		B * (Ro.y * Ro.y) +
-		C * (Ro.z * Ro.z) +
-		//D * (Ro.x * Ro.y) +
-		//E * (Ro.x * Ro.z) +
-		//F * (Ro.y * Ro.z) +
-		//G * Ro.x +
-		//H * Ro.y +
-		I * Ro.z + J;
+bool ICylinder::occludes(const Ray &ray, float tMax) const {
+	return IShape::occludes(ray, tMax);
+}
+
+/**
+ * @fn	void ICylinder::findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int primitives[MAX_PACKET_SIZE]) const
+ * @brief	Cylinders are clipped, so the quadric kernel does not apply. The
+ * 			rays are intersected one at a time.
+ * @param 		  	packet	  	The packet.
+ * @param [in,out]	t		  	The closest t for each ray, or FLT_MAX.
+ * @param [in,out]	primitives	The part of the shape hit by each ray.
+ */
+
+void ICylinder::findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int primitives[MAX_PACKET_SIZE]) const {
+	IShape::findClosestIntersections(packet, t, primitives);
 }
 
 /**
@@ -807,24 +1479,33 @@ ICylinderY::ICylinderY(const glm::vec3 &pos, float rad, float len)
  */
 
 void ICylinderY::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
-	const glm::vec3 &rayOrigin = ray.origin;
-	const glm::vec3 &rayDirection = ray.direction;
-	static HitRecord hits[2];
-	int numHits = ICylinder::findIntersections(ray, hits);
-	float minHit = FLT_MAX;
-	for (int i = 0; i < numHits; i++) {
-		if (hits[i].interceptPoint.y < center.y + length / 2 &&
-			hits[i].interceptPoint.y > center.y - length / 2) {
-				if (hits[i].t < minHit) {
-					hit = hits[i];
-					minHit = hit.t;
-				}
-		}
+	int primitive;
+	hit.t = ICylinderY::findClosestT(ray, primitive);
+	if (hit.t < FLT_MAX) {
+		hit.interceptPoint = ray.origin + hit.t * ray.direction;
+		hit.surfaceNormal = normal(hit.interceptPoint);
 	}
-	if (minHit != FLT_MAX) {
-		return;
+}
+
+/**
+ * @fn	float ICylinderY::findClosestT(const Ray &ray, int &primitive) const
+ * @brief	Finds the closest root whose intercept lies within the cylinder's length.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Unchanged; an open cylinder has one part.
+ * @return	The t of the closest intersection, or FLT_MAX.
+ */
+
+float ICylinderY::findClosestT(const Ray &ray, int &/*primitive*/) const {
+	float roots[2];
+	int numRoots = findRoots(ray, roots);
+	for (int i = 0; i < numRoots; i++) {
+		glm::vec3 intercept = ray.origin + roots[i] * ray.direction;
+		if (intercept.y < center.y + length / 2 &&
+			intercept.y > center.y - length / 2) {
+			return roots[i];
+		}
 	}
-	hit.t = FLT_MAX;
+	return FLT_MAX;
 }
 
 /**
@@ -842,6 +1523,19 @@ void ICylinderY::getTexCoords(const glm::vec3 &pt, float &u, float &v) const {
 	v = (pt.y - bottom) / length;
 }
 
+/**
+ * @fn	bool ICylinderY::getBounds(AABB &box) const
+ * @brief	Computes the box that bounds the cylinder, including any end caps.
+ * @param [in,out]	box	The bounding box.
+ * @return	True
+ */
+
+bool ICylinderY::getBounds(AABB &box) const {
+	glm::vec3 halfSize(radius, length / 2, radius);
+	box = AABB(center - halfSize, center + halfSize);
+	return true;
+}
+
 /**
  * @fn	ITriangle::ITriangle(const glm::vec3 &A, const glm::vec3 &B, const glm::vec3 &C)
  * @brief	Constructs and implicit representation of a triangle, given three vertices
@@ -889,6 +1583,21 @@ void ITriangle::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
 	}
 }
 
+/**
+ * @fn	bool ITriangle::getBounds(AABB &box) const
+ * @brief	Computes the box that bounds the triangle.
+ * @param [in,out]	box	The bounding box.
+ * @return	True
+ */
+
+bool ITriangle::getBounds(AABB &box) const {
+	box = AABB();
+	box.expand(a);
+	box.expand(b);
+	box.expand(c);
+	return true;
+}
+
 /**
  * @fn	IEllipsoid::IEllipsoid(const glm::vec3 &position, const glm::vec3 &sz) : IQuadricSurface(QuadricParameters::ellipoidParameters(sz), position)
  * @brief	Constructs an implicit representation of an ellipsoid.
@@ -901,52 +1610,41 @@ IEllipsoid::IEllipsoid(const glm::vec3 &position, const glm::vec3 &sz)
 }
 
 /**
- * @fn	void IEllipsoid::computeAqBqCq(const Ray &ray, float &Aq, float &Bq, float &Cq) const
- * @brief	Calculates the aq bq cq, given a particular ray.
- * @param 		  	ray	The ray.
- * @param [in,out]	Aq 	Aq.
- * @param [in,out]	Bq 	Bq.
- * @param [in,out]	Cq 	Cq.
- */
-
-void IEllipsoid::computeAqBqCq(const Ray &ray, float &Aq, float &Bq, float &Cq) const {
-	const float &A = qParams.A;
-	const float &B = qParams.B;
-	const float &C = qParams.C;
-	const float &D = qParams.D;
-	const float &E = qParams.E;
-	const float &F = qParams.F;
-	const float &G = qParams.G;
-	const float &H = qParams.H;
-	const float &I = qParams.I;
-	const float &J = qParams.J;
-	glm::vec3 Ro = ray.origin - center;
-	const glm::vec3 &Rd = ray.direction;
-
-	Aq = A * (Rd.x*Rd.x) +
-		B * (Rd.y*Rd.y) +
-		C * (Rd.z*Rd.z);
-	//D * (Rd.x * Rd.y) +
-	//E * (Rd.x * Rd.z) +
-	//F * (Rd.y * Rd.z);
-
-	Bq = 2 * A * Ro.x*Rd.x +
-		2 * B * Ro.y*Rd.y +
-		2 * C * Ro.z*Rd.z;
-	//D * (Ro.x * Rd.y + Ro.y * Rd.x) +
-	//E * (Ro.x * Rd.z + Ro.z * Rd.x) +
-	//F * (Ro.y * Rd.z + Ro.z * Rd.y) +
-	//G * Rd.x + H * Rd.y + I * Rd.z;
-
-	Cq = A * (Ro.x * Ro.x) +
-		B * (Ro.y * Ro.y) +
-		C * (Ro.z * Ro.z) +
-		//D * (Ro.x * Ro.y) +
-		//E * (Ro.x * Ro.z) +
-		//F * (Ro.y * Ro.z) +
-		//G * Ro.x +
-		//H * Ro.y +
-		I * Ro.z + J;
+ * @fn	void IEllipsoid::intersect(const RayBatch &rays, const VisibleIShape *object, HitBatch &hits) const
+ * @brief	Intersects a batch of rays with the ellipsoid, without a virtual
+ * 			call per ray.
+ * @param 		  	rays  	The rays.
+ * @param 		  	object	The object this shape belongs to, recorded for its hits.
+ * @param [in,out]	hits  	The closest hits so far.
+ */
+
+void IEllipsoid::intersect(const RayBatch &rays, const VisibleIShape *object, HitBatch &hits) const {
+	intersectUnclipped(rays, object, hits);
+}
+
+/**
+ * @fn	void IEllipsoid::occlude(RayBatch &rays) const
+ * @brief	Clears the active flag of every ray the ellipsoid blocks, without a
+ * 			virtual call per ray.
+ * @param [in,out]	rays	The rays.
+ */
+
+void IEllipsoid::occlude(RayBatch &rays) const {
+	occludeUnclipped(rays);
+}
+
+/**
+ * @fn	bool IEllipsoid::getBounds(AABB &box) const
+ * @brief	Computes the box that bounds the ellipsoid. The semi-axis lengths
+ * 			are recovered from the quadric parameters, A = 1/(sx*sx), etc.
+ * @param [in,out]	box	The bounding box.
+ * @return	True
+ */
+
+bool IEllipsoid::getBounds(AABB &box) const {
+	glm::vec3 halfSize(1.0f / std::sqrt(qParams.A), 1.0f / std::sqrt(qParams.B), 1.0f / std::sqrt(qParams.C));
+	box = AABB(center - halfSize, center + halfSize);
+	return true;
 }
 
 /**
@@ -971,31 +1669,57 @@ IClosedCylinderY::IClosedCylinderY(const glm::vec3 &pos, float rad, float len)
 */
 
 void IClosedCylinderY::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
-	const glm::vec3 &rayOrigin = ray.origin;
-	const glm::vec3 &rayDirection = ray.direction;
-	static HitRecord hits[2];
-	int numHits = ICylinder::findIntersections(ray, hits);
-	for (int i = 0; i < numHits; i++) {
-		if (hits[i].interceptPoint.y < center.y + length / 2 &&
-			hits[i].interceptPoint.y > center.y - length / 2) {
-			if (hits[i].t < hit.t)
-				hit = hits[i];
-		}
+	int primitive;
+	if (IClosedCylinderY::findClosestT(ray, primitive) < FLT_MAX) {
+		IClosedCylinderY::completeHit(ray, primitive, hit);
+	} else {
+		hit.t = FLT_MAX;
 	}
+}
+
+/**
+ * @fn	float IClosedCylinderY::findClosestT(const Ray &ray, int &primitive) const
+ * @brief	Finds the closest of the side and the two end caps.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Set to the part hit: SIDE, TOP or BOTTOM.
+ * @return	The t of the closest intersection, or FLT_MAX.
+ */
 
-	HitRecord topHit;
-	top.findClosestIntersection(ray, topHit);
-	if (topHit.t < hit.t) {
-		hit = topHit;
+float IClosedCylinderY::findClosestT(const Ray &ray, int &primitive) const {
+	int part;
+	float t = ICylinderY::findClosestT(ray, part);
+	primitive = SIDE;
+
+	float topT = top.findClosestT(ray, part);
+	if (topT < t) {
+		t = topT;
+		primitive = TOP;
 	}
 
-	HitRecord bottomHit;
-	bottom.findClosestIntersection(ray, bottomHit);
-	if (bottomHit.t < hit.t) {
-		hit = bottomHit;
+	float bottomT = bottom.findClosestT(ray, part);
+	if (bottomT < t) {
+		t = bottomT;
+		primitive = BOTTOM;
 	}
+	return t;
+}
 
-	// hit.t = FLT_MAX;
+/**
+ * @fn	void IClosedCylinderY::completeHit(const Ray &ray, int primitive, HitRecord &hit) const
+ * @brief	Completes the hit on the part found by findClosestT.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	primitive	SIDE, TOP or BOTTOM.
+ * @param [in,out]	hit		 	The hit.
+ */
+
+void IClosedCylinderY::completeHit(const Ray &ray, int primitive, HitRecord &hit) const {
+	if (primitive == TOP) {
+		top.findClosestIntersection(ray, hit);
+	} else if (primitive == BOTTOM) {
+		bottom.findClosestIntersection(ray, hit);
+	} else {
+		ICylinderY::findClosestIntersection(ray, hit);
+	}
 }
 
 ICylinderX::ICylinderX(const glm::vec3 &pos, float rad, float len)
@@ -1003,18 +1727,46 @@ ICylinderX::ICylinderX(const glm::vec3 &pos, float rad, float len)
 }
 
 void ICylinderX::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
-	const glm::vec3 &rayOrigin = ray.origin;
-	const glm::vec3 &rayDirection = ray.direction;
-	static HitRecord hits[2];
-	int numHits = ICylinder::findIntersections(ray, hits);
-	for (int i = 0; i < numHits; i++) {
-		if (hits[i].interceptPoint.x < center.x + length / 2 &&
-			hits[i].interceptPoint.x > center.x - length / 2) {
-			hit = hits[i];
-			return;
+	int primitive;
+	hit.t = ICylinderX::findClosestT(ray, primitive);
+	if (hit.t < FLT_MAX) {
+		hit.interceptPoint = ray.origin + hit.t * ray.direction;
+		hit.surfaceNormal = normal(hit.interceptPoint);
+	}
+}
+
+/**
+ * @fn	float ICylinderX::findClosestT(const Ray &ray, int &primitive) const
+ * @brief	Finds the closest root whose intercept lies within the cylinder's length.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Unchanged; an open cylinder has one part.
+ * @return	The t of the closest intersection, or FLT_MAX.
+ */
+
+float ICylinderX::findClosestT(const Ray &ray, int &/*primitive*/) const {
+	float roots[2];
+	int numRoots = findRoots(ray, roots);
+	for (int i = 0; i < numRoots; i++) {
+		glm::vec3 intercept = ray.origin + roots[i] * ray.direction;
+		if (intercept.x < center.x + length / 2 &&
+			intercept.x > center.x - length / 2) {
+			return roots[i];
 		}
 	}
-	hit.t = FLT_MAX;
+	return FLT_MAX;
+}
+
+/**
+ * @fn	bool ICylinderX::getBounds(AABB &box) const
+ * @brief	Computes the box that bounds the cylinder.
+ * @param [in,out]	box	The bounding box.
+ * @return	True
+ */
+
+bool ICylinderX::getBounds(AABB &box) const {
+	glm::vec3 halfSize(length / 2, radius, radius);
+	box = AABB(center - halfSize, center + halfSize);
+	return true;
 }
 
 ICone::ICone(const glm::vec3 &pos, float R, float L,
@@ -1022,24 +1774,30 @@ ICone::ICone(const glm::vec3 &pos, float R, float L,
 	: IQuadricSurface(qParams, pos), radius(R), height(L) {
 }
 
-void ICone::computeAqBqCq(const Ray &ray, float &Aq, float &Bq, float &Cq) const {
-	glm::vec3 Ro = ray.origin - center;
-	const glm::vec3 &Rd = ray.direction;
-	const float &A = qParams.A;
-	const float &B = qParams.B;
-	const float &C = qParams.C;
+/**
+ * @fn	bool ICone::occludes(const Ray &ray, float tMax) const
+ * @brief	Cones are clipped to their height, so a root of the quadric is not
+ * 			necessarily a hit. Falls back on the closest intersection.
+ * @param	ray 	The ray.
+ * @param	tMax	The farthest t of interest.
+ * @return	True iff the cone blocks the ray.
+ */
 
-	Aq = A * (Rd.x*Rd.x) +
-		B * (Rd.y*Rd.y) +
-		C * (Rd.z*Rd.z);
+bool ICone::occludes(const Ray &ray, float tMax) const {
+	return IShape::occludes(ray, tMax);
+}
 
-	Bq = twoA * Ro.x*Rd.x +
-		twoB * Ro.y*Rd.y +
-		twoC * Ro.z*Rd.z;
+/**
+ * @fn	void ICone::findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int primitives[MAX_PACKET_SIZE]) const
+ * @brief	Cones are clipped, so the quadric kernel does not apply. The rays
+ * 			are intersected one at a time.
+ * @param 		  	packet	  	The packet.
+ * @param [in,out]	t		  	The closest t for each ray, or FLT_MAX.
+ * @param [in,out]	primitives	The part of the shape hit by each ray.
+ */
 
-	Cq = A * (Ro.x * Ro.x) +
-		B * (Ro.y * Ro.y) +
-		C * (Ro.z * Ro.z);
+void ICone::findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int primitives[MAX_PACKET_SIZE]) const {
+	IShape::findClosestIntersections(packet, t, primitives);
 }
 
 IConeY::IConeY(const glm::vec3 &pos, float R, float H)
@@ -1047,21 +1805,198 @@ IConeY::IConeY(const glm::vec3 &pos, float R, float H)
 }
 
 void IConeY::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
-	const glm::vec3 &rayOrigin = ray.origin;
-	const glm::vec3 &rayDirection = ray.direction;
-	static HitRecord hits[2];
-	int numHits = ICone::findIntersections(ray, hits);
-
-	hit.t = FLT_MAX;
+	int primitive;
+	hit.t = IConeY::findClosestT(ray, primitive);
+	if (hit.t < FLT_MAX) {
+		hit.interceptPoint = ray.origin + hit.t * ray.direction;
+		hit.surfaceNormal = normal(hit.interceptPoint);
+	}
+}
 
-	for (int i = 0; i < numHits; i++) {
-		if (hits[i].interceptPoint.y < center.y &&
-			hits[i].interceptPoint.y > center.y - height) {
-			if (hits[i].t < hit.t) {
-				hit = hits[i];
-			}
+/**
+ * @fn	float IConeY::findClosestT(const Ray &ray, int &primitive) const
+ * @brief	Finds the closest root whose intercept lies between the apex and the base.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Unchanged; a cone has one part.
+ * @return	The t of the closest intersection, or FLT_MAX.
+ */
 
+float IConeY::findClosestT(const Ray &ray, int &/*primitive*/) const {
+	float roots[2];
+	int numRoots = findRoots(ray, roots);
+	for (int i = 0; i < numRoots; i++) {
+		glm::vec3 intercept = ray.origin + roots[i] * ray.direction;
+		if (intercept.y < center.y &&
+			intercept.y > center.y - height) {
+			return roots[i];
 		}
 	}
+	return FLT_MAX;
+}
+
+/**
+ * @fn	bool IConeY::getBounds(AABB &box) const
+ * @brief	Computes the box that bounds the cone. The apex is at the center and
+ * 			the cone opens downward; its radius at depth d is radius * d.
+ * @param [in,out]	box	The bounding box.
+ * @return	True
+ */
+
+bool IConeY::getBounds(AABB &box) const {
+	float R = radius * height;
+	box = AABB(center - glm::vec3(R, height, R), center + glm::vec3(R, 0, R));
+	return true;
+}
+
+/**
+ * @fn	IInstance::IInstance(IShapePtr shapePtr, const glm::mat4 &transform)
+ * @brief	Places a shared shape in the world.
+ * @param	shapePtr 	The shape, in object coordinates.
+ * @param	transform	Object to world transformation (e.g., T(...) * Ry(...) * S(...)).
+ */
+
+IInstance::IInstance(IShapePtr shapePtr, const glm::mat4 &transform)
+	: shape(shapePtr) {
+	setTransform(transform);
+}
+
+/**
+ * @fn	void IInstance::setTransform(const glm::mat4 &transform)
+ * @brief	Moves the instance. The shared shape is untouched, but the bounds of
+ * 			the VisibleIShape holding this instance must be updated (see
+ * 			VisibleIShape::updateBounds) and the scene's BVH rebuilt.
+ * @param	transform	Object to world transformation.
+ */
+
+void IInstance::setTransform(const glm::mat4 &transform) {
+	toWorld = transform;
+	toObject = glm::inverse(transform);
+}
+
+/**
+ * @fn	Ray IInstance::toObjectRay(const Ray &ray, float &tScale) const
+ * @brief	Transforms a world space ray into object coordinates. Since rays
+ * 			have unit directions, t values differ between the two spaces by a
+ * 			constant factor: t in object space = tScale * t in world space.
+ * @param 		  	ray   	The ray, in world coordinates.
+ * @param [in,out]	tScale	Set to the ratio of object to world t values.
+ * @return	The ray in object coordinates.
+ */
+
+Ray IInstance::toObjectRay(const Ray &ray, float &tScale) const {
+	glm::vec3 origin(toObject * glm::vec4(ray.origin, 1.0f));
+	glm::vec3 direction = glm::mat3(toObject) * ray.direction;
+	tScale = glm::length(direction);
+	return Ray(origin, direction);
+}
+
+/**
+ * @fn	void IInstance::toWorldHit(float tScale, HitRecord &hit) const
+ * @brief	Transforms a hit found in object coordinates back to the world.
+ * @param 		  	tScale	The ratio of object to world t values, from toObjectRay.
+ * @param [in,out]	hit   	The hit; unchanged if it is a miss.
+ */
+
+void IInstance::toWorldHit(float tScale, HitRecord &hit) const {
+	if (hit.t == FLT_MAX) {
+		return;
+	}
+	hit.t /= tScale;
+	hit.interceptPoint = glm::vec3(toWorld * glm::vec4(hit.interceptPoint, 1.0f));
+	// Normals transform by the inverse transpose.
+	hit.surfaceNormal = glm::normalize(glm::transpose(glm::mat3(toObject)) * hit.surfaceNormal);
+}
+
+/**
+ * @fn	void IInstance::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Searches for the closest intersection of the shared shape with the
+ * 			ray, in object coordinates.
+ * @param 		  	ray	The ray, in world coordinates.
+ * @param [in,out]	hit	The hit, in world coordinates.
+ */
+
+void IInstance::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
+	float tScale;
+	shape->findClosestIntersection(toObjectRay(ray, tScale), hit);
+	toWorldHit(tScale, hit);
+}
+
+/**
+ * @fn	float IInstance::findClosestT(const Ray &ray, int &primitive) const
+ * @brief	Finds only the t of the closest intersection, by way of the shared
+ * 			shape's findClosestT.
+ * @param 		  	ray		 	The ray, in world coordinates.
+ * @param [in,out]	primitive	Set to the part of the shared shape that was hit.
+ * @return	The closest t, in world units, or FLT_MAX.
+ */
+
+float IInstance::findClosestT(const Ray &ray, int &primitive) const {
+	float tScale;
+	float t = shape->findClosestT(toObjectRay(ray, tScale), primitive);
+	return t == FLT_MAX ? FLT_MAX : t / tScale;
+}
+
+/**
+ * @fn	void IInstance::completeHit(const Ray &ray, int primitive, HitRecord &hit) const
+ * @brief	Completes a hit found by findClosestT.
+ * @param 		  	ray		 	The ray, in world coordinates.
+ * @param 		  	primitive	The part hit, as reported by findClosestT.
+ * @param [in,out]	hit		 	The hit; t must be FLT_MAX on entry.
+ */
+
+void IInstance::completeHit(const Ray &ray, int primitive, HitRecord &hit) const {
+	float tScale;
+	shape->completeHit(toObjectRay(ray, tScale), primitive, hit);
+	toWorldHit(tScale, hit);
+}
+
+/**
+ * @fn	bool IInstance::occludes(const Ray &ray, float tMax) const
+ * @brief	Determines if the instance blocks the ray somewhere in (0, tMax).
+ * @param	ray 	The ray, in world coordinates.
+ * @param	tMax	The farthest t of interest, in world units.
+ * @return	True iff the shared shape blocks the transformed ray.
+ */
+
+bool IInstance::occludes(const Ray &ray, float tMax) const {
+	float tScale;
+	Ray objectRay = toObjectRay(ray, tScale);
+	// Scaling FLT_MAX up would overflow to infinity, which a miss is less than.
+	return shape->occludes(objectRay, std::min(tMax * tScale, FLT_MAX));
+}
+
+/**
+ * @fn	void IInstance::getTexCoords(const glm::vec3 &pt, float &u, float &v) const
+ * @brief	Computes the texture coordinates of a point on the instance, so
+ * 			that the texture moves with it.
+ * @param 		  	pt	The point, in world coordinates.
+ * @param [in,out]	u 	The u, in (u, v).
+ * @param [in,out]	v 	The v, in (u, v).
+ */
 
+void IInstance::getTexCoords(const glm::vec3 &pt, float &u, float &v) const {
+	shape->getTexCoords(glm::vec3(toObject * glm::vec4(pt, 1.0f)), u, v);
+}
+
+/**
+ * @fn	bool IInstance::getBounds(AABB &box) const
+ * @brief	Computes the world space box around the transformed corners of the
+ * 			shared shape's box.
+ * @param [in,out]	box	The bounding box, if there is one.
+ * @return	True iff the shared shape is bounded.
+ */
+
+bool IInstance::getBounds(AABB &box) const {
+	AABB objectBox;
+	if (!shape->getBounds(objectBox)) {
+		return false;
+	}
+	box = AABB();
+	for (int i = 0; i < 8; i++) {
+		glm::vec3 corner((i & 1) ? objectBox.upper.x : objectBox.lower.x,
+						(i & 2) ? objectBox.upper.y : objectBox.lower.y,
+						(i & 4) ? objectBox.upper.z : objectBox.lower.z);
+		box.expand(glm::vec3(toWorld * glm::vec4(corner, 1.0f)));
+	}
+	return true;
 }
@@ -1,11 +1,17 @@
 #pragma once
 #include <vector>
 #include "HitRecord.h"
+#include "RayPacket.h"
+#include "QuadricKernel.h"
 
 struct IShape;
 typedef IShape *IShapePtr;
 struct VisibleIShape;
 typedef VisibleIShape *VisibleIShapePtr;
+struct ClosestHit;
+struct PacketHits;
+struct RayBatch;
+struct HitBatch;
 
 /**
  * @struct	Ray
@@ -31,7 +37,15 @@ struct Ray {
 struct IShape {
 	IShape();
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const = 0;
+	virtual float findClosestT(const Ray &ray, int &primitive) const;
+	virtual void completeHit(const Ray &ray, int primitive, HitRecord &hit) const;
+	virtual bool occludes(const Ray &ray, float tMax) const;
+	virtual void findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int primitives[MAX_PACKET_SIZE]) const;
+	virtual void intersect(const RayBatch &rays, const VisibleIShape *object, HitBatch &hits) const;
+	virtual void occlude(RayBatch &rays) const;
 	virtual void getTexCoords(const glm::vec3 &pt, float &u, float &v) const;
+	virtual bool getBounds(AABB &box) const;
+	bool isBounded() const;
 	static glm::vec3 movePointOffSurface(const glm::vec3 &pt, const glm::vec3 &n);
 };
 
@@ -48,11 +62,60 @@ struct VisibleIShape {
 	float ru;			//!< right u value
 	float lv;			//!< left v value
 	float rv;			//!< right v value
+	AABB bounds;		//!< World space bounds of the shape, padded by EPSILON.
+	bool bounded;		//!< False if the shape cannot be bounded (e.g., a plane).
 	VisibleIShape(IShapePtr shapePtr, const Material &mat);
+	void updateBounds();
+	bool mightIntersect(const Ray &ray, float tMax) const;
+	bool mightIntersect(const RayBatch &rays, const std::vector<float> &tMax) const;
 	void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	bool updateClosestHit(const Ray &ray, ClosestHit &closest) const;
+	void completeHit(const Ray &ray, int primitive, HitRecord &hit) const;
+	bool occludes(const Ray &ray, float tMax) const;
+	void updateClosestHits(const RayPacket &packet, PacketHits &closest) const;
+	void intersect(const RayBatch &rays, HitBatch &hits) const;
+	void occlude(RayBatch &rays) const;
 	void setTexture(Image *tex, float leftU, float rightU, float bottomV, float topV);
 	void setTexture(Image *tex);
 	static HitRecord findIntersection(const Ray &ray, const std::vector<VisibleIShapePtr> &surfaces);
+	static bool occluded(const Ray &ray, float tMax, const std::vector<VisibleIShapePtr> &surfaces);
+	static void findAllIntersections(const Ray &ray, float tMax, const std::vector<VisibleIShapePtr> &surfaces,
+										std::vector<HitRecord> &hits);
+	static void findIntersections(const RayPacket &packet, const std::vector<VisibleIShapePtr> &surfaces,
+										HitRecord hits[MAX_PACKET_SIZE]);
+	static void intersect(const RayBatch &rays, const std::vector<VisibleIShapePtr> &surfaces, HitBatch &hits);
+	static void occlude(RayBatch &rays, const std::vector<VisibleIShapePtr> &surfaces);
+};
+
+/**
+ * @struct	ClosestHit
+ * @brief	The closest hit found so far while searching the objects for a ray.
+ * 			Only t, the object and the part of it that was hit are tracked;
+ * 			complete computes the intercept, normal, material and texture
+ * 			coordinates once, for the winner.
+ */
+
+struct ClosestHit {
+	float t;						//!< Closest t so far, FLT_MAX if none.
+	const VisibleIShape *object;	//!< Object hit, or nullptr.
+	int primitive;					//!< Part of the object that was hit (see IShape::findClosestT).
+	ClosestHit(float tMax = FLT_MAX) : t(tMax), object(nullptr), primitive(0) {}
+	void complete(const Ray &ray, HitRecord &hit) const;
+};
+
+/**
+ * @struct	PacketHits
+ * @brief	The closest hit found so far for each ray in a packet. Like
+ * 			ClosestHit, only t, the object and the part hit are tracked while
+ * 			searching; complete fills in full hit records for the winners.
+ */
+
+struct PacketHits {
+	float t[MAX_PACKET_SIZE];						//!< Closest t for each ray, FLT_MAX if none.
+	const VisibleIShape *objects[MAX_PACKET_SIZE];	//!< Object hit by each ray, or nullptr.
+	int primitives[MAX_PACKET_SIZE];				//!< Part of the object hit by each ray.
+	PacketHits();
+	void complete(const RayPacket &packet, HitRecord hits[MAX_PACKET_SIZE]) const;
 };
 
 /**
@@ -67,6 +130,9 @@ struct IPlane : public IShape {
 	IPlane(const std::vector<glm::vec3> &vertices);
 	IPlane(const glm::vec3 &p1, const glm::vec3 &p2, const glm::vec3 &p3);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual float findClosestT(const Ray &ray, int &primitive) const;
+	virtual void findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int primitives[MAX_PACKET_SIZE]) const;
+	virtual bool getBounds(AABB &box) const;
 	bool insidePlane(const glm::vec3 &point) const;
 	void findIntersection(const glm::vec3 &p1, const glm::vec3 &p2, float &t) const;
 };
@@ -80,6 +146,7 @@ struct IPlane : public IShape {
 struct IDisk : public IShape {
 	IDisk(const glm::vec3 &position, const glm::vec3 &n, float rad);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual bool getBounds(AABB &box) const;
 	glm::vec3 center;	//!< center point of disk
 	glm::vec3 n;		//!< normal vector of disk
 	float radius;
@@ -94,6 +161,7 @@ struct IDisk : public IShape {
 struct IRect : public IShape {
 	IRect(const glm::vec3 &position, const glm::vec3 &normal, float W, float H);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual bool getBounds(AABB &box) const;
 	float width;		//!< width of rectangle
 	float height;		//!< height of rectangle
 	glm::vec3 center;	//!< center point of rectangle
@@ -106,15 +174,24 @@ protected:
 
 /**
  * @struct	IBox
- * @brief	Implicit representation of 3D box.
+ * @brief	Implicit representation of an axis-aligned 3D box, intersected with
+ * 			the slab method. Its faces are its primitives, numbered as in Face.
+ * 			An oriented box is an IBox placed by an IInstance.
  */
 
 struct IBox : public IShape {
+	enum Face { RIGHT, LEFT, TOP, BOTTOM, FRONT, BACK };	//!< The faces facing +x, -x, +y, -y, +z and -z.
 	IBox(const glm::vec3 &center, const glm::vec3 &size);
 	IBox(const glm::vec3 &center, float size);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual float findClosestT(const Ray &ray, int &primitive) const;
+	virtual void completeHit(const Ray &ray, int primitive, HitRecord &hit) const;
+	virtual void getTexCoords(const glm::vec3 &pt, float &u, float &v) const;
+	virtual bool getBounds(AABB &box) const;
+	static glm::vec3 faceNormal(int face);
 protected:
-	std::vector<IRect> rects;	//!< 6 rectangles corresponding to sides of box.
+	glm::vec3 lower;	//!< The corner with the smallest coordinates.
+	glm::vec3 upper;	//!< The corner with the largest coordinates.
 };
 
 /**
@@ -134,6 +211,7 @@ struct QuadricParameters {
 	static QuadricParameters sphereQParams(float R);
 	static QuadricParameters ellipsoidQParams(const glm::vec3 &sz);
 	static QuadricParameters coneYQParams(float R);
+	int getTerms() const;
 };
 
 /**
@@ -146,6 +224,9 @@ struct IConvexPolygon : public IPlane {
 	glm::vec3 n;
 	IConvexPolygon(const std::vector<glm::vec3> &vertices);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual float findClosestT(const Ray &ray, int &primitive) const;
+	virtual void findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int primitives[MAX_PACKET_SIZE]) const;
+	virtual bool getBounds(AABB &box) const;
 	bool isInside(const glm::vec3 &point) const;
 };
 
@@ -161,6 +242,7 @@ struct ITriangle : public IShape {
 	IPlane plane;	//!< the plane this triangle lies on.
 	ITriangle(const glm::vec3 &A, const glm::vec3 &B, const glm::vec3 &C);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual bool getBounds(AABB &box) const;
 	bool inside(const glm::vec3 &pt) const;
 };
 
@@ -178,14 +260,20 @@ struct IQuadricSurface : public IShape {
 					const glm::vec3 & position);
 	IQuadricSurface(const glm::vec3 & position = glm::vec3(0, 0, 0));
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual float findClosestT(const Ray &ray, int &primitive) const;
+	virtual bool occludes(const Ray &ray, float tMax) const;
+	virtual void findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int primitives[MAX_PACKET_SIZE]) const;
 	int findIntersections(const Ray &ray, HitRecord hits[2]) const;
+	int findRoots(const Ray &ray, float roots[2]) const;
 	glm::vec3 normal(const glm::vec3 &pt) const;
-	virtual void computeAqBqCq(const Ray &ray, float &Aq, float &Bq, float &Cq) const;
+	void computeAqBqCq(const Ray &ray, float &Aq, float &Bq, float &Cq) const;
+	const QuadricParameters &getParameters() const { return qParams; }
 protected:
-	QuadricParameters qParams;		//!< The parameters that make up the quadric
-	float twoA;						//!< 2*A
-	float twoB;						//!< 2*B
-	float twoC;						//!< 2*C
+	QuadricParameters qParams;					//!< The parameters that make up the quadric
+	QuadricCoefficients<float> coefficients;	//!< qParams, with 2*A, 2*B and 2*C, as the kernels take them
+	const QuadricKernel *kernel;				//!< The smallest kernel whose terms include every nonzero coefficient
+	void intersectUnclipped(const RayBatch &rays, const VisibleIShape *object, HitBatch &hits) const;
+	void occludeUnclipped(RayBatch &rays) const;
 };
 
 /**
@@ -196,7 +284,9 @@ protected:
 struct ISphere : IQuadricSurface {
 	ISphere(const glm::vec3 &position, float radius);
 	virtual void getTexCoords(const glm::vec3 &pt, float &u, float &v) const;
-	virtual void computeAqBqCq(const Ray &ray, float &Aq, float &Bq, float &Cq) const;
+	virtual void intersect(const RayBatch &rays, const VisibleIShape *object, HitBatch &hits) const;
+	virtual void occlude(RayBatch &rays) const;
+	virtual bool getBounds(AABB &box) const;
 };
 
 /**
@@ -208,7 +298,9 @@ struct ICylinder : public IQuadricSurface {
 	float radius, length;
 	ICylinder(const glm::vec3 &position, float R, float len, const QuadricParameters &qParams);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const = 0;
-	virtual void computeAqBqCq(const Ray &ray, float &Aq, float &Bq, float &Cq) const;
+	virtual float findClosestT(const Ray &ray, int &primitive) const = 0;
+	virtual bool occludes(const Ray &ray, float tMax) const;
+	virtual void findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int primitives[MAX_PACKET_SIZE]) const;
 };
 
 /**
@@ -219,18 +311,25 @@ struct ICylinder : public IQuadricSurface {
 struct ICylinderY : public ICylinder {
 	ICylinderY(const glm::vec3 &position, float R, float len);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual float findClosestT(const Ray &ray, int &primitive) const;
+	virtual bool getBounds(AABB &box) const;
 	void getTexCoords(const glm::vec3 &pt, float &u, float &v) const;
 };
 
 struct IClosedCylinderY : public ICylinderY {
 	IClosedCylinderY(const glm::vec3 &position, float R, float len);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual float findClosestT(const Ray &ray, int &primitive) const;
+	virtual void completeHit(const Ray &ray, int primitive, HitRecord &hit) const;
 	IDisk top, bottom;
+	enum { SIDE, TOP, BOTTOM };		//!< The parts reported by findClosestT.
 };
 
 struct ICylinderX : public ICylinder {
 	ICylinderX(const glm::vec3 &position, float R, float len);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual float findClosestT(const Ray &ray, int &primitive) const;
+	virtual bool getBounds(AABB &box) const;
 };
 
 /**
@@ -240,17 +339,48 @@ struct ICylinderX : public ICylinder {
 
 struct IEllipsoid : public IQuadricSurface {
 	IEllipsoid(const glm::vec3 &position, const glm::vec3 &sz);
-	virtual void computeAqBqCq(const Ray &ray, float &Aq, float &Bq, float &Cq) const;
+	virtual void intersect(const RayBatch &rays, const VisibleIShape *object, HitBatch &hits) const;
+	virtual void occlude(RayBatch &rays) const;
+	virtual bool getBounds(AABB &box) const;
 };
 
 struct ICone : public IQuadricSurface {
 	float radius, height;
 	ICone(const glm::vec3 &position, float R, float H, const QuadricParameters &qParams);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const = 0;
-	virtual void computeAqBqCq(const Ray &ray, float &Aq, float &Bq, float &Cq) const;
+	virtual float findClosestT(const Ray &ray, int &primitive) const = 0;
+	virtual bool occludes(const Ray &ray, float tMax) const;
+	virtual void findClosestIntersections(const RayPacket &packet, float t[MAX_PACKET_SIZE], int primitives[MAX_PACKET_SIZE]) const;
 };
 
 struct IConeY : public ICone {
 	IConeY(const glm::vec3 &position, float R, float len);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
-};
\ No newline at end of file
+	virtual float findClosestT(const Ray &ray, int &primitive) const;
+	virtual bool getBounds(AABB &box) const;
+};
+/**
+ * @struct	IInstance
+ * @brief	A shared shape placed in the world by an affine transformation.
+ * 			The shape is defined once, in its own object coordinates, and any
+ * 			number of instances may refer to it; rays are moved into object
+ * 			coordinates instead of the shape being copied. This also allows
+ * 			shapes that are axis aligned by construction (e.g., IBox) to be
+ * 			rotated. The instance does not own the shape.
+ */
+
+struct IInstance : public IShape {
+	IShapePtr shape;			//!< The shared shape, in object coordinates.
+	glm::mat4 toWorld;			//!< Object to world transformation.
+	glm::mat4 toObject;			//!< World to object transformation.
+	IInstance(IShapePtr shapePtr, const glm::mat4 &transform);
+	void setTransform(const glm::mat4 &transform);
+	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual float findClosestT(const Ray &ray, int &primitive) const;
+	virtual void completeHit(const Ray &ray, int primitive, HitRecord &hit) const;
+	virtual bool occludes(const Ray &ray, float tMax) const;
+	virtual void getTexCoords(const glm::vec3 &pt, float &u, float &v) const;
+	virtual bool getBounds(AABB &box) const;
+	Ray toObjectRay(const Ray &ray, float &tScale) const;
+	void toWorldHit(float tScale, HitRecord &hit) const;
+};
@@ -0,0 +1,266 @@
+#include <algorithm>
+#include "ITriangleMesh.h"
+
+/**
+ * @struct	WatertightRay
+ * @brief	A ray set up for the watertight ray/triangle test of Woop, Benthin
+ * 			and Wald (2013). The axes are permuted so that the ray travels
+ * 			mostly along z, and a shear then maps its direction onto +z, so
+ * 			each triangle can be tested in 2D with no division.
+ */
+
+struct WatertightRay {
+	glm::vec3 origin;	//!< The ray's origin.
+	int kx, ky, kz;		//!< The permuted axes; kz is the ray's dominant axis.
+	float sx, sy, sz;	//!< The shear.
+	WatertightRay(const Ray &ray);
+};
+
+/**
+ * @fn	WatertightRay::WatertightRay(const Ray &ray)
+ * @brief	Computes the permutation and shear for a ray.
+ * @param	ray	The ray.
+ */
+
+WatertightRay::WatertightRay(const Ray &ray)
+	: origin(ray.origin) {
+	const glm::vec3 absDirection = glm::abs(ray.direction);
+	kz = absDirection.x > absDirection.y ? (absDirection.x > absDirection.z ? 0 : 2)
+										: (absDirection.y > absDirection.z ? 1 : 2);
+	kx = (kz + 1) % 3;
+	ky = (kx + 1) % 3;
+	if (ray.direction[kz] < 0.0f) {
+		std::swap(kx, ky);	// Keeps the winding, and so the sign of the weights
+	}
+	sx = ray.direction[kx] / ray.direction[kz];
+	sy = ray.direction[ky] / ray.direction[kz];
+	sz = 1.0f / ray.direction[kz];
+}
+
+/**
+ * @fn	static float intersectTriangle(const WatertightRay &ray, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c, float tMax, glm::vec3 &weights)
+ * @brief	Watertight ray/triangle test. The edge functions are evaluated
+ * 			exactly the same way for the two triangles sharing an edge, and
+ * 			recomputed in double precision when one is 0, so a ray can never
+ * 			slip through the seam between neighboring triangles.
+ * @param 		  	ray	   	The ray.
+ * @param 		  	a	   	First vertex.
+ * @param 		  	b	   	Second vertex.
+ * @param 		  	c	   	Third vertex.
+ * @param 		  	tMax   	The farthest t of interest.
+ * @param [in,out]	weights	Set to the barycentric weights of a, b and c at the hit.
+ * @return	The t of the hit, in (0, tMax], or FLT_MAX if there is none.
+ */
+
+static float intersectTriangle(const WatertightRay &ray, const glm::vec3 &a, const glm::vec3 &b,
+								const glm::vec3 &c, float tMax, glm::vec3 &weights) {
+	const glm::vec3 A = a - ray.origin;
+	const glm::vec3 B = b - ray.origin;
+	const glm::vec3 C = c - ray.origin;
+	const float ax = A[ray.kx] - ray.sx * A[ray.kz];
+	const float ay = A[ray.ky] - ray.sy * A[ray.kz];
+	const float bx = B[ray.kx] - ray.sx * B[ray.kz];
+	const float by = B[ray.ky] - ray.sy * B[ray.kz];
+	const float cx = C[ray.kx] - ray.sx * C[ray.kz];
+	const float cy = C[ray.ky] - ray.sy * C[ray.kz];
+
+	float u = cx * by - cy * bx;
+	float v = ax * cy - ay * cx;
+	float w = bx * ay - by * ax;
+	if (u == 0.0f || v == 0.0f || w == 0.0f) {
+		u = (float)((double)cx * by - (double)cy * bx);
+		v = (float)((double)ax * cy - (double)ay * cx);
+		w = (float)((double)bx * ay - (double)by * ax);
+	}
+	if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f)) {
+		return FLT_MAX;
+	}
+	const float det = u + v + w;
+	if (det == 0.0f) {
+		return FLT_MAX;
+	}
+
+	// t * det, compared without dividing
+	const float T = ray.sz * (u * A[ray.kz] + v * B[ray.kz] + w * C[ray.kz]);
+	if (det > 0.0f ? (T <= 0.0f || T > tMax * det) : (T >= 0.0f || T < tMax * det)) {
+		return FLT_MAX;
+	}
+	const float invDet = 1.0f / det;
+	weights = glm::vec3(u, v, w) * invDet;
+	return T * invDet;
+}
+
+/**
+ * @fn	ITriangleMesh::ITriangleMesh(const std::vector<glm::vec3> &vertexPositions, const std::vector<int> &triangleIndices, const std::vector<glm::vec3> &vertexNormals, WorkStealingPool *pool)
+ * @brief	Constructs a mesh and builds its BVH.
+ * @param	vertexPositions	The vertices.
+ * @param	triangleIndices	Three vertex numbers per triangle, counterclockwise
+ * 							seen from the front.
+ * @param	vertexNormals  	The normal at each vertex. If empty, they are
+ * 							computed (see computeVertexNormals).
+ * @param	pool		   	Threads to build the BVH with, or nullptr.
+ */
+
+ITriangleMesh::ITriangleMesh(const std::vector<glm::vec3> &vertexPositions, const std::vector<int> &triangleIndices,
+							const std::vector<glm::vec3> &vertexNormals, WorkStealingPool *pool)
+	: IShape(), vertices(vertexPositions), normals(vertexNormals), indices(triangleIndices) {
+	if (normals.size() != vertices.size()) {
+		computeVertexNormals();
+	}
+	buildBVH(pool);
+}
+
+/**
+ * @fn	ITriangleMesh::ITriangleMesh(const MeshData &mesh, WorkStealingPool *pool)
+ * @brief	Constructs a mesh from one loaded by MeshImporter, and builds its BVH.
+ * @param	mesh	The mesh.
+ * @param	pool	Threads to build the BVH with, or nullptr.
+ */
+
+ITriangleMesh::ITriangleMesh(const MeshData &mesh, WorkStealingPool *pool)
+	: ITriangleMesh(mesh.positions, mesh.indices, mesh.normals, pool) {
+}
+
+/**
+ * @fn	void ITriangleMesh::computeVertexNormals()
+ * @brief	Sets the normal at each vertex to the average of the normals of the
+ * 			triangles around it, weighted by their areas.
+ */
+
+void ITriangleMesh::computeVertexNormals() {
+	normals.assign(vertices.size(), glm::vec3(0.0f));
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		const glm::vec3 &a = vertices[indices[i]];
+		const glm::vec3 &b = vertices[indices[i + 1]];
+		const glm::vec3 &c = vertices[indices[i + 2]];
+		// The cross product's length is twice the triangle's area.
+		const glm::vec3 n = glm::cross(b - a, c - a);
+		normals[indices[i]] += n;
+		normals[indices[i + 1]] += n;
+		normals[indices[i + 2]] += n;
+	}
+	for (glm::vec3 &n : normals) {
+		float length = glm::length(n);
+		n = length > 0.0f ? n / length : Y_AXIS;
+	}
+}
+
+/**
+ * @fn	void ITriangleMesh::buildBVH(WorkStealingPool *pool)
+ * @brief	Builds the BVH over the triangles. Must be called again if the
+ * 			vertices or indices change.
+ * @param	pool	Threads to build with, or nullptr (see BVH::build).
+ */
+
+void ITriangleMesh::buildBVH(WorkStealingPool *pool) {
+	const int numTriangles = getNumTriangles();
+	std::vector<AABB> triangleBounds(numTriangles);
+	bounds = AABB();
+	for (int i = 0; i < numTriangles; i++) {
+		AABB &box = triangleBounds[i];
+		box.expand(vertices[indices[3 * i]]);
+		box.expand(vertices[indices[3 * i + 1]]);
+		box.expand(vertices[indices[3 * i + 2]]);
+		bounds.expand(box);
+	}
+	BVH binary;
+	binary.build(triangleBounds, pool);
+	bvh.build(binary);
+}
+
+/**
+ * @fn	void ITriangleMesh::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Searches for the nearest intersection with any of the triangles.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	Hit record.
+ */
+
+void ITriangleMesh::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
+	int primitive;
+	hit.t = FLT_MAX;
+	if (findClosestT(ray, primitive) < FLT_MAX) {
+		completeHit(ray, primitive, hit);
+	}
+}
+
+/**
+ * @fn	float ITriangleMesh::findClosestT(const Ray &ray, int &primitive) const
+ * @brief	Finds the t of the closest triangle hit, traversing the mesh's BVH.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Set to the triangle hit, if any.
+ * @return	The closest t, or FLT_MAX if the ray misses.
+ */
+
+float ITriangleMesh::findClosestT(const Ray &ray, int &primitive) const {
+	const WatertightRay wray(ray);
+	float closest = FLT_MAX;
+	bvh.traverse(ray, closest, [&](int triangle, float &tLimit) {
+		glm::vec3 weights;
+		const int *corners = &indices[3 * triangle];
+		float t = intersectTriangle(wray, vertices[corners[0]], vertices[corners[1]], vertices[corners[2]],
+									tLimit, weights);
+		if (t < tLimit) {
+			tLimit = t;
+			primitive = triangle;
+		}
+		return false;
+	});
+	return closest;
+}
+
+/**
+ * @fn	void ITriangleMesh::completeHit(const Ray &ray, int primitive, HitRecord &hit) const
+ * @brief	Computes the intercept and interpolated normal for a ray known to
+ * 			hit a triangle.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	primitive	The triangle hit, as reported by findClosestT.
+ * @param [in,out]	hit		 	The hit; t must be FLT_MAX on entry.
+ */
+
+void ITriangleMesh::completeHit(const Ray &ray, int primitive, HitRecord &hit) const {
+	const int *corners = &indices[3 * primitive];
+	glm::vec3 weights;
+	float t = intersectTriangle(WatertightRay(ray), vertices[corners[0]], vertices[corners[1]],
+								vertices[corners[2]], FLT_MAX, weights);
+	if (t == FLT_MAX) {
+		return;
+	}
+	hit.t = t;
+	hit.interceptPoint = ray.getPoint(t);
+	hit.surfaceNormal = glm::normalize(weights.x * normals[corners[0]] + weights.y * normals[corners[1]] +
+										weights.z * normals[corners[2]]);
+}
+
+/**
+ * @fn	bool ITriangleMesh::occludes(const Ray &ray, float tMax) const
+ * @brief	Determines if any triangle blocks the ray in (0, tMax), stopping at
+ * 			the first one found.
+ * @param	ray 	The ray.
+ * @param	tMax	The farthest t of interest (e.g., the distance to a light).
+ * @return	True iff some triangle blocks the ray.
+ */
+
+bool ITriangleMesh::occludes(const Ray &ray, float tMax) const {
+	const WatertightRay wray(ray);
+	bool blocked = false;
+	bvh.traverse(ray, tMax, [&](int triangle, float &tLimit) {
+		glm::vec3 weights;
+		const int *corners = &indices[3 * triangle];
+		blocked = intersectTriangle(wray, vertices[corners[0]], vertices[corners[1]], vertices[corners[2]],
+									tLimit, weights) < tLimit;
+		return blocked;
+	});
+	return blocked;
+}
+
+/**
+ * @fn	bool ITriangleMesh::getBounds(AABB &box) const
+ * @brief	Computes the box that bounds the mesh.
+ * @param [in,out]	box	The bounding box.
+ * @return	True
+ */
+
+bool ITriangleMesh::getBounds(AABB &box) const {
+	box = bounds;
+	return true;
+}
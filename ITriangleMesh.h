@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+#include "Defs.h"
+#include "IShape.h"
+#include "BVH.h"
+#include "MeshData.h"
+
+/**
+ * @struct	ITriangleMesh
+ * @brief	A mesh of triangles sharing one vertex buffer, with a normal at each
+ * 			vertex that is interpolated across the triangles. The mesh keeps its
+ * 			own 4-wide BVH over its triangles, so it goes into a scene as a
+ * 			single VisibleIShape, and may be placed any number of times with
+ * 			IInstance. The primitive reported by findClosestT is the triangle.
+ */
+
+struct ITriangleMesh : public IShape {
+	std::vector<glm::vec3> vertices;	//!< Vertex positions, shared by the triangles that meet there.
+	std::vector<glm::vec3> normals;		//!< Unit normal at each vertex.
+	std::vector<int> indices;			//!< Three vertex numbers per triangle, counterclockwise seen from the front.
+	QBVH bvh;							//!< Hierarchy over the triangles.
+	AABB bounds;						//!< Bounds of all the triangles.
+	ITriangleMesh(const std::vector<glm::vec3> &vertexPositions, const std::vector<int> &triangleIndices,
+					const std::vector<glm::vec3> &vertexNormals = std::vector<glm::vec3>(),
+					WorkStealingPool *pool = nullptr);
+	ITriangleMesh(const MeshData &mesh, WorkStealingPool *pool = nullptr);
+	int getNumTriangles() const { return (int)indices.size() / 3; }
+	void computeVertexNormals();
+	void buildBVH(WorkStealingPool *pool = nullptr);
+	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual float findClosestT(const Ray &ray, int &primitive) const;
+	virtual void completeHit(const Ray &ray, int primitive, HitRecord &hit) const;
+	virtual bool occludes(const Ray &ray, float tMax) const;
+	virtual bool getBounds(AABB &box) const;
+};
+
+typedef ITriangleMesh *ITriangleMeshPtr;
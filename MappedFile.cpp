@@ -0,0 +1,109 @@
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @fn	MappedFile::MappedFile()
+ * @brief	Constructs an object with nothing mapped.
+ */
+
+MappedFile::MappedFile()
+	: data(nullptr), size(0)
+#if defined(_WIN32)
+	, file(INVALID_HANDLE_VALUE), mapping(nullptr)
+#endif
+{
+}
+
+/**
+ * @fn	MappedFile::~MappedFile()
+ * @brief	Unmaps the file.
+ */
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+/**
+ * @fn	bool MappedFile::open(const std::string &fileName)
+ * @brief	Maps a whole file, read-only, unmapping any file mapped before.
+ * @param	fileName	Name of the file.
+ * @return	True iff the file exists, is not empty and could be mapped.
+ */
+
+bool MappedFile::open(const std::string &fileName) {
+	close();
+#if defined(_WIN32)
+	file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+						OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER fileSize;
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		close();
+		return false;
+	}
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		close();
+		return false;
+	}
+	data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	size = (size_t)fileSize.QuadPart;
+#else
+	int fd = ::open(fileName.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat status;
+	if (fstat(fd, &status) != 0 || status.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	void *address = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);	// The mapping keeps the file open
+	if (address != MAP_FAILED) {
+		data = (const char *)address;
+		size = (size_t)status.st_size;
+	}
+#endif
+	if (data == nullptr) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @fn	void MappedFile::close()
+ * @brief	Unmaps the file, if one is mapped. Pointers into it become invalid.
+ */
+
+void MappedFile::close() {
+#if defined(_WIN32)
+	if (data != nullptr) {
+		UnmapViewOfFile(data);
+	}
+	if (mapping != nullptr) {
+		CloseHandle(mapping);
+	}
+	if (file != INVALID_HANDLE_VALUE) {
+		CloseHandle(file);
+	}
+	mapping = nullptr;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (data != nullptr) {
+		munmap((void *)data, size);
+	}
+#endif
+	data = nullptr;
+	size = 0;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+/**
+ * @struct	MappedFile
+ * @brief	A whole file mapped read-only into memory. Processes that map the
+ * 			same file share its pages in the operating system's page cache,
+ * 			and nothing is read from disk until it is touched.
+ */
+
+struct MappedFile {
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator = (const MappedFile &) = delete;
+	bool open(const std::string &fileName);
+	void close();
+	bool isOpen() const { return data != nullptr; }
+	const char *getData() const { return data; }
+	size_t getSize() const { return size; }
+protected:
+	const char *data;		//!< Start of the mapping; page aligned. nullptr if nothing is mapped.
+	size_t size;			//!< Size of the file in bytes.
+#if defined(_WIN32)
+	void *file;				//!< Handle of the open file.
+	void *mapping;			//!< Handle of the file mapping object.
+#endif
+};
@@ -0,0 +1,21 @@
+#pragma once
+#include <vector>
+#include "Defs.h"
+
+/**
+ * @struct	MeshData
+ * @brief	An indexed triangle mesh, as loaded from a file: vertices shared by
+ * 			the triangles that meet there, and three vertex numbers per
+ * 			triangle. The ray tracer intersects it as an ITriangleMesh, and the
+ * 			pipeline draws it after EShape::createEMesh.
+ */
+
+struct MeshData {
+	std::vector<glm::vec3> positions;	//!< Vertex positions.
+	std::vector<glm::vec3> normals;		//!< Normal at each vertex, or empty if the file has none.
+	std::vector<int> indices;			//!< Three vertex numbers per triangle, counterclockwise seen from the front.
+	int getNumVertices() const { return (int)positions.size(); }
+	int getNumTriangles() const { return (int)indices.size() / 3; }
+	bool hasNormals() const { return !normals.empty(); }
+	void clear() { positions.clear(); normals.clear(); indices.clear(); }
+};
@@ -0,0 +1,783 @@
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <algorithm>
+#include <sstream>
+#include <unordered_map>
+#include "MeshImporter.h"
+#include "MappedFile.h"
+#include "WorkStealingPool.h"
+
+const int NO_INDEX = INT_MIN;		// An OBJ corner without a normal
+
+/**
+ * @fn	static int countPieces(size_t size, WorkStealingPool *pool)
+ * @brief	Decides how many pieces to split some data into for parsing.
+ * @param	size	Size of the data in bytes.
+ * @param	pool	Threads to parse with, or nullptr to parse serially.
+ * @return	The number of pieces, at least 1.
+ */
+
+static int countPieces(size_t size, WorkStealingPool *pool) {
+	if (pool == nullptr) {
+		return 1;
+	}
+	size_t maxPieces = (size_t)pool->getNumThreads() * IMPORT_TASKS_PER_THREAD;
+	return (int)std::max((size_t)1, std::min(maxPieces, size / IMPORT_MIN_CHUNK_BYTES));
+}
+
+/**
+ * @fn	template <class Task> static void runPieces(int numPieces, WorkStealingPool *pool, Task task)
+ * @brief	Runs task(i) for each piece, on the pool if there is more than one.
+ * @tparam	Task	Callable as void(int piece).
+ * @param	numPieces	Number of pieces.
+ * @param	pool	 	Threads to run on, or nullptr.
+ * @param	task	 	Processes one piece.
+ */
+
+template <class Task>
+static void runPieces(int numPieces, WorkStealingPool *pool, Task task) {
+	if (pool != nullptr && numPieces > 1) {
+		pool->parallelFor(numPieces, task);
+	} else {
+		for (int i = 0; i < numPieces; i++) {
+			task(i);
+		}
+	}
+}
+
+/**
+ * @fn	static const char *skipSpaces(const char *p, const char *end)
+ * @brief	Skips spaces and tabs, but not line ends.
+ * @param	p  	Where to start.
+ * @param	end	End of the text.
+ * @return	The first character that is not a space or tab.
+ */
+
+static const char *skipSpaces(const char *p, const char *end) {
+	while (p < end && (*p == ' ' || *p == '\t')) {
+		p++;
+	}
+	return p;
+}
+
+/**
+ * @fn	static const char *skipLine(const char *p, const char *end)
+ * @brief	Skips past the end of the current line.
+ * @param	p  	Somewhere in the line.
+ * @param	end	End of the text.
+ * @return	The start of the next line, or end.
+ */
+
+static const char *skipLine(const char *p, const char *end) {
+	const char *newline = (const char *)std::memchr(p, '\n', end - p);
+	return newline == nullptr ? end : newline + 1;
+}
+
+/**
+ * @fn	static bool parseInt(const char *&p, const char *end, int &value)
+ * @brief	Reads a decimal integer, with an optional sign.
+ * @param [in,out]	p	 	Where to read; moved past the number.
+ * @param 		  	end  	End of the text.
+ * @param [out]		value	The number.
+ * @return	False if there are no digits.
+ */
+
+static bool parseInt(const char *&p, const char *end, int &value) {
+	bool negative = p < end && *p == '-';
+	if (p < end && (*p == '-' || *p == '+')) {
+		p++;
+	}
+	const char *digits = p;
+	long long result = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		result = std::min(result * 10 + (*p++ - '0'), (long long)INT_MAX);
+	}
+	value = (int)(negative ? -result : result);
+	return p > digits;
+}
+
+/**
+ * @fn	static bool parseFloat(const char *&p, const char *end, float &value)
+ * @brief	Reads a decimal floating point number, such as -1.5e-3. Much faster
+ * 			than strtof, which must handle locales; the result is within an
+ * 			ulp of the correctly rounded value.
+ * @param [in,out]	p	 	Where to read; moved past the number.
+ * @param 		  	end  	End of the text.
+ * @param [out]		value	The number.
+ * @return	False if there are no digits.
+ */
+
+static bool parseFloat(const char *&p, const char *end, float &value) {
+	static const double POWERS_OF_10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+											1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	bool negative = p < end && *p == '-';
+	if (p < end && (*p == '-' || *p == '+')) {
+		p++;
+	}
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	int numDigits = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++, numDigits++) {
+		if (mantissa < 1000000000000000000ULL) {
+			mantissa = mantissa * 10 + (*p - '0');
+		} else {
+			exponent++;
+		}
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++, numDigits++) {
+			if (mantissa < 1000000000000000000ULL) {
+				mantissa = mantissa * 10 + (*p - '0');
+				exponent--;
+			}
+		}
+	}
+	if (numDigits == 0) {
+		return false;
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		int power;
+		if (!parseInt(p, end, power)) {
+			return false;
+		}
+		exponent += std::max(-1000, std::min(power, 1000));
+	}
+	double result = (double)mantissa;
+	if (exponent < 0) {
+		result = -exponent <= 22 ? result / POWERS_OF_10[-exponent] : result * std::pow(10.0, exponent);
+	} else if (exponent > 0) {
+		result = exponent <= 22 ? result * POWERS_OF_10[exponent] : result * std::pow(10.0, exponent);
+	}
+	value = (float)(negative ? -result : result);
+	return true;
+}
+
+/**
+ * @struct	OBJPiece
+ * @brief	What one piece of an OBJ file holds. Corners refer to vertices by
+ * 			their number in the whole file where the file gives one, or, for the
+ * 			negative numbers that count back from the latest vertex, by their
+ * 			number within this piece, until the piece's place is known.
+ */
+
+struct OBJPiece {
+	std::vector<glm::vec3> positions;	//!< "v" lines.
+	std::vector<glm::vec3> normals;		//!< "vn" lines.
+	std::vector<int> positionIndices;	//!< Position of each triangle corner, from 0.
+	std::vector<int> normalIndices;		//!< Normal of each triangle corner, from 0, or NO_INDEX.
+	std::vector<int> relativePositions;	//!< Corners whose position is numbered within the piece.
+	std::vector<int> relativeNormals;	//!< Corners whose normal is numbered within the piece.
+	bool valid;							//!< False if a line could not be parsed.
+	OBJPiece() : valid(true) {}
+	void parse(const char *p, const char *end);
+	bool parseCorner(const char *&p, const char *end, int &position, int &normal,
+					bool &positionIsRelative, bool &normalIsRelative) const;
+};
+
+/**
+ * @fn	void OBJPiece::parse(const char *p, const char *end)
+ * @brief	Parses whole lines of an OBJ file. Only vertices, normals and faces
+ * 			are kept.
+ * @param	p  	Start of the first line.
+ * @param	end	End of the last line.
+ */
+
+void OBJPiece::parse(const char *p, const char *end) {
+	std::vector<int> facePositions, faceNormals;
+	std::vector<unsigned char> faceRelative;	// Bit 0: position, bit 1: normal, counts back
+	while (p < end && valid) {
+		p = skipSpaces(p, end);
+		if (end - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+			glm::vec3 position;
+			for (int i = 0; i < 3 && valid; i++) {
+				p = skipSpaces(p + (i == 0 ? 1 : 0), end);
+				valid = parseFloat(p, end, position[i]);
+			}
+			positions.push_back(position);
+		} else if (end - p >= 3 && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')) {
+			glm::vec3 normal;
+			for (int i = 0; i < 3 && valid; i++) {
+				p = skipSpaces(p + (i == 0 ? 2 : 0), end);
+				valid = parseFloat(p, end, normal[i]);
+			}
+			normals.push_back(normal);
+		} else if (end - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+			facePositions.clear();
+			faceNormals.clear();
+			faceRelative.clear();
+			p = skipSpaces(p + 1, end);
+			while (valid && p < end && *p != '\n' && *p != '\r' && *p != '#') {
+				int position, normal;
+				bool positionIsRelative, normalIsRelative;
+				valid = parseCorner(p, end, position, normal, positionIsRelative, normalIsRelative);
+				facePositions.push_back(position);
+				faceNormals.push_back(normal);
+				faceRelative.push_back((positionIsRelative ? 1 : 0) | (normalIsRelative ? 2 : 0));
+				p = skipSpaces(p, end);
+			}
+			valid = valid && facePositions.size() >= 3;
+			for (size_t i = 2; valid && i < facePositions.size(); i++) {
+				const size_t corners[3] = { 0, i - 1, i };
+				for (size_t corner : corners) {
+					if ((faceRelative[corner] & 1) != 0) {
+						relativePositions.push_back((int)positionIndices.size());
+					}
+					if ((faceRelative[corner] & 2) != 0) {
+						relativeNormals.push_back((int)normalIndices.size());
+					}
+					positionIndices.push_back(facePositions[corner]);
+					normalIndices.push_back(faceNormals[corner]);
+				}
+			}
+		}
+		p = skipLine(p, end);
+	}
+}
+
+/**
+ * @fn	bool OBJPiece::parseCorner(const char *&p, const char *end, int &position, int &normal, bool &positionIsRelative, bool &normalIsRelative) const
+ * @brief	Reads one corner of a face: "v", "v/t", "v//n" or "v/t/n".
+ * @param [in,out]	p				  	Where to read; moved past the corner.
+ * @param 		  	end				  	End of the text.
+ * @param [out]		position		  	The corner's position, numbered from 0.
+ * @param [out]		normal			  	The corner's normal, numbered from 0, or NO_INDEX.
+ * @param [out]		positionIsRelative	True if position is numbered within this piece.
+ * @param [out]		normalIsRelative  	True if normal is numbered within this piece.
+ * @return	False if the corner is malformed.
+ */
+
+bool OBJPiece::parseCorner(const char *&p, const char *end, int &position, int &normal,
+							bool &positionIsRelative, bool &normalIsRelative) const {
+	int number;
+	if (!parseInt(p, end, number) || number == 0) {
+		return false;
+	}
+	positionIsRelative = number < 0;
+	position = number > 0 ? number - 1 : (int)positions.size() + number;
+	normal = NO_INDEX;
+	normalIsRelative = false;
+	if (p < end && *p == '/') {
+		p++;
+		int texCoord;
+		if (p < end && *p != '/' && !parseInt(p, end, texCoord)) {
+			return false;
+		}
+		if (p < end && *p == '/') {
+			p++;
+			if (!parseInt(p, end, number) || number == 0) {
+				return false;
+			}
+			normalIsRelative = number < 0;
+			normal = number > 0 ? number - 1 : (int)normals.size() + number;
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	bool MeshImporter::loadOBJ(const char *data, size_t size, MeshData &mesh, WorkStealingPool *pool)
+ * @brief	Parses a Wavefront OBJ file. The text is split at line ends into
+ * 			pieces parsed in parallel, whose vertices and corners are then
+ * 			numbered for the whole file. Texture coordinates, groups and
+ * 			materials are ignored. Corners that pair a position with a
+ * 			different normal each time become separate vertices.
+ * @param 		  	data	The file's contents.
+ * @param 		  	size	Size of the file in bytes.
+ * @param [in,out]	mesh	The mesh read.
+ * @param 		  	pool	Threads to parse with, or nullptr.
+ * @return	False if the file is malformed or refers to a missing vertex.
+ */
+
+bool MeshImporter::loadOBJ(const char *data, size_t size, MeshData &mesh, WorkStealingPool *pool) {
+	mesh.clear();
+	const char *end = data + size;
+	const int numPieces = countPieces(size, pool);
+	std::vector<const char *> starts(numPieces + 1, end);
+	starts[0] = data;
+	for (int i = 1; i < numPieces; i++) {
+		starts[i] = std::max(starts[i - 1], skipLine(data + size / numPieces * i, end));
+	}
+	std::vector<OBJPiece> pieces(numPieces);
+	runPieces(numPieces, pool, [&](int i) {
+		pieces[i].parse(starts[i], starts[i + 1]);
+	});
+
+	// Where each piece's vertices, normals and corners go in the whole file
+	std::vector<int> positionBases(numPieces + 1, 0), normalBases(numPieces + 1, 0);
+	std::vector<size_t> cornerBases(numPieces + 1, 0);
+	for (int i = 0; i < numPieces; i++) {
+		if (!pieces[i].valid) {
+			return false;
+		}
+		positionBases[i + 1] = positionBases[i] + (int)pieces[i].positions.size();
+		normalBases[i + 1] = normalBases[i] + (int)pieces[i].normals.size();
+		cornerBases[i + 1] = cornerBases[i] + pieces[i].positionIndices.size();
+	}
+	const int numPositions = positionBases[numPieces];
+	const int numNormals = normalBases[numPieces];
+	mesh.positions.resize(numPositions);
+	mesh.indices.resize(cornerBases[numPieces]);
+	std::vector<int> normalIndices(cornerBases[numPieces]);
+	std::vector<glm::vec3> normals(numNormals);
+	std::vector<char> pieceValid(numPieces, 1);
+	std::vector<char> pieceHasNormals(numPieces, 1);
+	std::vector<char> pieceNormalsMatch(numPieces, 1);
+	runPieces(numPieces, pool, [&](int i) {
+		OBJPiece &piece = pieces[i];
+		for (int corner : piece.relativePositions) {
+			piece.positionIndices[corner] += positionBases[i];
+		}
+		for (int corner : piece.relativeNormals) {
+			piece.normalIndices[corner] += normalBases[i];
+		}
+		std::copy(piece.positions.begin(), piece.positions.end(), mesh.positions.begin() + positionBases[i]);
+		std::copy(piece.normals.begin(), piece.normals.end(), normals.begin() + normalBases[i]);
+		std::copy(piece.positionIndices.begin(), piece.positionIndices.end(), mesh.indices.begin() + cornerBases[i]);
+		std::copy(piece.normalIndices.begin(), piece.normalIndices.end(), normalIndices.begin() + cornerBases[i]);
+		for (size_t j = 0; j < piece.positionIndices.size(); j++) {
+			const int position = piece.positionIndices[j];
+			const int normal = piece.normalIndices[j];
+			if (position < 0 || position >= numPositions ||
+				(normal != NO_INDEX && (normal < 0 || normal >= numNormals))) {
+				pieceValid[i] = 0;
+			}
+			pieceHasNormals[i] &= normal != NO_INDEX;
+			pieceNormalsMatch[i] &= normal == position;
+		}
+		piece = OBJPiece();
+	});
+	bool hasNormals = numNormals > 0;
+	bool normalsMatch = numNormals == numPositions;
+	for (int i = 0; i < numPieces; i++) {
+		if (!pieceValid[i]) {
+			return false;
+		}
+		hasNormals = hasNormals && pieceHasNormals[i];
+		normalsMatch = normalsMatch && pieceNormalsMatch[i];
+	}
+	if (!hasNormals) {
+		return true;
+	}
+	if (normalsMatch) {
+		mesh.normals.swap(normals);
+		return true;
+	}
+
+	// Make a vertex for each distinct position and normal pair
+	std::vector<glm::vec3> positions;
+	std::unordered_map<uint64_t, int> vertices;
+	positions.swap(mesh.positions);
+	for (size_t i = 0; i < mesh.indices.size(); i++) {
+		const uint64_t key = ((uint64_t)(uint32_t)mesh.indices[i] << 32) | (uint32_t)normalIndices[i];
+		auto inserted = vertices.insert(std::make_pair(key, (int)mesh.positions.size()));
+		if (inserted.second) {
+			mesh.positions.push_back(positions[mesh.indices[i]]);
+			mesh.normals.push_back(normals[normalIndices[i]]);
+		}
+		mesh.indices[i] = inserted.first->second;
+	}
+	return true;
+}
+
+/**
+ * @enum	PLYType
+ * @brief	The types a PLY property can have.
+ */
+
+enum PLYType { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64, PLY_UNKNOWN };
+
+/**
+ * @struct	PLYProperty
+ * @brief	One property of a PLY element: a single value, or a list of them
+ * 			preceded by their count.
+ */
+
+struct PLYProperty {
+	std::string name;		//!< Its name, e.g., "x" or "vertex_indices".
+	PLYType type;			//!< Type of the value, or of each value in a list.
+	PLYType countType;		//!< Type of a list's count; PLY_UNKNOWN if this is not a list.
+	bool isList() const { return countType != PLY_UNKNOWN; }
+};
+
+/**
+ * @struct	PLYElement
+ * @brief	One element of a PLY file, e.g., "vertex" or "face".
+ */
+
+struct PLYElement {
+	std::string name;						//!< Its name.
+	size_t count;							//!< Number of records.
+	std::vector<PLYProperty> properties;	//!< The properties of each record, in order.
+};
+
+/**
+ * @fn	static PLYType parsePLYType(const std::string &name)
+ * @brief	Looks up a PLY type by any of its names.
+ * @param	name	The name, e.g., "uchar" or "uint8".
+ * @return	The type, or PLY_UNKNOWN.
+ */
+
+static PLYType parsePLYType(const std::string &name) {
+	static const char *NAMES[][2] = { { "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" },
+									{ "ushort", "uint16" }, { "int", "int32" }, { "uint", "uint32" },
+									{ "float", "float32" }, { "double", "float64" } };
+	for (int i = 0; i < PLY_UNKNOWN; i++) {
+		if (name == NAMES[i][0] || name == NAMES[i][1]) {
+			return (PLYType)i;
+		}
+	}
+	return PLY_UNKNOWN;
+}
+
+/**
+ * @fn	static size_t sizeOfPLYType(PLYType type)
+ * @brief	Gets the size of a PLY type.
+ * @param	type	The type.
+ * @return	Its size in bytes.
+ */
+
+static size_t sizeOfPLYType(PLYType type) {
+	static const size_t SIZES[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+	return SIZES[type];
+}
+
+/**
+ * @fn	static double readPLYValue(const char *p, PLYType type, bool swapBytes)
+ * @brief	Reads one binary value.
+ * @param	p		 	Where the value is; need not be aligned.
+ * @param	type	 	Its type.
+ * @param	swapBytes	True if the file's byte order differs from this machine's.
+ * @return	The value.
+ */
+
+static double readPLYValue(const char *p, PLYType type, bool swapBytes) {
+	unsigned char bytes[8];
+	const size_t size = sizeOfPLYType(type);
+	std::memcpy(bytes, p, size);
+	if (swapBytes) {
+		std::reverse(bytes, bytes + size);
+	}
+	switch (type) {
+	case PLY_INT8: { int8_t v; std::memcpy(&v, bytes, 1); return v; }
+	case PLY_UINT8: { uint8_t v; std::memcpy(&v, bytes, 1); return v; }
+	case PLY_INT16: { int16_t v; std::memcpy(&v, bytes, 2); return v; }
+	case PLY_UINT16: { uint16_t v; std::memcpy(&v, bytes, 2); return v; }
+	case PLY_INT32: { int32_t v; std::memcpy(&v, bytes, 4); return v; }
+	case PLY_UINT32: { uint32_t v; std::memcpy(&v, bytes, 4); return v; }
+	case PLY_FLOAT32: { float v; std::memcpy(&v, bytes, 4); return v; }
+	case PLY_FLOAT64: { double v; std::memcpy(&v, bytes, 8); return v; }
+	default: return 0.0;
+	}
+}
+
+/**
+ * @fn	static bool skipPLYProperty(const char *&p, const char *end, const PLYProperty &property, bool swapBytes)
+ * @brief	Steps over one property of a record.
+ * @param [in,out]	p		 	Start of the property; moved past it.
+ * @param 		  	end		 	End of the file.
+ * @param 		  	property 	The property.
+ * @param 		  	swapBytes	True if the file's byte order differs from this machine's.
+ * @return	False if the file ends first.
+ */
+
+static bool skipPLYProperty(const char *&p, const char *end, const PLYProperty &property, bool swapBytes) {
+	size_t count = 1;
+	if (property.isList()) {
+		if ((size_t)(end - p) < sizeOfPLYType(property.countType)) {
+			return false;
+		}
+		count = (size_t)readPLYValue(p, property.countType, swapBytes);
+		p += sizeOfPLYType(property.countType);
+	}
+	if ((size_t)(end - p) / sizeOfPLYType(property.type) < count) {
+		return false;
+	}
+	p += count * sizeOfPLYType(property.type);
+	return true;
+}
+
+/**
+ * @fn	static bool skipPLYRecords(const char *&p, const char *end, const PLYElement &element, bool swapBytes)
+ * @brief	Steps over all the records of an element, one at a time, as must be
+ * 			done when they hold lists.
+ * @param [in,out]	p		 	Start of the first record; moved past the last.
+ * @param 		  	end		 	End of the file.
+ * @param 		  	element  	The element.
+ * @param 		  	swapBytes	True if the file's byte order differs from this machine's.
+ * @return	False if the file ends first.
+ */
+
+static bool skipPLYRecords(const char *&p, const char *end, const PLYElement &element, bool swapBytes) {
+	for (size_t i = 0; i < element.count; i++) {
+		for (const PLYProperty &property : element.properties) {
+			if (!skipPLYProperty(p, end, property, swapBytes)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	static bool readPLYHeader(const char *data, size_t size, std::vector<PLYElement> &elements, bool &swapBytes, size_t &headerSize)
+ * @brief	Reads the text header of a binary PLY file.
+ * @param 		  	data	  	The file's contents.
+ * @param 		  	size	  	Size of the file in bytes.
+ * @param [in,out]	elements  	The elements declared, in order.
+ * @param [out]		swapBytes 	True if the file's byte order differs from this machine's.
+ * @param [out]		headerSize	Where the binary data starts.
+ * @return	False if this is not a binary PLY file, or the header is malformed.
+ */
+
+static bool readPLYHeader(const char *data, size_t size, std::vector<PLYElement> &elements, bool &swapBytes,
+							size_t &headerSize) {
+	const char *end = data + size;
+	const char *p = data;
+	bool formatKnown = false;
+	while (p < end) {
+		const char *lineEnd = skipLine(p, end);
+		std::istringstream line(std::string(p, lineEnd));
+		std::string keyword;
+		line >> keyword;
+		if (p == data && keyword != "ply") {
+			return false;
+		}
+		p = lineEnd;
+		if (keyword == "format") {
+			std::string format;
+			line >> format;
+			const uint16_t one = 1;
+			const bool littleEndian = *(const unsigned char *)&one == 1;
+			if (format == "binary_little_endian") {
+				swapBytes = !littleEndian;
+			} else if (format == "binary_big_endian") {
+				swapBytes = littleEndian;
+			} else {
+				return false;
+			}
+			formatKnown = true;
+		} else if (keyword == "element") {
+			PLYElement element;
+			if (!(line >> element.name >> element.count)) {
+				return false;
+			}
+			elements.push_back(element);
+		} else if (keyword == "property") {
+			PLYProperty property;
+			std::string type;
+			if (elements.empty() || !(line >> type)) {
+				return false;
+			}
+			property.countType = PLY_UNKNOWN;
+			if (type == "list") {
+				std::string countType;
+				line >> countType >> type;
+				property.countType = parsePLYType(countType);
+				if (property.countType == PLY_UNKNOWN || property.countType == PLY_FLOAT32 ||
+					property.countType == PLY_FLOAT64) {
+					return false;
+				}
+			}
+			property.type = parsePLYType(type);
+			if (property.type == PLY_UNKNOWN || !(line >> property.name)) {
+				return false;
+			}
+			elements.back().properties.push_back(property);
+		} else if (keyword == "end_header") {
+			headerSize = p - data;
+			return formatKnown;
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	bool MeshImporter::loadPLY(const char *data, size_t size, MeshData &mesh, WorkStealingPool *pool)
+ * @brief	Parses a binary PLY file, of either byte order. Vertices, which
+ * 			all take the same space, are converted in parallel pieces. Faces
+ * 			are too, on the assumption that they are all triangles, which is
+ * 			checked in parallel first; other faces are read one at a time.
+ * 			Properties other than position, normal and vertex indices, and
+ * 			elements other than vertex and face, are skipped.
+ * @param 		  	data	The file's contents.
+ * @param 		  	size	Size of the file in bytes.
+ * @param [in,out]	mesh	The mesh read.
+ * @param 		  	pool	Threads to parse with, or nullptr.
+ * @return	False if the file is not binary PLY, is truncated or refers to a
+ * 			missing vertex.
+ */
+
+bool MeshImporter::loadPLY(const char *data, size_t size, MeshData &mesh, WorkStealingPool *pool) {
+	mesh.clear();
+	std::vector<PLYElement> elements;
+	bool swapBytes = false;
+	size_t headerSize = 0;
+	if (!readPLYHeader(data, size, elements, swapBytes, headerSize)) {
+		return false;
+	}
+	const char *end = data + size;
+	const char *p = data + headerSize;
+	size_t numVertices = 0;
+	for (const PLYElement &element : elements) {
+		// Offsets of the properties in a record, where they do not follow a list
+		std::vector<size_t> offsets;
+		size_t recordSize = 0;
+		int listProperty = -1;
+		for (size_t i = 0; i < element.properties.size(); i++) {
+			const PLYProperty &property = element.properties[i];
+			offsets.push_back(recordSize);
+			if (property.isList() && listProperty < 0) {
+				listProperty = (int)i;
+				recordSize += sizeOfPLYType(property.countType) + 3 * sizeOfPLYType(property.type);
+			} else {
+				recordSize += sizeOfPLYType(property.type);
+			}
+		}
+		const char *records = p;
+		auto find = [&](const char *name) {
+			for (size_t i = 0; i < element.properties.size(); i++) {
+				if (element.properties[i].name == name && !element.properties[i].isList()) {
+					return (int)i;
+				}
+			}
+			return -1;
+		};
+
+		if (element.name == "vertex") {
+			const int position[3] = { find("x"), find("y"), find("z") };
+			const int normal[3] = { find("nx"), find("ny"), find("nz") };
+			if (listProperty >= 0 || position[0] < 0 || position[1] < 0 || position[2] < 0 ||
+				(size_t)(end - p) / recordSize < element.count) {
+				return false;
+			}
+			const bool hasNormals = normal[0] >= 0 && normal[1] >= 0 && normal[2] >= 0;
+			numVertices = element.count;
+			mesh.positions.resize(numVertices);
+			mesh.normals.resize(hasNormals ? numVertices : 0);
+			const int numPieces = countPieces(numVertices * recordSize, pool);
+			runPieces(numPieces, pool, [&](int piece) {
+				const size_t first = numVertices * piece / numPieces;
+				const size_t last = numVertices * (piece + 1) / numPieces;
+				for (size_t v = first; v < last; v++) {
+					const char *record = records + v * recordSize;
+					for (int i = 0; i < 3; i++) {
+						mesh.positions[v][i] = (float)readPLYValue(record + offsets[position[i]],
+															element.properties[position[i]].type, swapBytes);
+						if (hasNormals) {
+							mesh.normals[v][i] = (float)readPLYValue(record + offsets[normal[i]],
+															element.properties[normal[i]].type, swapBytes);
+						}
+					}
+				}
+			});
+			p += numVertices * recordSize;
+		} else if (element.name == "face" && listProperty >= 0 &&
+					(element.properties[listProperty].name == "vertex_indices" ||
+					element.properties[listProperty].name == "vertex_index")) {
+			const PLYProperty &list = element.properties[listProperty];
+			const size_t countSize = sizeOfPLYType(list.countType);
+			const size_t indexSize = sizeOfPLYType(list.type);
+			bool allTriangles = true;
+			for (size_t i = listProperty + 1; i < element.properties.size(); i++) {
+				allTriangles = allTriangles && !element.properties[i].isList();
+			}
+			allTriangles = allTriangles && (size_t)(end - p) / recordSize >= element.count;
+			const int numPieces = countPieces(allTriangles ? element.count * recordSize : 0, pool);
+			std::vector<char> pieceValid(numPieces, 1);
+			if (allTriangles) {
+				runPieces(numPieces, pool, [&](int piece) {
+					const size_t first = element.count * piece / numPieces;
+					const size_t last = element.count * (piece + 1) / numPieces;
+					for (size_t f = first; f < last && pieceValid[piece]; f++) {
+						pieceValid[piece] = readPLYValue(records + f * recordSize + offsets[listProperty],
+														list.countType, swapBytes) == 3;
+					}
+				});
+				allTriangles = std::find(pieceValid.begin(), pieceValid.end(), 0) == pieceValid.end();
+			}
+			if (allTriangles) {
+				mesh.indices.resize(3 * element.count);
+				runPieces(numPieces, pool, [&](int piece) {
+					const size_t first = element.count * piece / numPieces;
+					const size_t last = element.count * (piece + 1) / numPieces;
+					for (size_t f = first; f < last; f++) {
+						const char *indices = records + f * recordSize + offsets[listProperty] + countSize;
+						for (int i = 0; i < 3; i++) {
+							mesh.indices[3 * f + i] = (int)readPLYValue(indices + i * indexSize, list.type, swapBytes);
+						}
+					}
+				});
+				p += element.count * recordSize;
+			} else {
+				std::vector<int> face;
+				for (size_t f = 0; f < element.count; f++) {
+					for (size_t i = 0; i < element.properties.size(); i++) {
+						const PLYProperty &property = element.properties[i];
+						if ((int)i == listProperty) {
+							if ((size_t)(end - p) < countSize) {
+								return false;
+							}
+							const size_t count = (size_t)readPLYValue(p, property.countType, swapBytes);
+							p += countSize;
+							if ((size_t)(end - p) / indexSize < count) {
+								return false;
+							}
+							face.clear();
+							for (size_t j = 0; j < count; j++, p += indexSize) {
+								face.push_back((int)readPLYValue(p, property.type, swapBytes));
+							}
+							for (size_t j = 2; j < face.size(); j++) {
+								mesh.indices.push_back(face[0]);
+								mesh.indices.push_back(face[j - 1]);
+								mesh.indices.push_back(face[j]);
+							}
+						} else if (!skipPLYProperty(p, end, property, swapBytes)) {
+							return false;
+						}
+					}
+				}
+			}
+		} else if (!skipPLYRecords(p, end, element, swapBytes)) {
+			return false;
+		}
+	}
+
+	const int numPieces = countPieces(mesh.indices.size() * sizeof(int), pool);
+	std::vector<char> pieceValid(numPieces, 1);
+	runPieces(numPieces, pool, [&](int piece) {
+		const size_t first = mesh.indices.size() * piece / numPieces;
+		const size_t last = mesh.indices.size() * (piece + 1) / numPieces;
+		for (size_t i = first; i < last; i++) {
+			if (mesh.indices[i] < 0 || (size_t)mesh.indices[i] >= numVertices) {
+				pieceValid[piece] = 0;
+			}
+		}
+	});
+	return std::find(pieceValid.begin(), pieceValid.end(), 0) == pieceValid.end();
+}
+
+/**
+ * @fn	bool MeshImporter::load(const std::string &fileName, MeshData &mesh, WorkStealingPool *pool)
+ * @brief	Loads a mesh from an OBJ or binary PLY file, telling them apart by
+ * 			their contents.
+ * @param 		  	fileName	Name of the file.
+ * @param [in,out]	mesh		The mesh read.
+ * @param 		  	pool		Threads to parse with, or nullptr.
+ * @return	False if the file cannot be opened or is malformed.
+ */
+
+bool MeshImporter::load(const std::string &fileName, MeshData &mesh, WorkStealingPool *pool) {
+	MappedFile file;
+	if (!file.open(fileName)) {
+		mesh.clear();
+		return false;
+	}
+	const char *data = file.getData();
+	const size_t size = file.getSize();
+	if (size >= 4 && std::memcmp(data, "ply", 3) == 0 && (data[3] == '\n' || data[3] == '\r')) {
+		return loadPLY(data, size, mesh, pool);
+	}
+	return loadOBJ(data, size, mesh, pool);
+}
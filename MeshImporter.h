@@ -0,0 +1,24 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#include "MeshData.h"
+
+const size_t IMPORT_MIN_CHUNK_BYTES = 1 << 20;	//!< Smallest piece of a file parsed as one task.
+const int IMPORT_TASKS_PER_THREAD = 4;			//!< Pieces per thread in a parallel import.
+
+struct WorkStealingPool;
+
+/**
+ * @struct	MeshImporter
+ * @brief	Loads Wavefront OBJ and binary PLY meshes. The file is mapped into
+ * 			memory rather than read, and with a pool, split into pieces that
+ * 			are parsed in parallel and then stitched together, so large files
+ * 			load at close to the speed of the disk. Polygons with more than
+ * 			three corners are split into fans of triangles.
+ */
+
+struct MeshImporter {
+	static bool load(const std::string &fileName, MeshData &mesh, WorkStealingPool *pool = nullptr);
+	static bool loadOBJ(const char *data, size_t size, MeshData &mesh, WorkStealingPool *pool = nullptr);
+	static bool loadPLY(const char *data, size_t size, MeshData &mesh, WorkStealingPool *pool = nullptr);
+};
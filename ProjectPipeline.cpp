@@ -1,4 +1,5 @@
 #include <ctime> 
+#include <chrono>
 #include <iostream> 
 #include <algorithm>
 #include <cmath>
@@ -11,6 +12,7 @@
 #include "Camera.h"
 #include "Utilities.h"
 #include "VertexOps.h"
+#include "RenderOptions.h"
 
 PositionalLightPtr theLight = new PositionalLight(glm::vec3(2, 1, 3), pureWhiteLight);
 std::vector<LightSourcePtr> lights = { theLight };
@@ -137,7 +139,41 @@ static void timer(int id) {
 	glutPostRedisplay();
 }
 
+/**
+ * @fn	int renderHeadless(const RenderOptions &options)
+ * @brief	Renders one frame without a window or GL context, and writes it out.
+ * @param	options	The command line options. Only the file names and size apply.
+ * @return	The exit status.
+ */
+
+int renderHeadless(const RenderOptions &options) {
+	frameBuffer.setHeadless(true);
+	frameBuffer.setFrameBufferSize(options.width, options.height);
+
+	auto frameStartTime = std::chrono::steady_clock::now();
+	render();
+	auto frameEndTime = std::chrono::steady_clock::now();
+	float totalTimeSec = std::chrono::duration<float>(frameEndTime - frameStartTime).count();
+	std::cout << "Render time: " << totalTimeSec << " sec." << std::endl;
+
+	bool written = frameBuffer.writeColorBuffer(options.colorFileName);
+	if (!options.depthFileName.empty()) {
+		written = frameBuffer.writeDepthBuffer(options.depthFileName) && written;
+	}
+	return written ? 0 : 1;
+}
+
 int main(int argc, char *argv[]) {
+	RenderOptions options;
+	if (!options.parse(argc, argv)) {
+		RenderOptions::printUsage(argv[0]);
+		return 1;
+	}
+	frameBuffer.setClearColor(lightGray);
+	if (options.isHeadless()) {
+		return renderHeadless(options);
+	}
+
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_RGB | GLUT_SINGLE);
 	glutInitWindowSize(WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -151,8 +187,6 @@ int main(int argc, char *argv[]) {
 	glutTimerFunc(100, timer, 0);
 	glutMouseFunc(mouseUtility);
 
-	frameBuffer.setClearColor(lightGray);
-
 	glutMainLoop();
 
 	return 0;
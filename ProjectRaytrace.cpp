@@ -1,4 +1,6 @@
 #include <ctime>
+#include <chrono>
+#include <random>
 #include "Defs.h"
 #include "IShape.h"
 #include "FrameBuffer.h"
@@ -8,6 +10,10 @@
 #include "Image.h"
 #include "Camera.h"
 #include "Rasterization.h"
+#include "RenderOptions.h"
+#include "ITriangleMesh.h"
+#include "MeshImporter.h"
+#include "MappedFile.h"
 
 int currLight = 0;
 float angle = 0.5f;
@@ -17,6 +23,7 @@ bool isAnimated = false;
 int numReflections = 0;
 int antiAliasing = 1;
 bool twoViewOn = false;
+bool isProgressive = false;
 
 std::vector<PositionalLightPtr> lights = {
 						new PositionalLight(glm::vec3(10, 10, 10), pureWhiteLight),
@@ -34,15 +41,52 @@ RaytracingCamera *cameras[] = { &pCamera, &oCamera };
 int currCamera = 0;
 IScene scene(cameras[currCamera], false);
 
-void render() {
-	int frameStartTime = glutGet(GLUT_ELAPSED_TIME);
-	cameras[currCamera]->calculateViewingParameters(frameBuffer.getWindowWidth()/2, frameBuffer.getWindowHeight());
+void configureCamera(int width, int height) {
+	cameras[currCamera]->calculateViewingParameters(width, height);
 	cameras[currCamera]->changeConfiguration(glm::vec3(0, 15, 15), glm::vec3(4.0f, 1.0f, 0.0f), Y_AXIS);
+}
+
+void renderFrame() {
+	configureCamera(frameBuffer.getWindowWidth()/2, frameBuffer.getWindowHeight());
 	rayTrace.raytraceScene(frameBuffer, numReflections, scene, antiAliasing);
+}
+
+void render() {
+	if (isProgressive) {
+		configureCamera(frameBuffer.getWindowWidth()/2, frameBuffer.getWindowHeight());
+		bool wasConverged = rayTrace.isConverged();
+		rayTrace.accumulateFrame(frameBuffer, numReflections, scene);
+		if (rayTrace.isConverged() && !wasConverged) {
+			std::cout << "Converged: " << rayTrace.numAccumulated << " samples per pixel" << std::endl;
+		}
+		return;
+	}
+
+	int frameStartTime = glutGet(GLUT_ELAPSED_TIME);
+	renderFrame();
 
 	int frameEndTime = glutGet(GLUT_ELAPSED_TIME); // Get end time
 	float totalTimeSec = (frameEndTime - frameStartTime) / 1000.0f;
 	std::cout << "Render time: " << totalTimeSec << " sec." << std::endl;
+	std::cout << "Primary rays: " << rayTrace.numPrimaryRays << " ("
+		<< (float)rayTrace.numPrimaryRays / (frameBuffer.getWindowWidth() * frameBuffer.getWindowHeight())
+		<< " per pixel)" << std::endl;
+	if (totalTimeSec > 0.0f) {
+		std::cout << "Rays/sec: " << rayTrace.numPrimaryRays / totalTimeSec << " after "
+			<< scene.visibleBVH.bvh.numRefits << " BVH refits" << std::endl;
+	}
+}
+
+/**
+ * @fn	void idle()
+ * @brief	In progressive mode, keeps adding samples while the window is idle,
+ * 			until the image has converged.
+ */
+
+void idle() {
+	if (isProgressive && !rayTrace.isConverged()) {
+		glutPostRedisplay();
+	}
 }
 
 void resize(int width, int height) {
@@ -82,6 +126,72 @@ void buildScene() {
 
 	scene.addObject(lights[0]);
 	scene.addObject(lights[1]);
+	scene.buildBVH();
+}
+
+const int STRESS_TEST_THREADS = 16;	// Threads used by -x when -t does not give a number
+
+/**
+ * @fn	int threadStressTest(const RenderOptions &options)
+ * @brief	Renders the scene serially, then options.numStressPasses more times
+ * 			with many threads and tiny tiles so that the threads constantly
+ * 			interleave on the same shapes. Reports whether every parallel image
+ * 			matches the serial one bit for bit. A serial image of a single color
+ * 			means nothing was hit, and fails the test, since any image would
+ * 			then match.
+ * @param	options	The command line options.
+ * @return	The exit status: 0 iff the serial render has hits and all the parallel
+ * 			renders match it.
+ */
+
+int threadStressTest(const RenderOptions &options) {
+	const int W = options.width;
+	const int H = options.height;
+	const int numThreads = options.numThreads > 0 ? options.numThreads : STRESS_TEST_THREADS;
+	const int passes = options.numStressPasses;
+	scene.visibleBVH.compressed = scene.transparentBVH.compressed = options.compressedBVH;
+	scene.bvhCacheDirectory = options.bvhCacheDirectory;
+	buildScene();
+
+	FrameBuffer serialBuffer(W, H);
+	FrameBuffer parallelBuffer(W, H);
+	serialBuffer.setHeadless(true);
+	parallelBuffer.setHeadless(true);
+	RayTracer serialTracer(rayTrace.defaultColor, 1);
+	RayTracer parallelTracer(rayTrace.defaultColor, numThreads);
+	parallelTracer.tileSize = 2;
+	serialTracer.adaptiveThreshold = parallelTracer.adaptiveThreshold = options.adaptiveThreshold;
+	if (options.packetWidth > 0) {
+		serialTracer.packetWidth = parallelTracer.packetWidth = options.packetWidth;
+	}
+
+	configureCamera(W, H);
+	serialTracer.raytraceScene(serialBuffer, options.numReflections, scene, options.antiAliasing);
+	bool isUniform = true;
+	for (int y = 0; y < H && isUniform; y++) {
+		for (int x = 0; x < W && isUniform; x++) {
+			isUniform = serialBuffer.getColor(x, y) == serialBuffer.getColor(0, 0);
+		}
+	}
+	if (isUniform) {
+		std::cout << "Thread stress test: FAILED, the serial image is a single color" << std::endl;
+		return 1;
+	}
+
+	int mismatches = 0;
+	for (int pass = 0; pass < passes; pass++) {
+		parallelTracer.raytraceScene(parallelBuffer, options.numReflections, scene, options.antiAliasing);
+		for (int y = 0; y < H; y++) {
+			for (int x = 0; x < W; x++) {
+				if (serialBuffer.getColor(x, y) != parallelBuffer.getColor(x, y)) {
+					mismatches++;
+				}
+			}
+		}
+	}
+	std::cout << "Thread stress test (" << numThreads << " threads, " << passes << " passes): "
+		<< (mismatches == 0 ? "PASSED" : "FAILED") << ", " << mismatches << " mismatched pixels" << std::endl;
+	return mismatches == 0 ? 0 : 1;
 }
 
 void incrementClamp(float &v, float delta, float lo, float hi) {
@@ -100,6 +210,8 @@ void timer(int id) {
 		std::cout << x << std::endl;
 		transPlane->a = glm::vec3(0, 0, pos);
 		// modify something in your scene
+
+		scene.refitBVH();
 	}
 	glutTimerFunc(TIME_INTERVAL, timer, 0);
 	glutPostRedisplay();
@@ -187,6 +299,23 @@ void keyboard(unsigned char key, int x, int y) {
 	case '-':	antiAliasing = 1;
 				std::cout << "Anti aliasing: " << antiAliasing << std::endl;
 				break;
+	case 'G':
+	case 'g':	rayTrace.adaptiveThreshold = rayTrace.adaptiveThreshold > 0.0f ? 0.0f : DEFAULT_ADAPTIVE_THRESHOLD;
+				std::cout << "Adaptive anti aliasing: " << (rayTrace.adaptiveThreshold > 0.0f ? "ON" : "OFF") << std::endl;
+				break;
+	case 'S':
+	case 's':	isProgressive = !isProgressive;
+				rayTrace.resetAccumulation();
+				std::cout << "Progressive rendering: " << (isProgressive ? "ON" : "OFF") << std::endl;
+				break;
+	case 'I':
+	case 'i':	rayTrace.packetWidth = rayTrace.packetWidth > 1 ? 1 : RayPacket::preferredWidth();
+				std::cout << "Ray packet width: " << rayTrace.packetWidth << std::endl;
+				break;
+	case 'T':
+	case 't':	rayTrace.setNumThreads(glm::clamp(rayTrace.getNumThreads() + (isupper(key) ? 1 : -1), 1, 64));
+				std::cout << "Threads: " << rayTrace.getNumThreads() << std::endl;
+				break;
 
 	case '0':	
 	case '1':	
@@ -229,7 +358,226 @@ void mouse(int button, int state, int x, int y) {
 	}
 }
 
+/**
+ * @fn	int renderHeadless(const RenderOptions &options)
+ * @brief	Renders one frame without a window or GL context, and writes it out.
+ * @param	options	The command line options.
+ * @return	The exit status.
+ */
+
+int renderHeadless(const RenderOptions &options) {
+	frameBuffer.setHeadless(true);
+	frameBuffer.setFrameBufferSize(options.width, options.height);
+	antiAliasing = options.antiAliasing;
+	numReflections = options.numReflections;
+	rayTrace.setNumThreads(options.numThreads);
+	rayTrace.recordDepth = !options.depthFileName.empty();
+	rayTrace.adaptiveThreshold = options.adaptiveThreshold;
+	if (options.packetWidth > 0) {
+		rayTrace.packetWidth = options.packetWidth;
+	}
+	scene.visibleBVH.compressed = scene.transparentBVH.compressed = options.compressedBVH;
+	scene.bvhCacheDirectory = options.bvhCacheDirectory;
+	auto sceneStartTime = std::chrono::steady_clock::now();
+	buildScene();
+	auto sceneEndTime = std::chrono::steady_clock::now();
+	std::cout << "Scene setup: " << std::chrono::duration<float, std::milli>(sceneEndTime - sceneStartTime).count()
+		<< " ms (BVH " << (scene.visibleBVH.isMapped() ? "mapped from cache" : "built") << ")" << std::endl;
+	scene.visibleBVH.countTraversals = options.countTraversals;
+
+	auto frameStartTime = std::chrono::steady_clock::now();
+	renderFrame();
+	auto frameEndTime = std::chrono::steady_clock::now();
+	float totalTimeSec = std::chrono::duration<float>(frameEndTime - frameStartTime).count();
+	std::cout << "Render time: " << totalTimeSec << " sec. (" << rayTrace.getNumThreads() << " threads)" << std::endl;
+	std::cout << "Primary rays: " << rayTrace.numPrimaryRays << " (" << rayTrace.numPrimaryRays / totalTimeSec
+		<< " per sec.)" << std::endl;
+	if (options.countTraversals) {
+		std::cout << "BVH traversals: " << scene.visibleBVH.getTraversalStats() << std::endl;
+	}
+
+	bool written = frameBuffer.writeColorBuffer(options.colorFileName);
+	if (!options.depthFileName.empty()) {
+		written = frameBuffer.writeDepthBuffer(options.depthFileName) && written;
+	}
+	return written ? 0 : 1;
+}
+
+const int BENCHMARK_RAYS = 100000;	// Random rays traced through each 4-wide BVH by -b
+
+/**
+ * @fn	template <class Node> float traceBenchmarkRays(const WideBVH<Node> &bvh, const std::vector<ITriangle> &triangles, const std::vector<Ray> &rays, std::vector<float> &hitTs)
+ * @brief	Finds where each ray first hits a triangle, through a 4-wide BVH.
+ * @tparam	Node	The BVH's node type.
+ * @param 		  	bvh		 	The hierarchy over the triangles.
+ * @param 		  	triangles	The triangles.
+ * @param 		  	rays	 	The rays.
+ * @param [in,out]	hitTs	 	The t of each ray's closest hit; FLT_MAX for a miss.
+ * @return	Rays traced per second.
+ */
+
+template <class Node>
+float traceBenchmarkRays(const WideBVH<Node> &bvh, const std::vector<ITriangle> &triangles,
+						const std::vector<Ray> &rays, std::vector<float> &hitTs) {
+	auto startTime = std::chrono::steady_clock::now();
+	hitTs.resize(rays.size());
+	for (size_t i = 0; i < rays.size(); i++) {
+		const Ray &ray = rays[i];
+		float tMax = FLT_MAX;
+		bvh.traverse(ray, tMax, [&](int triangle, float &tMax) {
+			int primitive;
+			tMax = std::min(tMax, triangles[triangle].findClosestT(ray, primitive));
+			return false;
+		});
+		hitTs[i] = tMax;
+	}
+	auto endTime = std::chrono::steady_clock::now();
+	return rays.size() / std::chrono::duration<float>(endTime - startTime).count();
+}
+
+/**
+ * @fn	int benchmarkBVHBuild(const RenderOptions &options)
+ * @brief	Builds a BVH over a cloud of small random triangles, as a large mesh
+ * 			would need, first on one thread and then on options.numThreads,
+ * 			and reports the time, memory and SAH cost of each build. The tree
+ * 			is then collapsed to 4-wide nodes, at full precision and
+ * 			compressed, and random rays are traced through both to compare
+ * 			their memory and speed.
+ * @param	options	The command line options.
+ * @return	The exit status; nonzero if the two builds differ or the two
+ * 			4-wide trees give different hits.
+ */
+
+int benchmarkBVHBuild(const RenderOptions &options) {
+	const int N = options.numBenchmarkTriangles;
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+	std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+	std::vector<ITriangle> triangles;
+	triangles.reserve(N);
+	for (int i = 0; i < N; i++) {
+		glm::vec3 center(position(rng), position(rng), position(rng));
+		triangles.push_back(ITriangle(center + glm::vec3(offset(rng), offset(rng), offset(rng)),
+									center + glm::vec3(offset(rng), offset(rng), offset(rng)),
+									center + glm::vec3(offset(rng), offset(rng), offset(rng))));
+	}
+	std::vector<AABB> bounds(N);
+	for (int i = 0; i < N; i++) {
+		triangles[i].getBounds(bounds[i]);
+	}
+
+	BVH serialBVH, parallelBVH;
+	WorkStealingPool pool(options.numThreads);
+	serialBVH.build(bounds);
+	parallelBVH.build(bounds, &pool);
+	std::cout << N << " triangles" << std::endl;
+	std::cout << "1 thread:   " << serialBVH.getStats() << std::endl;
+	std::cout << pool.getNumThreads() << " threads: " << parallelBVH.getStats() << std::endl;
+
+	bool same = serialBVH.primitiveIndices == parallelBVH.primitiveIndices &&
+				serialBVH.nodes.size() == parallelBVH.nodes.size();
+	for (size_t i = 0; same && i < serialBVH.nodes.size(); i++) {
+		const BVHNode &a = serialBVH.nodes[i];
+		const BVHNode &b = parallelBVH.nodes[i];
+		same = a.offset == b.offset && a.count == b.count &&
+				a.box.lower == b.box.lower && a.box.upper == b.box.upper;
+	}
+	std::cout << "Trees are " << (same ? "identical" : "DIFFERENT") << std::endl;
+
+	QBVH qbvh;
+	CompressedQBVH compressedQBVH;
+	auto collapseStartTime = std::chrono::steady_clock::now();
+	qbvh.build(parallelBVH);
+	auto compressStartTime = std::chrono::steady_clock::now();
+	compressedQBVH.build(qbvh);
+	auto compressEndTime = std::chrono::steady_clock::now();
+
+	std::vector<Ray> rays;
+	for (int i = 0; i < BENCHMARK_RAYS; i++) {
+		rays.push_back(Ray(glm::vec3(position(rng), position(rng), position(rng)),
+							glm::vec3(offset(rng), offset(rng), offset(rng))));
+	}
+	std::vector<float> hitTs, compressedHitTs;
+	float raysPerSec = traceBenchmarkRays(qbvh, triangles, rays, hitTs);
+	float compressedRaysPerSec = traceBenchmarkRays(compressedQBVH, triangles, rays, compressedHitTs);
+	std::cout << "4-wide:     " << std::chrono::duration<float, std::milli>(compressStartTime - collapseStartTime).count()
+		<< " ms, " << qbvh.nodes.size() << " nodes, " << (float)qbvh.memoryBytes() / N << " bytes per triangle, "
+		<< raysPerSec << " rays/sec" << std::endl;
+	std::cout << "Compressed: " << std::chrono::duration<float, std::milli>(compressEndTime - compressStartTime).count()
+		<< " ms, " << compressedQBVH.nodes.size() << " nodes, " << (float)compressedQBVH.memoryBytes() / N
+		<< " bytes per triangle, " << compressedRaysPerSec << " rays/sec ("
+		<< 100.0f * (1.0f - compressedRaysPerSec / raysPerSec) << "% slower)" << std::endl;
+	bool sameHits = hitTs == compressedHitTs;
+	std::cout << "Hits are " << (sameHits ? "identical" : "DIFFERENT") << std::endl;
+	return same && sameHits ? 0 : 1;
+}
+
+/**
+ * @fn	int benchmarkImport(const RenderOptions &options)
+ * @brief	Imports a mesh file, first on one thread and then on
+ * 			options.numThreads, reporting the speed of each in MB/s, and then
+ * 			builds the mesh's BVH. The file is imported once beforehand, so
+ * 			that both timings find it in the page cache.
+ * @param	options	The command line options.
+ * @return	The exit status; nonzero if the file cannot be imported or the two
+ * 			imports differ.
+ */
+
+int benchmarkImport(const RenderOptions &options) {
+	MeshData serialMesh, parallelMesh;
+	WorkStealingPool pool(options.numThreads);
+	if (!MeshImporter::load(options.importFileName, serialMesh)) {
+		std::cerr << "Cannot import " << options.importFileName << std::endl;
+		return 1;
+	}
+	MappedFile file;
+	file.open(options.importFileName);
+	const float megabytes = file.getSize() / (1024.0f * 1024.0f);
+
+	auto serialStartTime = std::chrono::steady_clock::now();
+	MeshImporter::load(options.importFileName, serialMesh);
+	auto parallelStartTime = std::chrono::steady_clock::now();
+	MeshImporter::load(options.importFileName, parallelMesh, &pool);
+	auto bvhStartTime = std::chrono::steady_clock::now();
+	ITriangleMesh mesh(parallelMesh, &pool);
+	auto endTime = std::chrono::steady_clock::now();
+
+	float serialSeconds = std::chrono::duration<float>(parallelStartTime - serialStartTime).count();
+	float parallelSeconds = std::chrono::duration<float>(bvhStartTime - parallelStartTime).count();
+	std::cout << options.importFileName << ": " << megabytes << " MB, " << serialMesh.getNumVertices()
+		<< " vertices, " << serialMesh.getNumTriangles() << " triangles"
+		<< (serialMesh.hasNormals() ? ", with normals" : "") << std::endl;
+	std::cout << "1 thread:   " << serialSeconds * 1000.0f << " ms, " << megabytes / serialSeconds << " MB/s" << std::endl;
+	std::cout << pool.getNumThreads() << " threads: " << parallelSeconds * 1000.0f << " ms, "
+		<< megabytes / parallelSeconds << " MB/s" << std::endl;
+	std::cout << "BVH:        " << std::chrono::duration<float, std::milli>(endTime - bvhStartTime).count()
+		<< " ms" << std::endl;
+
+	bool same = serialMesh.positions == parallelMesh.positions && serialMesh.normals == parallelMesh.normals &&
+				serialMesh.indices == parallelMesh.indices;
+	std::cout << "Meshes are " << (same ? "identical" : "DIFFERENT") << std::endl;
+	return same ? 0 : 1;
+}
+
 int main(int argc, char *argv[]) {
+	RenderOptions options;
+	if (!options.parse(argc, argv)) {
+		RenderOptions::printUsage(argv[0]);
+		return 1;
+	}
+	if (options.isBenchmark()) {
+		return benchmarkBVHBuild(options);
+	}
+	if (options.isImportBenchmark()) {
+		return benchmarkImport(options);
+	}
+	if (options.isStressTest()) {
+		return threadStressTest(options);
+	}
+	if (options.isHeadless()) {
+		return renderHeadless(options);
+	}
+
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_RGB | GLUT_SINGLE);
 	glutInitWindowSize(WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -241,6 +589,7 @@ int main(int argc, char *argv[]) {
 	glutKeyboardFunc(keyboard);
 	glutSpecialFunc(special);
 	glutMouseFunc(mouse);
+	glutIdleFunc(idle);
 	glutTimerFunc(TIME_INTERVAL, timer, 0);
 	buildScene();
 
@@ -0,0 +1,143 @@
+#include "QuadricKernel.h"
+
+/**
+ * @fn	template <int terms> static void computeAqBqCq(const QuadricCoefficients<float> &q, const glm::vec3 &center, const glm::vec3 &origin, const glm::vec3 &direction, float &Aq, float &Bq, float &Cq)
+ * @brief	Scalar kernel: quadricTerms for one ray.
+ */
+
+template <int terms>
+static void computeAqBqCq(const QuadricCoefficients<float> &q, const glm::vec3 &center,
+						const glm::vec3 &origin, const glm::vec3 &direction, float &Aq, float &Bq, float &Cq) {
+	const float centerXYZ[3] = { center.x, center.y, center.z };
+	const float originXYZ[3] = { origin.x, origin.y, origin.z };
+	const float directionXYZ[3] = { direction.x, direction.y, direction.z };
+	quadricTerms<terms>(q, centerXYZ, originXYZ, directionXYZ, Aq, Bq, Cq);
+}
+
+#if defined(RAYPACKET_X86)
+
+/**
+ * @fn	template <class Real> static QuadricCoefficients<Real> broadcast(const QuadricCoefficients<float> &q)
+ * @brief	Copies one quadric's coefficients into every lane.
+ */
+
+template <class Real>
+static inline QuadricCoefficients<Real> broadcast(const QuadricCoefficients<float> &q) {
+	QuadricCoefficients<Real> lanes;
+	lanes.A = Real(q.A);
+	lanes.B = Real(q.B);
+	lanes.C = Real(q.C);
+	lanes.D = Real(q.D);
+	lanes.E = Real(q.E);
+	lanes.F = Real(q.F);
+	lanes.G = Real(q.G);
+	lanes.H = Real(q.H);
+	lanes.I = Real(q.I);
+	lanes.J = Real(q.J);
+	lanes.twoA = Real(q.twoA);
+	lanes.twoB = Real(q.twoB);
+	lanes.twoC = Real(q.twoC);
+	return lanes;
+}
+
+/**
+ * @fn	template <int terms> static void intersectPacketSSE(const RayPacket &packet, const QuadricCoefficients<float> &q, const float center[3], float t[MAX_PACKET_SIZE])
+ * @brief	SSE version of the packet kernel, 4 lanes at a time.
+ */
+
+template <int terms>
+TARGET_SSE2 TARGET_FLATTEN
+static void intersectPacketSSE(const RayPacket &packet, const QuadricCoefficients<float> &q,
+								const float center[3], float t[MAX_PACKET_SIZE]) {
+	const QuadricCoefficients<Float4> lanes = broadcast<Float4>(q);
+	const Float4 centerXYZ[3] = { Float4(center[0]), Float4(center[1]), Float4(center[2]) };
+	for (int base = 0; base < packet.width; base += 4) {
+		const Float4 origin[3] = { loadLanes<Float4>(packet.ox + base), loadLanes<Float4>(packet.oy + base), loadLanes<Float4>(packet.oz + base) };
+		const Float4 direction[3] = { loadLanes<Float4>(packet.dx + base), loadLanes<Float4>(packet.dy + base), loadLanes<Float4>(packet.dz + base) };
+		closestQuadricT<terms>(lanes, centerXYZ, origin, direction).store(t + base);
+	}
+}
+
+/**
+ * @fn	template <int terms> static void intersectPacketAVX2(const RayPacket &packet, const QuadricCoefficients<float> &q, const float center[3], float t[MAX_PACKET_SIZE])
+ * @brief	AVX2 version of the packet kernel, all 8 lanes at once.
+ */
+
+template <int terms>
+TARGET_AVX2 TARGET_FLATTEN
+static void intersectPacketAVX2(const RayPacket &packet, const QuadricCoefficients<float> &q,
+								const float center[3], float t[MAX_PACKET_SIZE]) {
+	const QuadricCoefficients<Float8> lanes = broadcast<Float8>(q);
+	const Float8 centerXYZ[3] = { Float8(center[0]), Float8(center[1]), Float8(center[2]) };
+	const Float8 origin[3] = { loadLanes<Float8>(packet.ox), loadLanes<Float8>(packet.oy), loadLanes<Float8>(packet.oz) };
+	const Float8 direction[3] = { loadLanes<Float8>(packet.dx), loadLanes<Float8>(packet.dy), loadLanes<Float8>(packet.dz) };
+	closestQuadricT<terms>(lanes, centerXYZ, origin, direction).store(t);
+}
+
+#endif
+
+/**
+ * @fn	template <int terms> static void intersectPacket(const RayPacket &packet, const QuadricCoefficients<float> &q, const float center[3], float t[MAX_PACKET_SIZE])
+ * @brief	Intersects every ray in the packet with an unclipped quadric.
+ * @param 		  	packet	The packet.
+ * @param 		  	q	  	The quadric's coefficients.
+ * @param 		  	center	The quadric's center.
+ * @param [in,out]	t	  	The smallest positive root for each lane, or FLT_MAX.
+ */
+
+template <int terms>
+static void intersectPacket(const RayPacket &packet, const QuadricCoefficients<float> &q,
+							const float center[3], float t[MAX_PACKET_SIZE]) {
+#if defined(RAYPACKET_X86)
+	if (packet.width == 8 && RayPacket::preferredWidth() == 8) {
+		intersectPacketAVX2<terms>(packet, q, center, t);
+		return;
+	} else if (packet.width % 4 == 0) {
+		intersectPacketSSE<terms>(packet, q, center, t);
+		return;
+	}
+#endif
+	for (int i = 0; i < packet.width; i++) {
+		const float origin[3] = { packet.ox[i], packet.oy[i], packet.oz[i] };
+		const float direction[3] = { packet.dx[i], packet.dy[i], packet.dz[i] };
+		t[i] = closestQuadricT<terms>(q, center, origin, direction);
+	}
+}
+
+/**
+ * @fn	template <int terms> static QuadricKernel makeKernel()
+ * @brief	Instantiates every kernel for one set of terms.
+ */
+
+template <int terms>
+static QuadricKernel makeKernel() {
+	QuadricKernel kernel;
+	kernel.terms = terms;
+	kernel.computeAqBqCq = computeAqBqCq<terms>;
+	kernel.gradient = quadricGradient<terms>;
+	kernel.intersectPacket = intersectPacket<terms>;
+	return kernel;
+}
+
+/**
+ * @fn	const QuadricKernel &QuadricKernel::select(int nonzeroTerms)
+ * @brief	Chooses the smallest kernel that covers the nonzero coefficients.
+ * @param	nonzeroTerms	The QuadricTerms whose coefficients are not 0.
+ * @return	The kernel.
+ */
+
+const QuadricKernel &QuadricKernel::select(int nonzeroTerms) {
+	static const QuadricKernel kernels[] = {
+		makeKernel<QUADRIC_SQUARES>(),
+		makeKernel<QUADRIC_SQUARES | QUADRIC_J>(),
+		makeKernel<QUADRIC_SQUARES | QUADRIC_LINEAR | QUADRIC_J>(),
+		makeKernel<QUADRIC_ALL>()
+	};
+	const int numKernels = sizeof(kernels) / sizeof(kernels[0]);
+	for (int i = 0; i < numKernels - 1; i++) {
+		if ((nonzeroTerms & ~kernels[i].terms) == 0) {
+			return kernels[i];
+		}
+	}
+	return kernels[numKernels - 1];
+}
@@ -0,0 +1,328 @@
+#pragma once
+#include <cfloat>
+#include <cmath>
+#include "Defs.h"
+#include "RayPacket.h"
+
+#if defined(RAYPACKET_X86)
+#include <immintrin.h>
+#endif
+
+/**
+ * @enum	QuadricTerms
+ * @brief	Bits naming the coefficients of the general quadric
+ * 			Ax^2 + By^2 + Cz^2 + Dxy + Exz + Fyz + Gx + Hy + Iz + J. A kernel
+ * 			evaluates only the terms in its set.
+ */
+
+enum QuadricTerms {
+	QUADRIC_A = 1 << 0, QUADRIC_B = 1 << 1, QUADRIC_C = 1 << 2,
+	QUADRIC_D = 1 << 3, QUADRIC_E = 1 << 4, QUADRIC_F = 1 << 5,
+	QUADRIC_G = 1 << 6, QUADRIC_H = 1 << 7, QUADRIC_I = 1 << 8,
+	QUADRIC_J = 1 << 9,
+	QUADRIC_SQUARES = QUADRIC_A | QUADRIC_B | QUADRIC_C,	//!< x^2, y^2 and z^2.
+	QUADRIC_CROSS = QUADRIC_D | QUADRIC_E | QUADRIC_F,		//!< xy, xz and yz; present once a quadric is rotated.
+	QUADRIC_LINEAR = QUADRIC_G | QUADRIC_H | QUADRIC_I,		//!< x, y and z.
+	QUADRIC_ALL = QUADRIC_SQUARES | QUADRIC_CROSS | QUADRIC_LINEAR | QUADRIC_J
+};
+
+/**
+ * @struct	QuadricCoefficients
+ * @brief	A quadric's coefficients, for one quadric (Real = float) or for one
+ * 			quadric per SIMD lane (Real = Float4 or Float8).
+ */
+
+template <class Real>
+struct QuadricCoefficients {
+	Real A, B, C, D, E, F, G, H, I, J;
+	Real twoA;		//!< 2*A
+	Real twoB;		//!< 2*B
+	Real twoC;		//!< 2*C
+};
+
+/**
+ * @fn	template <class Real> inline Real loadLanes(const float *p)
+ * @brief	Loads consecutive floats, one per lane of Real.
+ */
+
+template <class Real> inline Real loadLanes(const float *p);
+
+template <>
+inline float loadLanes<float>(const float *p) {
+	return *p;
+}
+
+/**
+ * @fn	inline float selectLanes(bool mask, float a, float b)
+ * @brief	Scalar version of the SIMD lane select: a where mask is set, else b.
+ */
+
+inline float selectLanes(bool mask, float a, float b) {
+	return mask ? a : b;
+}
+
+/**
+ * @fn	inline bool anyLane(bool mask)
+ * @brief	Scalar version of the SIMD test for any set lane.
+ */
+
+inline bool anyLane(bool mask) {
+	return mask;
+}
+
+#if defined(RAYPACKET_X86)
+
+/**
+ * @struct	Float4
+ * @brief	Four SSE lanes, so that the quadric templates below can be
+ * 			instantiated for SSE. Comparisons return all-ones lanes as masks.
+ * 			The copy constructor is user-provided, which makes the type pass
+ * 			through memory rather than in a register; calls between code
+ * 			built for different targets are then safe even when not inlined.
+ */
+
+struct Float4 {
+	__m128 v;
+	TARGET_SSE2 Float4() {}
+	TARGET_SSE2 Float4(__m128 lanes) : v(lanes) {}
+	TARGET_SSE2 explicit Float4(float x) : v(_mm_set1_ps(x)) {}
+	TARGET_SSE2 Float4(const Float4 &other) : v(other.v) {}
+	TARGET_SSE2 Float4 &operator=(const Float4 &other) { v = other.v; return *this; }
+	TARGET_SSE2 void store(float *p) const { _mm_storeu_ps(p, v); }
+};
+
+template <>
+TARGET_SSE2 inline Float4 loadLanes<Float4>(const float *p) { return _mm_loadu_ps(p); }
+
+TARGET_SSE2 inline Float4 operator+(const Float4 &a, const Float4 &b) { return _mm_add_ps(a.v, b.v); }
+TARGET_SSE2 inline Float4 operator-(const Float4 &a, const Float4 &b) { return _mm_sub_ps(a.v, b.v); }
+TARGET_SSE2 inline Float4 operator*(const Float4 &a, const Float4 &b) { return _mm_mul_ps(a.v, b.v); }
+TARGET_SSE2 inline Float4 operator/(const Float4 &a, const Float4 &b) { return _mm_div_ps(a.v, b.v); }
+TARGET_SSE2 inline Float4 operator<(const Float4 &a, const Float4 &b) { return _mm_cmplt_ps(a.v, b.v); }
+TARGET_SSE2 inline Float4 operator>(const Float4 &a, const Float4 &b) { return _mm_cmpgt_ps(a.v, b.v); }
+TARGET_SSE2 inline Float4 operator>=(const Float4 &a, const Float4 &b) { return _mm_cmpge_ps(a.v, b.v); }
+TARGET_SSE2 inline Float4 sqrt(const Float4 &a) { return _mm_sqrt_ps(a.v); }
+TARGET_SSE2 inline Float4 selectLanes(const Float4 &mask, const Float4 &a, const Float4 &b) {
+	return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+TARGET_SSE2 inline bool anyLane(const Float4 &mask) { return _mm_movemask_ps(mask.v) != 0; }
+
+/**
+ * @struct	Float8
+ * @brief	Eight AVX2 lanes; see Float4.
+ */
+
+struct Float8 {
+	__m256 v;
+	TARGET_AVX2 Float8() {}
+	TARGET_AVX2 Float8(__m256 lanes) : v(lanes) {}
+	TARGET_AVX2 explicit Float8(float x) : v(_mm256_set1_ps(x)) {}
+	TARGET_AVX2 Float8(const Float8 &other) : v(other.v) {}
+	TARGET_AVX2 Float8 &operator=(const Float8 &other) { v = other.v; return *this; }
+	TARGET_AVX2 void store(float *p) const { _mm256_storeu_ps(p, v); }
+};
+
+template <>
+TARGET_AVX2 inline Float8 loadLanes<Float8>(const float *p) { return _mm256_loadu_ps(p); }
+
+TARGET_AVX2 inline Float8 operator+(const Float8 &a, const Float8 &b) { return _mm256_add_ps(a.v, b.v); }
+TARGET_AVX2 inline Float8 operator-(const Float8 &a, const Float8 &b) { return _mm256_sub_ps(a.v, b.v); }
+TARGET_AVX2 inline Float8 operator*(const Float8 &a, const Float8 &b) { return _mm256_mul_ps(a.v, b.v); }
+TARGET_AVX2 inline Float8 operator/(const Float8 &a, const Float8 &b) { return _mm256_div_ps(a.v, b.v); }
+TARGET_AVX2 inline Float8 operator<(const Float8 &a, const Float8 &b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+TARGET_AVX2 inline Float8 operator>(const Float8 &a, const Float8 &b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+TARGET_AVX2 inline Float8 operator>=(const Float8 &a, const Float8 &b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+TARGET_AVX2 inline Float8 sqrt(const Float8 &a) { return _mm256_sqrt_ps(a.v); }
+TARGET_AVX2 inline Float8 selectLanes(const Float8 &mask, const Float8 &a, const Float8 &b) {
+	return _mm256_blendv_ps(b.v, a.v, mask.v);
+}
+TARGET_AVX2 inline bool anyLane(const Float8 &mask) { return _mm256_movemask_ps(mask.v) != 0; }
+
+#endif
+
+/**
+ * @fn	template <int terms, class Real> inline void quadricTerms(const QuadricCoefficients<Real> &q, const Real center[3], const Real origin[3], const Real direction[3], Real &Aq, Real &Bq, Real &Cq)
+ * @brief	Calculates aq, bq and cq from the terms in terms only. The tests on
+ * 			terms are resolved at compile time, so each kernel is free of the
+ * 			other terms and of branches. Terms are added in the same order in
+ * 			every kernel, starting from -0, which leaves the first term
+ * 			unchanged; leaving out terms whose coefficients are 0 therefore does
+ * 			not change the result, and every lane type gives the same values.
+ * @param 		  	q		 	The coefficients.
+ * @param 		  	center   	The quadric's center.
+ * @param 		  	origin   	The ray's origin.
+ * @param 		  	direction	The ray's direction.
+ * @param [in,out]	Aq		 	The aq.
+ * @param [in,out]	Bq		 	The bq.
+ * @param [in,out]	Cq		 	The cq.
+ */
+
+template <int terms, class Real>
+inline void quadricTerms(const QuadricCoefficients<Real> &q, const Real center[3],
+						const Real origin[3], const Real direction[3], Real &Aq, Real &Bq, Real &Cq) {
+	const Real Rox = origin[0] - center[0];
+	const Real Roy = origin[1] - center[1];
+	const Real Roz = origin[2] - center[2];
+	const Real &Rdx = direction[0];
+	const Real &Rdy = direction[1];
+	const Real &Rdz = direction[2];
+	Aq = Bq = Cq = Real(-0.0f);
+	if (terms & QUADRIC_A) {
+		Aq = Aq + q.A * (Rdx*Rdx);
+		Bq = Bq + q.twoA * Rox*Rdx;
+		Cq = Cq + q.A * (Rox * Rox);
+	}
+	if (terms & QUADRIC_B) {
+		Aq = Aq + q.B * (Rdy*Rdy);
+		Bq = Bq + q.twoB * Roy*Rdy;
+		Cq = Cq + q.B * (Roy * Roy);
+	}
+	if (terms & QUADRIC_C) {
+		Aq = Aq + q.C * (Rdz*Rdz);
+		Bq = Bq + q.twoC * Roz*Rdz;
+		Cq = Cq + q.C * (Roz * Roz);
+	}
+	if (terms & QUADRIC_D) {
+		Aq = Aq + q.D * (Rdx * Rdy);
+		Bq = Bq + q.D * (Rox * Rdy + Roy * Rdx);
+		Cq = Cq + q.D * (Rox * Roy);
+	}
+	if (terms & QUADRIC_E) {
+		Aq = Aq + q.E * (Rdx * Rdz);
+		Bq = Bq + q.E * (Rox * Rdz + Roz * Rdx);
+		Cq = Cq + q.E * (Rox * Roz);
+	}
+	if (terms & QUADRIC_F) {
+		Aq = Aq + q.F * (Rdy * Rdz);
+		Bq = Bq + q.F * (Roy * Rdz + Roz * Rdy);
+		Cq = Cq + q.F * (Roy * Roz);
+	}
+	if (terms & QUADRIC_G) {
+		Bq = Bq + q.G * Rdx;
+		Cq = Cq + q.G * Rox;
+	}
+	if (terms & QUADRIC_H) {
+		Bq = Bq + q.H * Rdy;
+		Cq = Cq + q.H * Roy;
+	}
+	if (terms & QUADRIC_I) {
+		Bq = Bq + q.I * Rdz;
+		Cq = Cq + q.I * Roz;
+	}
+	if (terms & QUADRIC_J) {
+		Cq = Cq + q.J;
+	}
+}
+
+/**
+ * @fn	template <class Real> inline Real closestQuadricRoot(const Real &Aq, const Real &Bq, const Real &Cq)
+ * @brief	Finds the smallest positive root of Aq t^2 + Bq t + Cq with the
+ * 			arithmetic of quadratic, so that the roots are identical. The root
+ * 			is chosen with selects rather than branches, so it works the same
+ * 			on every lane type.
+ * @param	Aq	Aq.
+ * @param	Bq	Bq.
+ * @param	Cq	Cq.
+ * @return	The smallest positive root, or FLT_MAX.
+ */
+
+template <class Real>
+inline Real closestQuadricRoot(const Real &Aq, const Real &Bq, const Real &Cq) {
+	using std::sqrt;
+	const Real zero(0.0f);
+	const Real noHit(FLT_MAX);
+	const Real inside = Bq * Bq - Real(4.0f) * Aq * Cq;
+	if (!anyLane(inside >= zero)) {
+		return noHit;
+	}
+	const Real root = sqrt(inside);
+	const Real minusB = Real(-1.0f) * Bq;
+	const Real twoAq = Real(2.0f) * Aq;
+	const Real x1 = (minusB + root) / twoAq;
+	const Real x2 = (minusB - root) / twoAq;
+	const auto swap = x1 > x2;
+	const Real nearer = selectLanes(swap, x2, x1);
+	const Real farther = selectLanes(swap, x1, x2);
+	const Real t = selectLanes(nearer > zero, nearer, selectLanes(farther > zero, farther, noHit));
+	return selectLanes(inside < zero, noHit, t);
+}
+
+/**
+ * @fn	template <int terms, class Real> inline Real closestQuadricT(const QuadricCoefficients<Real> &q, const Real center[3], const Real origin[3], const Real direction[3])
+ * @brief	Intersects a ray with a quadric, from the terms in terms only.
+ * @param	q		 	The coefficients.
+ * @param	center   	The quadric's center.
+ * @param	origin   	The ray's origin.
+ * @param	direction	The ray's direction.
+ * @return	The smallest positive t, or FLT_MAX.
+ */
+
+template <int terms, class Real>
+inline Real closestQuadricT(const QuadricCoefficients<Real> &q, const Real center[3],
+							const Real origin[3], const Real direction[3]) {
+	Real Aq, Bq, Cq;
+	quadricTerms<terms>(q, center, origin, direction, Aq, Bq, Cq);
+	return closestQuadricRoot(Aq, Bq, Cq);
+}
+
+/**
+ * @fn	template <int terms> inline glm::vec3 quadricGradient(const QuadricCoefficients<float> &q, const glm::vec3 &pt)
+ * @brief	The gradient of the quadric, from the terms in terms only (see
+ * 			quadricTerms).
+ * @param	q 	The coefficients.
+ * @param	pt	A point, relative to the center.
+ * @return	The gradient at pt.
+ */
+
+template <int terms>
+inline glm::vec3 quadricGradient(const QuadricCoefficients<float> &q, const glm::vec3 &pt) {
+	glm::vec3 g(-0.0f, -0.0f, -0.0f);
+	if (terms & QUADRIC_A) {
+		g.x += q.twoA * pt.x;
+	}
+	if (terms & QUADRIC_B) {
+		g.y += q.twoB * pt.y;
+	}
+	if (terms & QUADRIC_C) {
+		g.z += q.twoC * pt.z;
+	}
+	if (terms & QUADRIC_D) {
+		g.x += q.D * pt.y;
+		g.y += q.D * pt.x;
+	}
+	if (terms & QUADRIC_E) {
+		g.x += q.E * pt.z;
+		g.z += q.E * pt.x;
+	}
+	if (terms & QUADRIC_F) {
+		g.y += q.F * pt.z;
+		g.z += q.F * pt.y;
+	}
+	if (terms & QUADRIC_G) {
+		g.x += q.G;
+	}
+	if (terms & QUADRIC_H) {
+		g.y += q.H;
+	}
+	if (terms & QUADRIC_I) {
+		g.z += q.I;
+	}
+	return g;
+}
+
+/**
+ * @struct	QuadricKernel
+ * @brief	The quadric templates instantiated for one set of terms. A quadric
+ * 			picks its kernel once, when it is constructed, and calls through it
+ * 			without testing its terms again.
+ */
+
+struct QuadricKernel {
+	int terms;		//!< The QuadricTerms evaluated
+	void (*computeAqBqCq)(const QuadricCoefficients<float> &q, const glm::vec3 &center,
+						const glm::vec3 &origin, const glm::vec3 &direction, float &Aq, float &Bq, float &Cq);
+	glm::vec3 (*gradient)(const QuadricCoefficients<float> &q, const glm::vec3 &pt);
+	void (*intersectPacket)(const RayPacket &packet, const QuadricCoefficients<float> &q,
+						const float center[3], float t[MAX_PACKET_SIZE]);
+	static const QuadricKernel &select(int nonzeroTerms);
+};
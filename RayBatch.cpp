@@ -0,0 +1,86 @@
+#include "RayBatch.h"
+
+/**
+ * @fn	void RayBatch::add(const Ray &ray, float rayTMin, float rayTMax)
+ * @brief	Adds an active ray to the batch.
+ * @param	ray	   	The ray.
+ * @param	rayTMin	Where the ray starts.
+ * @param	rayTMax	The farthest t of interest.
+ */
+
+void RayBatch::add(const Ray &ray, float rayTMin, float rayTMax) {
+	ox.push_back(ray.origin.x);
+	oy.push_back(ray.origin.y);
+	oz.push_back(ray.origin.z);
+	dx.push_back(ray.direction.x);
+	dy.push_back(ray.direction.y);
+	dz.push_back(ray.direction.z);
+	tMin.push_back(rayTMin);
+	tMax.push_back(rayTMax);
+	active.push_back(1);
+}
+
+/**
+ * @fn	Ray RayBatch::getRay(int i) const
+ * @brief	Gets a ray as a Ray, starting at tMin. The t values of hits along it
+ * 			are therefore tMin less than along the batch's ray.
+ * @param	i	The ray.
+ * @return	The ray.
+ */
+
+Ray RayBatch::getRay(int i) const {
+	const glm::vec3 direction(dx[i], dy[i], dz[i]);
+	Ray ray(glm::vec3(ox[i], oy[i], oz[i]) + tMin[i] * direction, direction);
+	ray.direction = direction;	// Already of unit length; normalizing again could change it.
+	return ray;
+}
+
+/**
+ * @fn	void RayBatch::clear()
+ * @brief	Removes all the rays.
+ */
+
+void RayBatch::clear() {
+	ox.clear();
+	oy.clear();
+	oz.clear();
+	dx.clear();
+	dy.clear();
+	dz.clear();
+	tMin.clear();
+	tMax.clear();
+	active.clear();
+}
+
+/**
+ * @fn	void HitBatch::reset(const RayBatch &rays)
+ * @brief	Sets up one empty hit per ray, with no hit closer than the ray's tMax.
+ * @param	rays	The rays.
+ */
+
+void HitBatch::reset(const RayBatch &rays) {
+	t.assign(rays.tMax.begin(), rays.tMax.end());
+	objects.assign(rays.size(), nullptr);
+	primitives.assign(rays.size(), 0);
+}
+
+/**
+ * @fn	void HitBatch::complete(const RayBatch &rays, std::vector<HitRecord> &hits) const
+ * @brief	Computes full hit records (intercept, normal, material, texture
+ * 			coordinates) for the winning object of each ray.
+ * @param 		  	rays	The rays.
+ * @param [in,out]	hits	Set to the hit record for each ray, with t measured
+ * 							from its origin.
+ */
+
+void HitBatch::complete(const RayBatch &rays, std::vector<HitRecord> &hits) const {
+	hits.resize(rays.size());
+	for (int i = 0; i < rays.size(); i++) {
+		if (objects[i] == nullptr) {
+			hits[i] = HitRecord();
+		} else {
+			objects[i]->completeHit(rays.getRay(i), primitives[i], hits[i]);
+			hits[i].t += rays.tMin[i];
+		}
+	}
+}
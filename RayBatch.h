@@ -0,0 +1,67 @@
+#pragma once
+#include <vector>
+#include "IShape.h"
+
+/**
+ * @struct	RayBatch
+ * @brief	Any number of rays, laid out one coordinate per array, to be
+ * 			intersected together (see IShape::intersect). Each ray starts at
+ * 			origin + tMin * direction and is of interest up to tMax; both are
+ * 			measured from the origin. Only the active rays are traced, and
+ * 			occlusion tests clear the flag of each ray they find blocked.
+ */
+
+struct RayBatch {
+	std::vector<float> ox;			//!< Origin x of each ray
+	std::vector<float> oy;			//!< Origin y of each ray
+	std::vector<float> oz;			//!< Origin z of each ray
+	std::vector<float> dx;			//!< Direction x of each ray, of unit length
+	std::vector<float> dy;			//!< Direction y of each ray
+	std::vector<float> dz;			//!< Direction z of each ray
+	std::vector<float> tMin;		//!< Where each ray starts
+	std::vector<float> tMax;		//!< The farthest t of interest for each ray
+	std::vector<char> active;		//!< Nonzero for the rays to be traced
+	int size() const { return (int)active.size(); }
+	float getLength(int i) const { return tMax[i] - tMin[i]; }
+	void add(const Ray &ray, float rayTMin = 0.0f, float rayTMax = FLT_MAX);
+	Ray getRay(int i) const;
+	void clear();
+};
+
+/**
+ * @struct	HitBatch
+ * @brief	The closest hit found so far for each ray in a RayBatch. Like
+ * 			ClosestHit, only t, the object and the part hit are tracked while
+ * 			searching; complete fills in full hit records for the winners.
+ */
+
+struct HitBatch {
+	std::vector<float> t;						//!< Closest t for each ray, from its origin; tMax if none.
+	std::vector<const VisibleIShape *> objects;	//!< Object hit by each ray, or nullptr.
+	std::vector<int> primitives;				//!< Part of the object hit by each ray.
+	void reset(const RayBatch &rays);
+	bool update(int i, float hitT, const VisibleIShape *object, int primitive);
+	void complete(const RayBatch &rays, std::vector<HitRecord> &hits) const;
+};
+
+/**
+ * @fn	inline bool HitBatch::update(int i, float hitT, const VisibleIShape *object, int primitive)
+ * @brief	Records a hit of an object by ray i, if it is closer than the ray's
+ * 			closest hit so far. Inline, since shapes call it for every ray they
+ * 			hit.
+ * @param	i		 	The ray.
+ * @param	hitT	 	The t of the hit, from the ray's origin.
+ * @param	object   	The object hit.
+ * @param	primitive	The part hit.
+ * @return	True iff the hit was recorded.
+ */
+
+inline bool HitBatch::update(int i, float hitT, const VisibleIShape *object, int primitive) {
+	if (hitT < t[i]) {
+		t[i] = hitT;
+		objects[i] = object;
+		primitives[i] = primitive;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,243 @@
+#include <algorithm>
+#include "RayPacket.h"
+#include "IShape.h"
+
+#if defined(RAYPACKET_X86)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+/**
+ * @fn	void RayPacket::set(const Ray *firstRay, int numRays, int packetWidth)
+ * @brief	Fills the packet from consecutive rays.
+ * @param	firstRay   	The first ray.
+ * @param	numRays	   	Number of rays; at most packetWidth.
+ * @param	packetWidth	Lanes to process at once: 4 or 8.
+ */
+
+void RayPacket::set(const Ray *firstRay, int numRays, int packetWidth) {
+	size = numRays;
+	width = packetWidth;
+	for (int i = 0; i < width; i++) {
+		const Ray &ray = firstRay[i < numRays ? i : 0];
+		rays[i] = &ray;
+		ox[i] = ray.origin.x;
+		oy[i] = ray.origin.y;
+		oz[i] = ray.origin.z;
+		dx[i] = ray.direction.x;
+		dy[i] = ray.direction.y;
+		dz[i] = ray.direction.z;
+		ix[i] = 1.0f / dx[i];
+		iy[i] = 1.0f / dy[i];
+		iz[i] = 1.0f / dz[i];
+	}
+}
+
+/**
+ * @fn	int RayPacket::preferredWidth()
+ * @brief	The widest packet this CPU can process: 8 with AVX2, 4 with SSE2
+ * 			and 1 (no packets) otherwise. Determined once, at run time.
+ * @return	The packet width.
+ */
+
+int RayPacket::preferredWidth() {
+	static const int width = [] {
+#if defined(RAYPACKET_X86) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		const int maxLeaf = info[0];
+		__cpuid(info, 1);
+		const bool hasSSE2 = (info[3] & (1 << 26)) != 0;
+		const bool osSavesAVX = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 &&
+								(_xgetbv(0) & 6) == 6;
+		if (osSavesAVX && maxLeaf >= 7) {
+			__cpuidex(info, 7, 0);
+			if (info[1] & (1 << 5)) {
+				return 8;
+			}
+		}
+		return hasSSE2 ? 4 : 1;
+#elif defined(RAYPACKET_X86)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			return 8;
+		}
+		return __builtin_cpu_supports("sse2") ? 4 : 1;
+#else
+		return 1;
+#endif
+	}();
+	return width;
+}
+
+#if defined(RAYPACKET_X86)
+
+/**
+ * @fn	static void intersectPlaneSSE(const RayPacket &packet, const float point[3], const float normal[3], float t[MAX_PACKET_SIZE])
+ * @brief	SSE version of the plane kernel, 4 lanes at a time.
+ */
+
+TARGET_SSE2
+static void intersectPlaneSSE(const RayPacket &packet, const float point[3], const float normal[3], float t[MAX_PACKET_SIZE]) {
+	const __m128 nx = _mm_set1_ps(normal[0]), ny = _mm_set1_ps(normal[1]), nz = _mm_set1_ps(normal[2]);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 noHit = _mm_set1_ps(FLT_MAX);
+
+	for (int base = 0; base < packet.width; base += 4) {
+		__m128 denom = _mm_mul_ps(_mm_load_ps(packet.dx + base), nx);
+		denom = _mm_add_ps(denom, _mm_mul_ps(_mm_load_ps(packet.dy + base), ny));
+		denom = _mm_add_ps(denom, _mm_mul_ps(_mm_load_ps(packet.dz + base), nz));
+		__m128 num = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(point[0]), _mm_load_ps(packet.ox + base)), nx);
+		num = _mm_add_ps(num, _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(point[1]), _mm_load_ps(packet.oy + base)), ny));
+		num = _mm_add_ps(num, _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(point[2]), _mm_load_ps(packet.oz + base)), nz));
+
+		const __m128 miss = _mm_or_ps(_mm_cmpeq_ps(denom, zero), _mm_cmplt_ps(_mm_div_ps(num, denom), zero));
+		const __m128 result = _mm_or_ps(_mm_and_ps(miss, noHit), _mm_andnot_ps(miss, _mm_div_ps(num, denom)));
+		_mm_storeu_ps(t + base, result);
+	}
+}
+
+/**
+ * @fn	static void intersectPlaneAVX2(const RayPacket &packet, const float point[3], const float normal[3], float t[MAX_PACKET_SIZE])
+ * @brief	AVX2 version of the plane kernel, all 8 lanes at once.
+ */
+
+TARGET_AVX2
+static void intersectPlaneAVX2(const RayPacket &packet, const float point[3], const float normal[3], float t[MAX_PACKET_SIZE]) {
+	const __m256 nx = _mm256_set1_ps(normal[0]), ny = _mm256_set1_ps(normal[1]), nz = _mm256_set1_ps(normal[2]);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 noHit = _mm256_set1_ps(FLT_MAX);
+
+	__m256 denom = _mm256_mul_ps(_mm256_load_ps(packet.dx), nx);
+	denom = _mm256_add_ps(denom, _mm256_mul_ps(_mm256_load_ps(packet.dy), ny));
+	denom = _mm256_add_ps(denom, _mm256_mul_ps(_mm256_load_ps(packet.dz), nz));
+	__m256 num = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(point[0]), _mm256_load_ps(packet.ox)), nx);
+	num = _mm256_add_ps(num, _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(point[1]), _mm256_load_ps(packet.oy)), ny));
+	num = _mm256_add_ps(num, _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(point[2]), _mm256_load_ps(packet.oz)), nz));
+
+	const __m256 result = _mm256_div_ps(num, denom);
+	const __m256 miss = _mm256_or_ps(_mm256_cmp_ps(denom, zero, _CMP_EQ_OQ), _mm256_cmp_ps(result, zero, _CMP_LT_OQ));
+	_mm256_storeu_ps(t, _mm256_blendv_ps(result, noHit, miss));
+}
+
+/**
+ * @fn	static int intersectBoxSSE(const RayPacket &packet, const float lower[3], const float upper[3], const float tMax[MAX_PACKET_SIZE])
+ * @brief	SSE version of the slab test, 4 lanes at a time.
+ */
+
+TARGET_SSE2
+static int intersectBoxSSE(const RayPacket &packet, const float lower[3], const float upper[3], const float tMax[MAX_PACKET_SIZE]) {
+	const float *origins[3] = { packet.ox, packet.oy, packet.oz };
+	const float *invDirections[3] = { packet.ix, packet.iy, packet.iz };
+	int mask = 0;
+	for (int base = 0; base < packet.width; base += 4) {
+		__m128 tNear = _mm_setzero_ps();
+		__m128 tFar = _mm_loadu_ps(tMax + base);
+		for (int i = 0; i < 3; i++) {
+			const __m128 origin = _mm_load_ps(origins[i] + base);
+			const __m128 invDirection = _mm_load_ps(invDirections[i] + base);
+			const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(lower[i]), origin), invDirection);
+			const __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(upper[i]), origin), invDirection);
+			// Operand order matches std::min and std::max when a t is NaN
+			tNear = _mm_max_ps(_mm_min_ps(t2, t1), tNear);
+			tFar = _mm_min_ps(_mm_mul_ps(_mm_max_ps(t2, t1), _mm_set1_ps(SLAB_EXIT_SCALE)), tFar);
+		}
+		mask |= _mm_movemask_ps(_mm_cmple_ps(tNear, tFar)) << base;
+	}
+	return mask;
+}
+
+/**
+ * @fn	static int intersectBoxAVX2(const RayPacket &packet, const float lower[3], const float upper[3], const float tMax[MAX_PACKET_SIZE])
+ * @brief	AVX2 version of the slab test, all 8 lanes at once.
+ */
+
+TARGET_AVX2
+static int intersectBoxAVX2(const RayPacket &packet, const float lower[3], const float upper[3], const float tMax[MAX_PACKET_SIZE]) {
+	const float *origins[3] = { packet.ox, packet.oy, packet.oz };
+	const float *invDirections[3] = { packet.ix, packet.iy, packet.iz };
+	__m256 tNear = _mm256_setzero_ps();
+	__m256 tFar = _mm256_loadu_ps(tMax);
+	for (int i = 0; i < 3; i++) {
+		const __m256 origin = _mm256_load_ps(origins[i]);
+		const __m256 invDirection = _mm256_load_ps(invDirections[i]);
+		const __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(lower[i]), origin), invDirection);
+		const __m256 t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(upper[i]), origin), invDirection);
+		tNear = _mm256_max_ps(_mm256_min_ps(t2, t1), tNear);
+		tFar = _mm256_min_ps(_mm256_mul_ps(_mm256_max_ps(t2, t1), _mm256_set1_ps(SLAB_EXIT_SCALE)), tFar);
+	}
+	return _mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+}
+
+#endif
+
+/**
+ * @fn	void intersectPlanePacket(const RayPacket &packet, const float point[3], const float normal[3], float t[MAX_PACKET_SIZE])
+ * @brief	Intersects every ray in the packet with a plane. The arithmetic
+ * 			matches IPlane::findClosestIntersection.
+ * @param 		  	packet	The packet.
+ * @param 		  	point 	A point on the plane.
+ * @param 		  	normal	The plane's unit normal.
+ * @param [in,out]	t	  	The intercept for each lane, or FLT_MAX.
+ */
+
+void intersectPlanePacket(const RayPacket &packet, const float point[3],
+							const float normal[3], float t[MAX_PACKET_SIZE]) {
+#if defined(RAYPACKET_X86)
+	if (packet.width == 8 && RayPacket::preferredWidth() == 8) {
+		intersectPlaneAVX2(packet, point, normal, t);
+		return;
+	} else if (packet.width % 4 == 0) {
+		intersectPlaneSSE(packet, point, normal, t);
+		return;
+	}
+#endif
+	for (int i = 0; i < packet.width; i++) {
+		float denom = packet.dx[i] * normal[0] + packet.dy[i] * normal[1] + packet.dz[i] * normal[2];
+		float num = (point[0] - packet.ox[i]) * normal[0] + (point[1] - packet.oy[i]) * normal[1] +
+					(point[2] - packet.oz[i]) * normal[2];
+		t[i] = (denom == 0 || num / denom < 0) ? FLT_MAX : num / denom;
+	}
+}
+
+/**
+ * @fn	int intersectBoxPacket(const RayPacket &packet, const float lower[3], const float upper[3], const float tMax[MAX_PACKET_SIZE])
+ * @brief	Slab test for every ray in the packet. The arithmetic matches
+ * 			AABB::intersects, so a lane passes exactly when its ray would.
+ * @param	packet	The packet.
+ * @param	lower 	The box's lower corner.
+ * @param	upper 	The box's upper corner.
+ * @param	tMax  	The farthest t of interest for each lane.
+ * @return	A mask with bit i set iff ray i (i < size) hits the box within [0, tMax[i]].
+ */
+
+int intersectBoxPacket(const RayPacket &packet, const float lower[3],
+						const float upper[3], const float tMax[MAX_PACKET_SIZE]) {
+	const int realLanes = (1 << packet.size) - 1;
+#if defined(RAYPACKET_X86)
+	if (packet.width == 8 && RayPacket::preferredWidth() == 8) {
+		return intersectBoxAVX2(packet, lower, upper, tMax) & realLanes;
+	} else if (packet.width % 4 == 0) {
+		return intersectBoxSSE(packet, lower, upper, tMax) & realLanes;
+	}
+#endif
+	const float *origins[3] = { packet.ox, packet.oy, packet.oz };
+	const float *invDirections[3] = { packet.ix, packet.iy, packet.iz };
+	int mask = 0;
+	for (int lane = 0; lane < packet.size; lane++) {
+		float tNear = 0.0f;
+		float tFar = tMax[lane];
+		for (int i = 0; i < 3; i++) {
+			float t1 = (lower[i] - origins[i][lane]) * invDirections[i][lane];
+			float t2 = (upper[i] - origins[i][lane]) * invDirections[i][lane];
+			tNear = std::max(tNear, std::min(t1, t2));
+			tFar = std::min(tFar, std::max(t1, t2) * SLAB_EXIT_SCALE);
+		}
+		if (tNear <= tFar) {
+			mask |= 1 << lane;
+		}
+	}
+	return mask;
+}
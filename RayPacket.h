@@ -0,0 +1,49 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RAYPACKET_X86		//!< SSE and AVX2 kernels are available.
+#endif
+
+#if defined(RAYPACKET_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_SSE2 __attribute__((target("sse2")))		//!< Compile one function for SSE2.
+#define TARGET_AVX2 __attribute__((target("avx2")))		//!< Compile one function for AVX2.
+#define TARGET_FLATTEN __attribute__((flatten))			//!< Inline every call, so generic code takes on the caller's target.
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#define TARGET_FLATTEN
+#endif
+
+struct Ray;
+
+const int MAX_PACKET_SIZE = 8;		//!< Most rays in a packet (one AVX2 register).
+
+/**
+ * @struct	RayPacket
+ * @brief	A group of rays laid out one coordinate per array, so that SIMD
+ * 			kernels can intersect 4 (SSE) or 8 (AVX2) of them at once. Lanes
+ * 			past size are padded with copies of lane 0; their results are
+ * 			ignored.
+ */
+
+struct RayPacket {
+	alignas(32) float ox[MAX_PACKET_SIZE];	//!< Origin x of each ray
+	alignas(32) float oy[MAX_PACKET_SIZE];	//!< Origin y of each ray
+	alignas(32) float oz[MAX_PACKET_SIZE];	//!< Origin z of each ray
+	alignas(32) float dx[MAX_PACKET_SIZE];	//!< Direction x of each ray
+	alignas(32) float dy[MAX_PACKET_SIZE];	//!< Direction y of each ray
+	alignas(32) float dz[MAX_PACKET_SIZE];	//!< Direction z of each ray
+	alignas(32) float ix[MAX_PACKET_SIZE];	//!< 1/direction x of each ray, for slab tests
+	alignas(32) float iy[MAX_PACKET_SIZE];	//!< 1/direction y of each ray
+	alignas(32) float iz[MAX_PACKET_SIZE];	//!< 1/direction z of each ray
+	const Ray *rays[MAX_PACKET_SIZE];		//!< The original rays, for shapes without a packet kernel
+	int size;								//!< Number of real rays
+	int width;								//!< Lanes processed at once: 4 or 8
+	void set(const Ray *firstRay, int numRays, int packetWidth);
+	static int preferredWidth();
+};
+
+void intersectPlanePacket(const RayPacket &packet, const float point[3],
+							const float normal[3], float t[MAX_PACKET_SIZE]);
+int intersectBoxPacket(const RayPacket &packet, const float lower[3],
+							const float upper[3], const float tMax[MAX_PACKET_SIZE]);
@@ -1,108 +1,650 @@
+#include <algorithm>
+#include <tuple>
 #include "RayTracer.h"
 #include "IShape.h"
+#include "RayBatch.h"
 
 /**
- * @fn	RayTracer::RayTracer(const color &defa)
- * @brief	Constructs a raytracers.
+ * @fn	RayTracer::RayTracer(const color &defa, int N)
+ * @brief	Constructs a raytracers. The rendering threads are not started
+ * 			until the first frame, so tracers that never render cost none.
  * @param	defa	The clear color.
+ * @param	N   	Number of rendering threads. 0 uses one per hardware thread.
  */
 
-RayTracer::RayTracer(const color &defa)
-	: defaultColor(defa) {
+RayTracer::RayTracer(const color &defa, int N)
+	: defaultColor(defa), tileSize(DEFAULT_TILE_SIZE), recordDepth(false),
+	adaptiveThreshold(0.0f), numPrimaryRays(0), packetWidth(RayPacket::preferredWidth()),
+	maxAccumulatedSamples(DEFAULT_MAX_ACCUMULATED_SAMPLES), numAccumulated(0),
+	sortByMaterial(false), numThreads(N) {
 }
 
 /**
- * @fn	void RayTracer::raytraceScene(FrameBuffer &frameBuffer, int depth, const IScene &theScene) const
- * @brief	Raytrace scene
+ * @fn	void RayTracer::setNumThreads(int N)
+ * @brief	Changes the number of threads used to render a frame. The old
+ * 			threads are stopped; the new ones start with the next frame.
+ * @param	N	Number of threads. 0 uses one per hardware thread.
+ */
+
+void RayTracer::setNumThreads(int N) {
+	pool.reset();
+	numThreads = N;
+}
+
+/**
+ * @fn	int RayTracer::getNumThreads() const
+ * @brief	Gets the number of threads used to render a frame.
+ * @return	The number of threads.
+ */
+
+int RayTracer::getNumThreads() const {
+	return numThreads > 0 ? numThreads : WorkStealingPool::defaultNumThreads();
+}
+
+/**
+ * @fn	WorkStealingPool &RayTracer::getPool() const
+ * @brief	Gets the rendering threads, starting them if this is the first frame
+ * 			since construction or setNumThreads.
+ * @return	The pool.
+ */
+
+WorkStealingPool &RayTracer::getPool() const {
+	if (!pool) {
+		pool.reset(new WorkStealingPool(numThreads));
+	}
+	return *pool;
+}
+
+/**
+ * @fn	void RayTracer::raytraceScene(FrameBuffer &frameBuffer, int depth, const IScene &theScene, int antiAliasing)
+ * @brief	Raytrace scene. The frame is split into tileSize x tileSize tiles,
+ * 			which are rendered in parallel. Each pixel is computed exactly as
+ * 			it would be serially, so the image does not depend on the thread count.
+ * 			
+ * 			If adaptiveThreshold is set, every pixel is first sampled once
+ * 			through its center. Only pixels whose center color differs from a
+ * 			neighbor's by more than the threshold then get the full
+ * 			antiAliasing x antiAliasing grid of rays; those pixels come out
+ * 			exactly as they would with fixed anti-aliasing.
+ * @param [in,out]	frameBuffer 	Framebuffer.
+ * @param 		  	depth	   		The current depth of recursion.
+ * @param 		  	theScene   		The scene.
+ * @param 		  	antiAliasing	Number of rays per pixel, in each direction.
+ */
+
+void RayTracer::raytraceScene(FrameBuffer &frameBuffer, int depth,
+	const IScene &theScene, int antiAliasing) {
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	const int numTiles = ((W + tileSize - 1) / tileSize) * ((H + tileSize - 1) / tileSize);
+	std::vector<int> raysPerTile(numTiles, 0);
+	std::vector<color> centerColors;
+
+	if (adaptiveThreshold > 0.0f && antiAliasing > 1) {
+		centerColors.resize(W * H);
+		forEachTile(W, H, [&](int tile, int left, int bottom, int right, int top) {
+			raysPerTile[tile] = traceCenterSamples(centerColors, W, depth, theScene, left, bottom, right, top);
+		});
+	}
+	forEachTile(W, H, [&](int tile, int left, int bottom, int right, int top) {
+		raysPerTile[tile] += raytraceTile(frameBuffer, depth, theScene, antiAliasing, centerColors,
+											left, bottom, right, top);
+	});
+
+	numPrimaryRays = 0;
+	for (int rays : raysPerTile) {
+		numPrimaryRays += rays;
+	}
+
+	frameBuffer.showColorBuffer();
+}
+
+/**
+ * @fn	void RayTracer::forEachTile(int width, int height, const std::function<void(int tile, int left, int bottom, int right, int top)> &body) const
+ * @brief	Splits a width x height frame into tileSize x tileSize tiles and
+ * 			calls body for each one, in parallel.
+ * @param	width 	Width of the frame.
+ * @param	height	Height of the frame.
+ * @param	body  	Called with the tile's index and its pixels [left, right) x [bottom, top).
+ */
+
+void RayTracer::forEachTile(int width, int height,
+							const std::function<void(int tile, int left, int bottom, int right, int top)> &body) const {
+	const int tilesAcross = (width + tileSize - 1) / tileSize;
+	const int tilesDown = (height + tileSize - 1) / tileSize;
+	getPool().parallelFor(tilesAcross * tilesDown, [&](int tile) {
+		int left = (tile % tilesAcross) * tileSize;
+		int bottom = (tile / tilesAcross) * tileSize;
+		body(tile, left, bottom, std::min(left + tileSize, width), std::min(bottom + tileSize, height));
+	});
+}
+
+/**
+ * @fn	static float radicalInverse(int base, int i)
+ * @brief	The i-th element of the van der Corput sequence in the given base,
+ * 			used to spread progressive samples evenly over a pixel.
+ * @param	base	The base (a prime).
+ * @param	i   	Index in the sequence.
+ * @return	A value in [0, 1).
+ */
+
+static float radicalInverse(int base, int i) {
+	float result = 0.0f;
+	float digitWeight = 1.0f / base;
+	while (i > 0) {
+		result += (i % base) * digitWeight;
+		i /= base;
+		digitWeight /= base;
+	}
+	return result;
+}
+
+/**
+ * @fn	void RayTracer::accumulateFrame(FrameBuffer &frameBuffer, int depth, const IScene &theScene)
+ * @brief	Progressive rendering: adds one more sample per pixel to the
+ * 			accumulation buffer and displays the average. The first sample goes
+ * 			through each pixel's center, so it matches a frame rendered without
+ * 			anti-aliasing; later samples are jittered over the pixel (the same
+ * 			offset for every pixel, from a Halton sequence). The accumulated
+ * 			samples are discarded whenever the camera, the lights, the scene's
+ * 			version, the frame size or depth change. Once maxAccumulatedSamples
+ * 			have been taken, the average is displayed without tracing any rays.
  * @param [in,out]	frameBuffer	Framebuffer.
  * @param 		  	depth	   	The current depth of recursion.
  * @param 		  	theScene   	The scene.
  */
 
-void RayTracer::raytraceScene(FrameBuffer &frameBuffer, int depth,
-	const IScene &theScene, int antiAliasing) const {
-	const RaytracingCamera &camera = *theScene.camera;
-	const std::vector<VisibleIShapePtr> &objs = theScene.visibleObjects;
-	const std::vector<PositionalLightPtr> &lights = theScene.lights;
+void RayTracer::accumulateFrame(FrameBuffer &frameBuffer, int depth, const IScene &theScene) {
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	std::vector<float> key;
+	getAccumulationKey(theScene, W, H, depth, key);
+	if (key != accumulationKey) {
+		resetAccumulation();
+		accumulationKey = key;
+	}
+	if (numAccumulated == 0) {
+		accumulation.assign(W * H, black);
+	}
 
-	for (int y = 0; y < frameBuffer.getWindowHeight(); ++y) {
-		for (int x = 0; x < frameBuffer.getWindowWidth(); ++x) {
-			DEBUG_PIXEL = false;
+	numPrimaryRays = 0;
+	if (!isConverged()) {
+		glm::vec2 jitter(0.0f, 0.0f);
+		if (numAccumulated > 0) {
+			jitter = glm::vec2(radicalInverse(2, numAccumulated), radicalInverse(3, numAccumulated)) - 0.5f;
+		}
+		forEachTile(W, H, [&](int /*tile*/, int left, int bottom, int right, int top) {
+			accumulateTile(frameBuffer, depth, theScene, jitter, left, bottom, right, top);
+		});
+		numAccumulated++;
+		numPrimaryRays = W * H;
+	} else {
+		const float weight = 1.0f / numAccumulated;
+		for (int y = 0; y < H; ++y) {
+			for (int x = 0; x < W; ++x) {
+				frameBuffer.setColor(x, y, accumulation[y * W + x] * weight);
+			}
+		}
+	}
+
+	frameBuffer.showColorBuffer();
+}
+
+/**
+ * @fn	void RayTracer::resetAccumulation()
+ * @brief	Discards the accumulated samples; the next accumulateFrame starts over.
+ */
+
+void RayTracer::resetAccumulation() {
+	numAccumulated = 0;
+	accumulationKey.clear();
+}
+
+/**
+ * @fn	void RayTracer::accumulateTile(FrameBuffer &frameBuffer, int depth, const IScene &theScene, const glm::vec2 &jitter, int left, int bottom, int right, int top)
+ * @brief	Adds one sample, offset by jitter, to each pixel in [left, right) x [bottom, top)
+ * 			and writes the new averages to the framebuffer.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	depth	   	The current depth of recursion.
+ * @param 		  	theScene   	The scene.
+ * @param 		  	jitter	   	Offset of the sample from the pixel's center, in [-0.5, 0.5).
+ * @param 		  	left	   	Leftmost pixel column of the tile.
+ * @param 		  	bottom	   	Lowest pixel row of the tile.
+ * @param 		  	right	   	One past the rightmost column.
+ * @param 		  	top		   	One past the highest row.
+ */
+
+void RayTracer::accumulateTile(FrameBuffer &frameBuffer, int depth, const IScene &theScene, const glm::vec2 &jitter,
+								int left, int bottom, int right, int top) {
+	const RaytracingCamera &camera = *theScene.camera;
+	const int W = frameBuffer.getWindowWidth();
+	const float weight = 1.0f / (numAccumulated + 1);
+	std::vector<Ray> rays;
+	std::vector<color> colors;
+	int debugRay = -1;
+	for (int y = bottom; y < top; ++y) {
+		for (int x = left; x < right; ++x) {
 			if (xDebug == x && yDebug == y) {
-				DEBUG_PIXEL = true;
+				debugRay = (int)rays.size();
 			}
+			rays.push_back(camera.getRay(x + jitter.x, y + jitter.y));
+		}
+	}
+	traceWavefront(rays, depth, theScene, colors, debugRay, debugRay + 1);
 
-			// Handle Anti-aliasing
-			color avgColor = black;
-
-			int offset = antiAliasing / 2; // <! the number of sample rays on each side of the default ray
-			for (int yAnti = 0; yAnti < antiAliasing; yAnti++) {
-				for (int xAnti = 0; xAnti < antiAliasing; xAnti++) {
-					/*  ___________
-					 * | o | o | o | This box represents a single pixel, and the dashes represent the
-					 * |-----------| origin of each antiAliasing ray.
-					 * | o | o | o |
-					 * |-----------| The center point is the original (antiAliasing=1) ray, and you
-					 * | o | o | o | can see there are [antiAliasing / 2] rays above, below, left, and right
-					 *  -----------  of the original ray.
-					 */
-					 // These coordinates are the origin of each new ray.
-					float xPos = x + (-offset + xAnti) / (float)antiAliasing;
-					float yPos = y + (-offset + yAnti) / (float)antiAliasing;
-
-					Ray ray = camera.getRay((float)xPos, (float)yPos);
-					avgColor += traceIndividualRay(ray, theScene, depth);
+	int nextRay = 0;
+	for (int y = bottom; y < top; ++y) {
+		for (int x = left; x < right; ++x) {
+			color &sum = accumulation[y * W + x];
+			sum += colors[nextRay++];
+			frameBuffer.setColor(x, y, sum * weight);
+		}
+	}
+}
+
+/**
+ * @fn	void RayTracer::getAccumulationKey(const IScene &theScene, int width, int height, int depth, std::vector<float> &key) const
+ * @brief	Lists everything that accumulated samples depend on: the frame's
+ * 			size, the recursion depth, the camera, every light and the scene's
+ * 			version. Two equal keys mean the samples can be averaged together.
+ * @param 		  	theScene	The scene.
+ * @param 		  	width   	Width of the frame.
+ * @param 		  	height  	Height of the frame.
+ * @param 		  	depth   	The recursion depth.
+ * @param [in,out]	key	   	Set to the key.
+ */
+
+void RayTracer::getAccumulationKey(const IScene &theScene, int width, int height, int depth, std::vector<float> &key) const {
+	auto add = [&](const glm::vec3 &v) { key.insert(key.end(), { v.x, v.y, v.z }); };
+	const RaytracingCamera &camera = *theScene.camera;
+	key = { (float)width, (float)height, (float)depth, (float)theScene.version,
+			camera.fov, camera.left, camera.right, camera.bottom, camera.top, camera.nx, camera.ny };
+	add(camera.cameraFrame.origin);
+	add(camera.cameraFrame.u);
+	add(camera.cameraFrame.v);
+	add(camera.cameraFrame.w);
+	for (const PositionalLight *light : theScene.lights) {
+		key.insert(key.end(), { (float)light->isOn, (float)light->isTiedToWorld, (float)light->attenuationIsTurnedOn,
+								light->attenuationParams.constant, light->attenuationParams.linear,
+								light->attenuationParams.quadratic });
+		add(light->lightPosition);
+		add(light->lightColorComponents.ambient);
+		add(light->lightColorComponents.diffuse);
+		add(light->lightColorComponents.specular);
+		const SpotLight *spot = dynamic_cast<const SpotLight *>(light);
+		if (spot != nullptr) {
+			key.push_back(spot->fov);
+			add(spot->spotDirection);
+		}
+	}
+}
+
+/**
+ * @fn	int RayTracer::raytraceTile(FrameBuffer &frameBuffer, int depth, const IScene &theScene, int antiAliasing, const std::vector<color> &centerColors, int left, int bottom, int right, int top) const
+ * @brief	Raytrace the pixels in [left, right) x [bottom, top). All of the
+ * 			tile's camera rays are traced together by traceWavefront.
+ * @param [in,out]	frameBuffer 	Framebuffer.
+ * @param 		  	depth	   		The current depth of recursion.
+ * @param 		  	theScene   		The scene.
+ * @param 		  	antiAliasing	Number of rays per pixel, in each direction.
+ * @param 		  	centerColors	Colors through the center of every pixel when
+ * 									anti-aliasing adaptively; otherwise empty.
+ * @param 		  	left			Leftmost pixel column of the tile.
+ * @param 		  	bottom			Lowest pixel row of the tile.
+ * @param 		  	right			One past the rightmost column.
+ * @param 		  	top				One past the highest row.
+ * @return	The number of camera rays cast.
+ */
+
+int RayTracer::raytraceTile(FrameBuffer &frameBuffer, int depth, const IScene &theScene, int antiAliasing,
+							const std::vector<color> &centerColors, int left, int bottom, int right, int top) const {
+	const RaytracingCamera &camera = *theScene.camera;
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	const bool adaptive = !centerColors.empty();
+	const int offset = antiAliasing / 2;
+	const int tileWidth = right - left;
+	std::vector<Ray> rays;
+	std::vector<color> colors;
+	std::vector<bool> refine(tileWidth * (top - bottom));
+	int debugBegin = -1, debugEnd = -1;
+
+	for (int y = bottom; y < top; ++y) {
+		for (int x = left; x < right; ++x) {
+			int i = (y - bottom) * tileWidth + (x - left);
+			refine[i] = !adaptive || needsRefinement(centerColors, W, H, x, y);
+			if (refine[i]) {
+				if (xDebug == x && yDebug == y) {
+					debugBegin = (int)rays.size();
+				}
+				addPixelRays(rays, camera, x, y, antiAliasing, adaptive);
+				if (xDebug == x && yDebug == y) {
+					debugEnd = (int)rays.size();
 				}
 			}
-			color colorForPixel = avgColor * (1.0f / (antiAliasing * antiAliasing));
+		}
+	}
+	traceWavefront(rays, depth, theScene, colors, debugBegin, debugEnd);
+
+	int nextRay = 0;
+	for (int y = bottom; y < top; ++y) {
+		for (int x = left; x < right; ++x) {
+			color colorForPixel = adaptive ? centerColors[y * W + x] : black;
+			if (refine[(y - bottom) * tileWidth + (x - left)]) {
+				// Handle Anti-aliasing, in the same order the rays were added
+				color avgColor = black;
+				for (int yAnti = 0; yAnti < antiAliasing; yAnti++) {
+					for (int xAnti = 0; xAnti < antiAliasing; xAnti++) {
+						if (adaptive && xAnti == offset && yAnti == offset) {
+							avgColor += centerColors[y * W + x];
+						} else {
+							avgColor += colors[nextRay++];
+						}
+					}
+				}
+				colorForPixel = avgColor * (1.0f / (antiAliasing * antiAliasing));
+			}
 			frameBuffer.setColor(x, y, colorForPixel);
+
+			if (recordDepth) {
+				Ray centerRay = camera.getRay((float)x, (float)y);
+				frameBuffer.setDepth(x, y, theScene.findIntersection(centerRay).t);
+			}
 		}
 	}
+	return (int)rays.size();
+}
 
-	frameBuffer.showColorBuffer();
+/**
+ * @fn	int RayTracer::traceCenterSamples(std::vector<color> &centerColors, int width, int depth, const IScene &theScene, int left, int bottom, int right, int top) const
+ * @brief	Traces one ray through the center of each pixel in [left, right) x [bottom, top).
+ * @param [in,out]	centerColors	Colors for the whole frame, one per pixel.
+ * @param 		  	width			Width of the frame.
+ * @param 		  	depth			The current depth of recursion.
+ * @param 		  	theScene		The scene.
+ * @param 		  	left			Leftmost pixel column of the tile.
+ * @param 		  	bottom			Lowest pixel row of the tile.
+ * @param 		  	right			One past the rightmost column.
+ * @param 		  	top				One past the highest row.
+ * @return	The number of camera rays cast.
+ */
+
+int RayTracer::traceCenterSamples(std::vector<color> &centerColors, int width, int depth, const IScene &theScene,
+								int left, int bottom, int right, int top) const {
+	const RaytracingCamera &camera = *theScene.camera;
+	std::vector<Ray> rays;
+	std::vector<color> colors;
+	int debugRay = -1;
+	for (int y = bottom; y < top; ++y) {
+		for (int x = left; x < right; ++x) {
+			if (xDebug == x && yDebug == y) {
+				debugRay = (int)rays.size();
+			}
+			rays.push_back(camera.getRay((float)x, (float)y));
+		}
+	}
+	traceWavefront(rays, depth, theScene, colors, debugRay, debugRay + 1);
 
+	int nextRay = 0;
+	for (int y = bottom; y < top; ++y) {
+		for (int x = left; x < right; ++x) {
+			centerColors[y * width + x] = colors[nextRay++];
+		}
+	}
+	return (int)rays.size();
 }
 
 /**
- * @fn	color RayTracer::traceIndividualRay(const Ray &ray, const IScene &theScene, int recursionLevel) const
- * @brief	Trace an individual ray.
- * @param	ray			  	The ray.
- * @param	theScene	  	The scene.
- * @param	recursionLevel	The recursion level.
- * @return	The color to be displayed as a result of this ray.
+ * @fn	bool RayTracer::needsRefinement(const std::vector<color> &centerColors, int width, int height, int x, int y) const
+ * @brief	Determines if a pixel lies on an edge, a shadow boundary or some
+ * 			texture detail, judged by how much its center color differs from
+ * 			those of its eight neighbors.
+ * @param	centerColors	Colors through the center of every pixel.
+ * @param	width			Width of the frame.
+ * @param	height			Height of the frame.
+ * @param	x				The x coordinate.
+ * @param	y				The y coordinate.
+ * @return	True iff some color channel differs by more than adaptiveThreshold.
  */
 
-color RayTracer::traceIndividualRay(const Ray &ray, const IScene &theScene, int recursionLevel) const {
-	HitRecord theHit = VisibleIShape::findIntersection(ray, theScene.visibleObjects);
+bool RayTracer::needsRefinement(const std::vector<color> &centerColors, int width, int height, int x, int y) const {
+	const color &C = centerColors[y * width + x];
+	for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, height - 1); ny++) {
+		for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, width - 1); nx++) {
+			color diff = glm::abs(centerColors[ny * width + nx] - C);
+			if (diff.r > adaptiveThreshold || diff.g > adaptiveThreshold || diff.b > adaptiveThreshold) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	void RayTracer::addPixelRays(std::vector<Ray> &rays, const RaytracingCamera &camera, int x, int y, int antiAliasing, bool skipCenter) const
+ * @brief	Adds the antiAliasing x antiAliasing grid of camera rays for a pixel.
+ * @param [in,out]	rays			The rays.
+ * @param 		  	camera			The camera.
+ * @param 		  	x				The x coordinate.
+ * @param 		  	y				The y coordinate.
+ * @param 		  	antiAliasing	Number of rays per pixel, in each direction.
+ * @param 		  	skipCenter		True to leave out the ray through the pixel's center.
+ */
+
+void RayTracer::addPixelRays(std::vector<Ray> &rays, const RaytracingCamera &camera, int x, int y,
+							int antiAliasing, bool skipCenter) const {
+	int offset = antiAliasing / 2; // <! the number of sample rays on each side of the default ray
+	for (int yAnti = 0; yAnti < antiAliasing; yAnti++) {
+		for (int xAnti = 0; xAnti < antiAliasing; xAnti++) {
+			/*  ___________
+			 * | o | o | o | This box represents a single pixel, and the dashes represent the
+			 * |-----------| origin of each antiAliasing ray.
+			 * | o | o | o |
+			 * |-----------| The center point is the original (antiAliasing=1) ray, and you
+			 * | o | o | o | can see there are [antiAliasing / 2] rays above, below, left, and right
+			 *  -----------  of the original ray.
+			 */
+			if (skipCenter && xAnti == offset && yAnti == offset) {
+				continue;
+			}
+			 // These coordinates are the origin of each new ray.
+			float xPos = x + (-offset + xAnti) / (float)antiAliasing;
+			float yPos = y + (-offset + yAnti) / (float)antiAliasing;
+
+			rays.push_back(camera.getRay((float)xPos, (float)yPos));
+		}
+	}
+}
+
+/**
+ * @fn	void RayTracer::traceWavefront(const std::vector<Ray> &cameraRays, int depth, const IScene &theScene, std::vector<color> &colors, int debugBegin, int debugEnd) const
+ * @brief	Traces a batch of camera rays one bounce at a time instead of
+ * 			recursively. Each bounce intersects all of its rays together,
+ * 			then casts all of their shadow rays, then shades the hits, and
+ * 			finally emits one reflection ray per path for the next bounce.
+ * 			The colors of the bounces are combined at the end, deepest
+ * 			first, exactly as the recursion would have.
+ * @param 		  	cameraRays	The rays leaving the camera.
+ * @param 		  	depth	  	The number of reflections to follow.
+ * @param 		  	theScene  	The scene.
+ * @param [in,out]	colors	  	Set to the color seen along each camera ray.
+ * @param 		  	debugBegin	First camera ray of the debug pixel, or -1.
+ * @param 		  	debugEnd  	One past the last camera ray of the debug pixel.
+ */
+
+void RayTracer::traceWavefront(const std::vector<Ray> &cameraRays, int depth, const IScene &theScene,
+								std::vector<color> &colors, int debugBegin, int debugEnd) const {
+	const size_t numRays = cameraRays.size();
+	const size_t numLights = theScene.lights.size();
+	// A negative depth shades the camera hits only, as the recursion did.
+	depth = std::max(depth, 0);
+	// Reused from tile to tile, like the transparent hits in adjustForTransparency.
+	static thread_local std::vector<Ray> rays, nextRays;
+	static thread_local std::vector<HitRecord> hits;
+	static thread_local std::vector<char> shadowed;
+	static thread_local std::vector<color> localColors;
+	static thread_local std::vector<int> order;
+	static thread_local RayBatch batch;
+	static thread_local HitBatch batchHits;
+	rays.assign(cameraRays.begin(), cameraRays.end());
+	shadowed.resize(numRays * numLights);
+	localColors.resize(numRays * (depth + 1));
+
+	for (int bounce = 0; bounce <= depth; bounce++) {
+		if (bounce == 0) {
+			// Camera rays are coherent enough for packets.
+			theScene.findIntersections(rays, hits, packetWidth);
+		} else {
+			// Reflected rays are not, so they are traced as a batch.
+			batch.clear();
+			for (const Ray &ray : rays) {
+				batch.add(ray);
+			}
+			theScene.intersect(batch, batchHits);
+			batchHits.complete(batch, hits);
+		}
+		traceShadowRays(hits, theScene, shadowed);
+
+		color *local = &localColors[bounce * numRays];
+		getShadingOrder(hits, order);
+		for (int i : order) {
+			DEBUG_PIXEL = i >= debugBegin && i < debugEnd;
+			local[i] = shadeLocal(rays[i], hits[i], theScene, &shadowed[i * numLights]);
+		}
+
+		if (bounce < depth) {
+			// Misses reflect too (into the sky), so every path continues.
+			nextRays.clear();
+			for (size_t i = 0; i < numRays; i++) {
+				glm::vec3 I = glm::normalize(rays[i].direction);
+				glm::vec3 N = glm::normalize(hits[i].surfaceNormal);
+
+				glm::vec3 reflectionDirection = I - 2.0f * glm::dot(I, N) * N;
+				glm::vec3 reflectionOrigin = hits[i].interceptPoint + EPSILON * hits[i].surfaceNormal;
+				nextRays.push_back(Ray(reflectionOrigin, reflectionDirection));
+			}
+			rays.swap(nextRays);
+		}
+	}
+	DEBUG_PIXEL = false;
+
+	// At the moment, each reflection is 50% weaker than the previous
+	colors.resize(numRays);
+	for (size_t i = 0; i < numRays; i++) {
+		color result = glm::clamp(localColors[depth * numRays + i], 0.0f, 1.0f);
+		for (int bounce = depth - 1; bounce >= 0; bounce--) {
+			result = glm::clamp(localColors[bounce * numRays + i] + result * 0.5f, 0.0f, 1.0f);
+		}
+		colors[i] = result;
+	}
+}
+
+/**
+ * @fn	void RayTracer::traceShadowRays(const std::vector<HitRecord> &hits, const IScene &theScene, std::vector<char> &shadowed) const
+ * @brief	Casts a shadow ray from every hit to every light that is on. The
+ * 			rays are gathered into one batch and tested together.
+ * @param 		  	hits		The hits of one bounce; misses cast no shadow rays.
+ * @param 		  	theScene	The scene.
+ * @param [in,out]	shadowed	Set to 1 for each (hit, light) pair that is in shadow,
+ * 								indexed by hit * number of lights + light.
+ */
+
+void RayTracer::traceShadowRays(const std::vector<HitRecord> &hits, const IScene &theScene,
+								std::vector<char> &shadowed) const {
+	const size_t numLights = theScene.lights.size();
+	// Reused from tile to tile, like the other per-bounce arrays in traceWavefront.
+	static thread_local RayBatch shadowRays;
+	static thread_local std::vector<size_t> pairs;
+	shadowRays.clear();
+	pairs.clear();
+	for (size_t l = 0; l < numLights; l++) {
+		const PositionalLight *light = theScene.lights[l];
+		if (!light->isOn) {
+			continue; // it contributes nothing, shadowed or not
+		}
+		for (size_t i = 0; i < hits.size(); i++) {
+			const HitRecord &theHit = hits[i];
+			if (theHit.t == FLT_MAX) {
+				continue;
+			}
+			// Send ray from the intercept point to the light source, if it collides with anything we know we are in shadow.
+			glm::vec3 shadowCheckerOrigin = theHit.interceptPoint + EPSILON * theHit.surfaceNormal;
+			Ray shadowChecker = Ray(shadowCheckerOrigin, glm::normalize(light->lightPosition - shadowCheckerOrigin));
+			shadowRays.add(shadowChecker, 0.0f, glm::distance(light->lightPosition, theHit.interceptPoint));
+			pairs.push_back(i * numLights + l);
+		}
+	}
+
+	theScene.occlude(shadowRays);
+	std::fill(shadowed.begin(), shadowed.end(), 0);
+	for (int r = 0; r < shadowRays.size(); r++) {
+		shadowed[pairs[r]] = !shadowRays.active[r];
+	}
+}
+
+/**
+ * @fn	void RayTracer::getShadingOrder(const std::vector<HitRecord> &hits, std::vector<int> &order) const
+ * @brief	Lists the hits in the order they are to be shaded. When sortByMaterial
+ * 			is set, hits sharing a texture and material are shaded together and
+ * 			misses come last; otherwise they are shaded in ray order.
+ * @param 		  	hits 	The hits of one bounce.
+ * @param [in,out]	order	Set to the indices of the hits.
+ */
+
+void RayTracer::getShadingOrder(const std::vector<HitRecord> &hits, std::vector<int> &order) const {
+	order.resize(hits.size());
+	for (size_t i = 0; i < hits.size(); i++) {
+		order[i] = (int)i;
+	}
+	if (!sortByMaterial) {
+		return;
+	}
+	auto key = [&hits](int i) {
+		const HitRecord &h = hits[i];
+		const Material &m = h.material;
+		return std::make_tuple(h.t == FLT_MAX, h.texture,
+								m.diffuse.r, m.diffuse.g, m.diffuse.b,
+								m.ambient.r, m.ambient.g, m.ambient.b,
+								m.specular.r, m.specular.g, m.specular.b, m.shininess);
+	};
+	std::stable_sort(order.begin(), order.end(), [&key](int a, int b) { return key(a) < key(b); });
+}
+
+/**
+ * @fn	color RayTracer::shadeLocal(const Ray &ray, const HitRecord &theHit, const IScene &theScene, const char *shadowed) const
+ * @brief	Computes the color of a hit from the lights, its texture and the
+ * 			transparent objects in front of it, without its reflection.
+ * @param	ray			The ray.
+ * @param	theHit  	The closest hit along the ray; t is FLT_MAX for a miss.
+ * @param	theScene	The scene.
+ * @param	shadowed	For each light, nonzero if the hit is in its shadow.
+ * @return	The color, not yet clamped.
+ */
+
+color RayTracer::shadeLocal(const Ray &ray, const HitRecord &theHit, const IScene &theScene, const char *shadowed) const {
 	color result = black;
 
 	color texCol;
 	if (theHit.t < FLT_MAX) {
 
 		// Handle lighting + shadows
-		for (const PositionalLight *l : theScene.lights) {
-			// Send ray from the intercept point to each light source, if it collides with anything we know we are in shadow.
-			glm::vec3 shadowCheckerOrigin = theHit.interceptPoint + EPSILON * theHit.surfaceNormal;
-			Ray shadowChecker = Ray(shadowCheckerOrigin, glm::normalize(l->lightPosition - shadowCheckerOrigin));
-			HitRecord shadowHit = VisibleIShape::findIntersection(shadowChecker, theScene.visibleObjects);
-
-			bool shadow = (shadowHit.t < glm::distance(l->lightPosition, theHit.interceptPoint));
+		for (size_t l = 0; l < theScene.lights.size(); l++) {
+			const PositionalLight *light = theScene.lights[l];
+			bool shadow = shadowed[l] != 0;
 
 			color matContrib;
-			matContrib = l->illuminate(theHit.interceptPoint, theHit.surfaceNormal, theHit.material, theScene.camera->cameraFrame, shadow);
+			matContrib = light->illuminate(theHit.interceptPoint, theHit.surfaceNormal, theHit.material, theScene.camera->cameraFrame, shadow);
 
 			// Handle textures
 			if (theHit.texture != nullptr) {
 				float u = glm::clamp(theHit.u, 0.0f, 1.0f);
 				float v = glm::clamp(theHit.v, 0.0f, 1.0f);
 				texCol = theHit.texture->getPixel(u, v);
-				color texContrib = l->illuminate(theHit.interceptPoint, theHit.surfaceNormal, texCol, theScene.camera->cameraFrame, shadow);
+				color texContrib = light->illuminate(theHit.interceptPoint, theHit.surfaceNormal, texCol, theScene.camera->cameraFrame, shadow);
 				result += glm::clamp((matContrib + texContrib) / 2.0f, 0.0f, 1.0f);
-				RayTracer::adjustForTransparency(ray, theScene, theHit, result);
 			}
 			else {
 				result += matContrib;
-				RayTracer::adjustForTransparency(ray, theScene, theHit, result);
 			}
 		}
 
@@ -117,46 +659,37 @@ color RayTracer::traceIndividualRay(const Ray &ray, const IScene &theScene, int
 	else {
 		// If we don't collide with any visible objects, return the 'sky' color.
 		result = defaultColor;
-		RayTracer::adjustForTransparency(ray, theScene, theHit, result);
-	}
-
-	/*
-	// Handle transparent objects
-	HitRecord transHit = VisibleIShape::findIntersection(ray, theScene.transparentObjects);
-	if (transHit.t < FLT_MAX) {
-		if (transHit.t < theHit.t) {
-			float a = transHit.material.alpha;
-			result = glm::clamp(result * (1.0f - a) + transHit.material.ambient * a, 0.0f, 1.0f);
-		}
 	}
-	
-	*/
 
-	if (recursionLevel > 0) {
-		// Handle reflections
-		glm::vec3 I = glm::normalize(ray.direction);
-		glm::vec3 N = glm::normalize(theHit.surfaceNormal);
-
-		glm::vec3 reflectionDirection = I - 2.0f * glm::dot(I, N) * N;
-		
-		glm::vec3 reflectionOrigin = theHit.interceptPoint + EPSILON * theHit.surfaceNormal;
-
-		Ray reflectionRay = Ray(reflectionOrigin, reflectionDirection);
-
-		// At the moment, each reflection is 50% weaker than the previous
-		color reflectionColor = traceIndividualRay(reflectionRay, theScene, recursionLevel - 1);
-		return glm::clamp(result + reflectionColor * 0.5f, 0.0f, 1.0f);
-
-	} return glm::clamp(result, 0.0f, 1.0f);
+	RayTracer::adjustForTransparency(ray, theScene, theHit, result);
+	return result;
 }
 
+/**
+ * @fn	void RayTracer::adjustForTransparency(const Ray &ray, const IScene &theScene, const HitRecord &theHit, color &result) const
+ * @brief	Blends the transparent objects in front of the hit into its color.
+ * 			The transparent hits are found in a single query and composited
+ * 			front to back, so this is done once per ray regardless of the
+ * 			number of lights.
+ * @param 		  	ray			The ray.
+ * @param 		  	theScene	The scene.
+ * @param 		  	theHit  	The closest opaque hit; t is FLT_MAX for the sky.
+ * @param [in,out]	result  	The color of the hit, adjusted in place.
+ */
+
 void RayTracer::adjustForTransparency(const Ray &ray, const IScene &theScene, const HitRecord &theHit, color &result) const {
-	// Handle transparent objects
-	HitRecord transHit = VisibleIShape::findIntersection(ray, theScene.transparentObjects);
-	if (transHit.t < FLT_MAX) {
-		if (transHit.t < theHit.t) {
-			float a = transHit.material.alpha;
-			result = glm::clamp(result * (1.0f - a) + transHit.material.ambient * a, 0.0f, 1.0f);
-		}
+	static thread_local std::vector<HitRecord> transHits;
+	theScene.findTransparentHits(ray, theHit.t, transHits);
+	if (transHits.empty()) {
+		return;
+	}
+
+	color blended = black;
+	float transmitted = 1.0f;
+	for (const HitRecord &transHit : transHits) {
+		float a = transHit.material.alpha;
+		blended += transmitted * a * transHit.material.ambient;
+		transmitted *= 1.0f - a;
 	}
+	result = glm::clamp(blended + transmitted * result, 0.0f, 1.0f);
 }
\ No newline at end of file
@@ -1,9 +1,16 @@
 #pragma once
 
+#include <vector>
+#include <memory>
 #include "Utilities.h"
 #include "FrameBuffer.h"
 #include "Camera.h"
 #include "IScene.h"
+#include "WorkStealingPool.h"
+
+const int DEFAULT_TILE_SIZE = 16;		//!< Width and height of the tiles handed to each thread.
+const float DEFAULT_ADAPTIVE_THRESHOLD = 0.05f;	//!< Color difference that marks an edge when anti-aliasing adaptively.
+const int DEFAULT_MAX_ACCUMULATED_SAMPLES = 64;	//!< Samples per pixel at which progressive rendering stops.
 
 /**
  * @struct	RayTracer
@@ -12,10 +19,45 @@
 
 struct RayTracer {
 	color defaultColor;
-	RayTracer(const color &defaultColor);
+	int tileSize;					//!< Width/height of the square tiles the frame is split into.
+	bool recordDepth;				//!< If true, the distance to the surface seen through each pixel's center is stored in the depth buffer.
+	float adaptiveThreshold;		//!< If > 0, only pixels whose neighbors differ by more than this are anti-aliased.
+	int numPrimaryRays;				//!< Rays cast from the camera during the last frame.
+	int packetWidth;				//!< Camera rays intersected together: 8 (AVX2), 4 (SSE) or 1 (one at a time).
+	int maxAccumulatedSamples;		//!< Progressive rendering stops adding samples after this many per pixel.
+	int numAccumulated;				//!< Samples per pixel accumulated so far by accumulateFrame.
+	bool sortByMaterial;			//!< If true, each bounce's hits are shaded grouped by texture and material.
+	RayTracer(const color &defaultColor, int numThreads = 0);
 	void raytraceScene(FrameBuffer &frameBuffer, int depth,
-						const IScene &theScene, int antiAliasing) const;
+						const IScene &theScene, int antiAliasing);
+	void accumulateFrame(FrameBuffer &frameBuffer, int depth, const IScene &theScene);
+	void resetAccumulation();
+	bool isConverged() const { return numAccumulated >= maxAccumulatedSamples; }
+	void setNumThreads(int numThreads);
+	int getNumThreads() const;
 protected:
-	color traceIndividualRay(const Ray &ray, const IScene &theScene, int recursionLevel) const;
+	int numThreads;					//!< Threads to render with; 0 uses one per hardware thread.
+	mutable std::unique_ptr<WorkStealingPool> pool;	//!< Threads used to render the tiles; started by the first frame.
+	std::vector<color> accumulation;	//!< Sum of the progressive samples for each pixel.
+	std::vector<float> accumulationKey;	//!< Camera, lights and scene the accumulated samples were taken with.
+	WorkStealingPool &getPool() const;
+	void forEachTile(int width, int height,
+						const std::function<void(int tile, int left, int bottom, int right, int top)> &body) const;
+	void accumulateTile(FrameBuffer &frameBuffer, int depth, const IScene &theScene, const glm::vec2 &jitter,
+						int left, int bottom, int right, int top);
+	void getAccumulationKey(const IScene &theScene, int width, int height, int depth, std::vector<float> &key) const;
+	int raytraceTile(FrameBuffer &frameBuffer, int depth, const IScene &theScene, int antiAliasing,
+						const std::vector<color> &centerColors, int left, int bottom, int right, int top) const;
+	int traceCenterSamples(std::vector<color> &centerColors, int width, int depth, const IScene &theScene,
+						int left, int bottom, int right, int top) const;
+	bool needsRefinement(const std::vector<color> &centerColors, int width, int height, int x, int y) const;
+	void addPixelRays(std::vector<Ray> &rays, const RaytracingCamera &camera, int x, int y,
+						int antiAliasing, bool skipCenter) const;
+	void traceWavefront(const std::vector<Ray> &cameraRays, int depth, const IScene &theScene,
+						std::vector<color> &colors, int debugBegin, int debugEnd) const;
+	void traceShadowRays(const std::vector<HitRecord> &hits, const IScene &theScene,
+						std::vector<char> &shadowed) const;
+	void getShadingOrder(const std::vector<HitRecord> &hits, std::vector<int> &order) const;
+	color shadeLocal(const Ray &ray, const HitRecord &theHit, const IScene &theScene, const char *shadowed) const;
 	void adjustForTransparency(const Ray &ray, const IScene &theScene, const HitRecord &theHit, color &result) const;
 };
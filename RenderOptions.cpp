@@ -0,0 +1,106 @@
+#include <iostream>
+#include <cstdlib>
+#include "RenderOptions.h"
+
+/**
+ * @fn	RenderOptions::RenderOptions()
+ * @brief	Constructs the default options: an interactive, window sized render.
+ */
+
+RenderOptions::RenderOptions()
+	: width(WINDOW_WIDTH), height(WINDOW_HEIGHT), antiAliasing(1),
+	numReflections(0), numThreads(0), adaptiveThreshold(0.0f), packetWidth(0),
+	numBenchmarkTriangles(0), countTraversals(false), compressedBVH(false), numStressPasses(0) {
+}
+
+/**
+ * @fn	bool RenderOptions::parse(int argc, char *argv[])
+ * @brief	Reads the options from the command line.
+ * @param	argc	Number of arguments.
+ * @param	argv	The arguments, starting with the program name.
+ * @return	False if an option is unknown, is missing its value or has a bad value.
+ */
+
+bool RenderOptions::parse(int argc, char *argv[]) {
+	for (int i = 1; i < argc; i++) {
+		std::string option(argv[i]);
+		int numValues = option == "-s" ? 2 : (option == "-c" || option == "-q" ? 0 : 1);
+		if (i + numValues >= argc) {
+			return false;
+		}
+		if (option == "-o") {
+			colorFileName = argv[++i];
+		} else if (option == "-d") {
+			depthFileName = argv[++i];
+		} else if (option == "-s") {
+			width = std::atoi(argv[++i]);
+			height = std::atoi(argv[++i]);
+			if (width <= 0 || height <= 0) {
+				return false;
+			}
+		} else if (option == "-a") {
+			antiAliasing = std::atoi(argv[++i]);
+			if (antiAliasing < 1) {
+				return false;
+			}
+		} else if (option == "-r") {
+			numReflections = std::atoi(argv[++i]);
+			if (numReflections < 0) {
+				return false;
+			}
+		} else if (option == "-t") {
+			numThreads = std::atoi(argv[++i]);
+			if (numThreads < 0) {
+				return false;
+			}
+		} else if (option == "-e") {
+			adaptiveThreshold = (float)std::atof(argv[++i]);
+		} else if (option == "-p") {
+			packetWidth = std::atoi(argv[++i]);
+			if (packetWidth != 0 && packetWidth != 1 && packetWidth != 4 && packetWidth != 8) {
+				return false;
+			}
+		} else if (option == "-b") {
+			numBenchmarkTriangles = std::atoi(argv[++i]);
+			if (numBenchmarkTriangles <= 0) {
+				return false;
+			}
+		} else if (option == "-c") {
+			countTraversals = true;
+		} else if (option == "-q") {
+			compressedBVH = true;
+		} else if (option == "-m") {
+			bvhCacheDirectory = argv[++i];
+		} else if (option == "-i") {
+			importFileName = argv[++i];
+		} else if (option == "-x") {
+			numStressPasses = std::atoi(argv[++i]);
+			if (numStressPasses <= 0) {
+				return false;
+			}
+		} else {
+			return false;
+		}
+	}
+	return depthFileName.empty() || !colorFileName.empty();
+}
+
+/**
+ * @fn	void RenderOptions::printUsage(const std::string &programName)
+ * @brief	Describes the command line options on std::cerr.
+ * @param	programName	Name of the program.
+ */
+
+void RenderOptions::printUsage(const std::string &programName) {
+	std::cerr << "Usage: " << programName << " [-o color.ppm [-d depth.pam]] [-s width height]"
+		<< " [-a antiAliasing] [-e edgeThreshold] [-r reflections] [-t threads]"
+		<< " [-p packetWidth] [-b triangles] [-i mesh.obj|mesh.ply] [-x passes]" << std::endl
+		<< "With -o, a single frame is rendered without a window and written to the file." << std::endl
+		<< "With -c, the BVH nodes and primitives visited by each ray that is not in a packet are counted." << std::endl
+		<< "With -q, the BVHs are compressed to save memory, at some cost in speed." << std::endl
+		<< "With -m, BVHs saved in the directory by an earlier run are mapped instead of built." << std::endl
+		<< "With -b, BVH build times are measured instead, with 1 thread and with -t threads." << std::endl
+		<< "With -i, mesh import times are measured instead, with 1 thread and with -t threads." << std::endl
+		<< "With -x, the scene is rendered serially and then that many times on -t threads (16 by default)" << std::endl
+		<< "with tiny tiles instead, and the images are checked to be identical." << std::endl;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include "Defs.h"
+
+/**
+ * @struct	RenderOptions
+ * @brief	Settings for rendering a single frame from the command line, without
+ * 			opening a window. Options missing from the command line keep the
+ * 			values they had before parse was called.
+ */
+
+struct RenderOptions {
+	std::string colorFileName;	//!< -o file: PPM file for the color buffer. Empty means interactive.
+	std::string depthFileName;	//!< -d file: PAM file for the depth buffer. Empty means no depth output.
+	int width;					//!< -s width height: size of the image.
+	int height;					//!< Height of the image.
+	int antiAliasing;			//!< -a N: rays per pixel in each direction.
+	int numReflections;			//!< -r N: levels of reflection.
+	int numThreads;				//!< -t N: rendering threads. 0 uses one per hardware thread.
+	float adaptiveThreshold;	//!< -e T: anti-alias only where neighboring colors differ by more than T. 0 anti-aliases every pixel.
+	int packetWidth;			//!< -p N: camera rays intersected together (1, 4 or 8). 0 uses the widest the CPU supports.
+	int numBenchmarkTriangles;	//!< -b N: instead of rendering, time BVH builds over N random triangles.
+	bool countTraversals;		//!< -c: report the BVH nodes and primitives visited per ray.
+	bool compressedBVH;			//!< -q: use compressed BVHs, which take half the memory.
+	std::string bvhCacheDirectory;	//!< -m dir: map BVHs cached in dir instead of building them, and cache those that are built.
+	std::string importFileName;		//!< -i file: instead of rendering, time importing the OBJ or PLY mesh in file.
+	int numStressPasses;			//!< -x N: instead of rendering, check N renders on many threads against a serial render.
+	RenderOptions();
+	bool parse(int argc, char *argv[]);
+	bool isHeadless() const { return !colorFileName.empty(); }
+	bool isBenchmark() const { return numBenchmarkTriangles > 0; }
+	bool isImportBenchmark() const { return !importFileName.empty(); }
+	bool isStressTest() const { return numStressPasses > 0; }
+	static void printUsage(const std::string &programName);
+};
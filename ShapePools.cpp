@@ -0,0 +1,533 @@
+#include <typeinfo>
+#include "ShapePools.h"
+#include "RayPacket.h"
+
+#if defined(RAYPACKET_X86)
+#include <immintrin.h>
+#endif
+
+const int ELLIPSOID_TERMS = QUADRIC_SQUARES | QUADRIC_J;	//!< The terms of every pooled sphere and ellipsoid
+
+/**
+ * @fn	template <class Real> static inline Real ellipsoidsT(const EllipsoidPool &ellipsoids, int i, const Real origin[3], const Real direction[3])
+ * @brief	Intersects a ray with pooled ellipsoids i onward, one per lane of
+ * 			Real. This is the quadric kernel for A, B, C and J, which for
+ * 			A = B = C = 1 gives exactly the sphere's values.
+ * @param	ellipsoids	The pool.
+ * @param	i		  	The first ellipsoid.
+ * @param	origin	  	The ray's origin, in every lane.
+ * @param	direction 	The ray's direction, in every lane.
+ * @return	The smallest positive t in each lane, or FLT_MAX.
+ */
+
+template <class Real>
+static inline Real ellipsoidsT(const EllipsoidPool &ellipsoids, int i, const Real origin[3], const Real direction[3]) {
+	QuadricCoefficients<Real> q;
+	q.A = loadLanes<Real>(&ellipsoids.A[i]);
+	q.B = loadLanes<Real>(&ellipsoids.B[i]);
+	q.C = loadLanes<Real>(&ellipsoids.C[i]);
+	q.J = loadLanes<Real>(&ellipsoids.J[i]);
+	q.twoA = Real(2.0f) * q.A;
+	q.twoB = Real(2.0f) * q.B;
+	q.twoC = Real(2.0f) * q.C;
+	const Real center[3] = { loadLanes<Real>(&ellipsoids.centerX[i]), loadLanes<Real>(&ellipsoids.centerY[i]),
+							loadLanes<Real>(&ellipsoids.centerZ[i]) };
+	return closestQuadricT<ELLIPSOID_TERMS>(q, center, origin, direction);
+}
+
+/**
+ * @fn	static inline float ellipsoidT(const Ray &ray, const EllipsoidPool &ellipsoids, int i)
+ * @brief	Intersects a ray with one pooled ellipsoid.
+ * @param	ray		  	The ray.
+ * @param	ellipsoids	The pool.
+ * @param	i		  	The ellipsoid.
+ * @return	The smallest positive t, or FLT_MAX.
+ */
+
+static inline float ellipsoidT(const Ray &ray, const EllipsoidPool &ellipsoids, int i) {
+	const float origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+	const float direction[3] = { ray.direction.x, ray.direction.y, ray.direction.z };
+	return ellipsoidsT(ellipsoids, i, origin, direction);
+}
+
+/**
+ * @fn	static int closestLane(const float t[], const int index[], int width, float &closestT)
+ * @brief	Combines the closest hits kept in each lane of a kernel. On equal
+ * 			t the lower index wins, as it would in a scalar loop.
+ * @param 		  	t	   	Each lane's closest t.
+ * @param 		  	index  	Each lane's closest ellipsoid, or -1.
+ * @param 		  	width  	Number of lanes.
+ * @param [in,out]	closestT	The closest t so far; replaced by the lanes' if closer.
+ * @return	The closest ellipsoid, or -1 if no lane found one.
+ */
+
+static int closestLane(const float t[], const int index[], int width, float &closestT) {
+	int closest = -1;
+	for (int lane = 0; lane < width; lane++) {
+		if (index[lane] >= 0 && (closest < 0 || t[lane] < closestT ||
+								(t[lane] == closestT && index[lane] < closest))) {
+			closestT = t[lane];
+			closest = index[lane];
+		}
+	}
+	return closest;
+}
+
+#if defined(RAYPACKET_X86)
+
+/**
+ * @fn	static int findClosestSSE(const Ray &ray, const EllipsoidPool &ellipsoids, int end, float &closestT)
+ * @brief	SSE version of EllipsoidPool::findClosest over ellipsoids 0 to
+ * 			end - 1, 4 at a time; end is a multiple of 4.
+ */
+
+TARGET_SSE2 TARGET_FLATTEN
+static int findClosestSSE(const Ray &ray, const EllipsoidPool &ellipsoids, int end, float &closestT) {
+	const Float4 origin[3] = { Float4(ray.origin.x), Float4(ray.origin.y), Float4(ray.origin.z) };
+	const Float4 direction[3] = { Float4(ray.direction.x), Float4(ray.direction.y), Float4(ray.direction.z) };
+	const __m128 zero = _mm_setzero_ps();
+	__m128 bestT = _mm_set1_ps(closestT);
+	__m128i bestIndex = _mm_set1_epi32(-1);
+	__m128i index = _mm_setr_epi32(0, 1, 2, 3);
+	for (int i = 0; i < end; i += 4) {
+		const __m128 t = ellipsoidsT(ellipsoids, i, origin, direction).v;
+		const __m128 closer = _mm_and_ps(_mm_cmplt_ps(t, bestT), _mm_cmpgt_ps(t, zero));
+		bestT = _mm_or_ps(_mm_and_ps(closer, t), _mm_andnot_ps(closer, bestT));
+		const __m128i closerIndex = _mm_castps_si128(closer);
+		bestIndex = _mm_or_si128(_mm_and_si128(closerIndex, index), _mm_andnot_si128(closerIndex, bestIndex));
+		index = _mm_add_epi32(index, _mm_set1_epi32(4));
+	}
+	alignas(16) float t[4];
+	alignas(16) int indices[4];
+	_mm_store_ps(t, bestT);
+	_mm_store_si128((__m128i *)indices, bestIndex);
+	return closestLane(t, indices, 4, closestT);
+}
+
+/**
+ * @fn	static bool occludesSSE(const Ray &ray, const EllipsoidPool &ellipsoids, int end, float tMax)
+ * @brief	SSE version of EllipsoidPool::occludes over ellipsoids 0 to end - 1,
+ * 			4 at a time; end is a multiple of 4.
+ */
+
+TARGET_SSE2 TARGET_FLATTEN
+static bool occludesSSE(const Ray &ray, const EllipsoidPool &ellipsoids, int end, float tMax) {
+	const Float4 origin[3] = { Float4(ray.origin.x), Float4(ray.origin.y), Float4(ray.origin.z) };
+	const Float4 direction[3] = { Float4(ray.direction.x), Float4(ray.direction.y), Float4(ray.direction.z) };
+	const __m128 limit = _mm_set1_ps(tMax);
+	for (int i = 0; i < end; i += 4) {
+		if (_mm_movemask_ps(_mm_cmplt_ps(ellipsoidsT(ellipsoids, i, origin, direction).v, limit)) != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	static int findClosestAVX2(const Ray &ray, const EllipsoidPool &ellipsoids, int end, float &closestT)
+ * @brief	AVX2 version of EllipsoidPool::findClosest over ellipsoids 0 to
+ * 			end - 1, 8 at a time; end is a multiple of 8.
+ */
+
+TARGET_AVX2 TARGET_FLATTEN
+static int findClosestAVX2(const Ray &ray, const EllipsoidPool &ellipsoids, int end, float &closestT) {
+	const Float8 origin[3] = { Float8(ray.origin.x), Float8(ray.origin.y), Float8(ray.origin.z) };
+	const Float8 direction[3] = { Float8(ray.direction.x), Float8(ray.direction.y), Float8(ray.direction.z) };
+	const __m256 zero = _mm256_setzero_ps();
+	__m256 bestT = _mm256_set1_ps(closestT);
+	__m256i bestIndex = _mm256_set1_epi32(-1);
+	__m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	for (int i = 0; i < end; i += 8) {
+		const __m256 t = ellipsoidsT(ellipsoids, i, origin, direction).v;
+		const __m256 closer = _mm256_and_ps(_mm256_cmp_ps(t, bestT, _CMP_LT_OQ), _mm256_cmp_ps(t, zero, _CMP_GT_OQ));
+		bestT = _mm256_blendv_ps(bestT, t, closer);
+		bestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestIndex), _mm256_castsi256_ps(index), closer));
+		index = _mm256_add_epi32(index, _mm256_set1_epi32(8));
+	}
+	alignas(32) float t[8];
+	alignas(32) int indices[8];
+	_mm256_store_ps(t, bestT);
+	_mm256_store_si256((__m256i *)indices, bestIndex);
+	return closestLane(t, indices, 8, closestT);
+}
+
+/**
+ * @fn	static bool occludesAVX2(const Ray &ray, const EllipsoidPool &ellipsoids, int end, float tMax)
+ * @brief	AVX2 version of EllipsoidPool::occludes over ellipsoids 0 to end - 1,
+ * 			8 at a time; end is a multiple of 8.
+ */
+
+TARGET_AVX2 TARGET_FLATTEN
+static bool occludesAVX2(const Ray &ray, const EllipsoidPool &ellipsoids, int end, float tMax) {
+	const Float8 origin[3] = { Float8(ray.origin.x), Float8(ray.origin.y), Float8(ray.origin.z) };
+	const Float8 direction[3] = { Float8(ray.direction.x), Float8(ray.direction.y), Float8(ray.direction.z) };
+	const __m256 limit = _mm256_set1_ps(tMax);
+	for (int i = 0; i < end; i += 8) {
+		if (_mm256_movemask_ps(_mm256_cmp_ps(ellipsoidsT(ellipsoids, i, origin, direction).v, limit, _CMP_LT_OQ)) != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+#endif
+
+/**
+ * @fn	static inline float planeT(const Ray &ray, const PlanePool &planes, int i)
+ * @brief	Intersects a ray with one pooled plane, as IPlane::findClosestT does.
+ * @param	ray   	The ray.
+ * @param	planes	The pool.
+ * @param	i	  	The plane.
+ * @return	The t of the intersection, or FLT_MAX if it is behind the ray or the
+ * 			ray is parallel to the plane.
+ */
+
+static inline float planeT(const Ray &ray, const PlanePool &planes, int i) {
+	const float denom = ray.direction.x * planes.normalX[i] + ray.direction.y * planes.normalY[i] +
+						ray.direction.z * planes.normalZ[i];
+	if (denom == 0) {
+		return FLT_MAX;
+	}
+	const float num = (planes.pointX[i] - ray.origin.x) * planes.normalX[i] +
+						(planes.pointY[i] - ray.origin.y) * planes.normalY[i] +
+						(planes.pointZ[i] - ray.origin.z) * planes.normalZ[i];
+	const float t = num / denom;
+	return t < 0 ? FLT_MAX : t;
+}
+
+/**
+ * @fn	void EllipsoidPool::add(const IQuadricSurface &quadric, int object)
+ * @brief	Adds a sphere or ellipsoid to the pool.
+ * @param	quadric	The ISphere or IEllipsoid.
+ * @param	object 	The object it belongs to.
+ */
+
+void EllipsoidPool::add(const IQuadricSurface &quadric, int object) {
+	centerX.push_back(0.0f);
+	centerY.push_back(0.0f);
+	centerZ.push_back(0.0f);
+	A.push_back(0.0f);
+	B.push_back(0.0f);
+	C.push_back(0.0f);
+	J.push_back(0.0f);
+	objects.push_back(object);
+	set(size() - 1, quadric);
+}
+
+/**
+ * @fn	void EllipsoidPool::set(int i, const IQuadricSurface &quadric)
+ * @brief	Copies a sphere's or ellipsoid's center and coefficients into the
+ * 			pool.
+ * @param	i	   	Its place in the pool.
+ * @param	quadric	The ISphere or IEllipsoid.
+ */
+
+void EllipsoidPool::set(int i, const IQuadricSurface &quadric) {
+	const QuadricParameters &params = quadric.getParameters();
+	centerX[i] = quadric.center.x;
+	centerY[i] = quadric.center.y;
+	centerZ[i] = quadric.center.z;
+	A[i] = params.A;
+	B[i] = params.B;
+	C[i] = params.C;
+	J[i] = params.J;
+}
+
+/**
+ * @fn	void EllipsoidPool::clear()
+ * @brief	Removes all the ellipsoids.
+ */
+
+void EllipsoidPool::clear() {
+	centerX.clear();
+	centerY.clear();
+	centerZ.clear();
+	A.clear();
+	B.clear();
+	C.clear();
+	J.clear();
+	objects.clear();
+}
+
+/**
+ * @fn	int EllipsoidPool::findClosest(const Ray &ray, float &closestT) const
+ * @brief	Finds the ellipsoid the ray hits first, if closer than closestT.
+ * 			The ellipsoids are intersected 8 at a time with AVX2 or 4 at a time
+ * 			with SSE2, whichever the CPU supports, and the rest one by one.
+ * 			Every version gives the same t values as ellipsoidT, and the same
+ * 			ellipsoid on ties.
+ * @param 		  	ray	   	The ray.
+ * @param [in,out]	closestT	The closest t so far; replaced if an ellipsoid is closer.
+ * @return	The ellipsoid's place in the pool, or -1 if none is closer.
+ */
+
+int EllipsoidPool::findClosest(const Ray &ray, float &closestT) const {
+	int closest = -1;
+	int i = 0;
+#if defined(RAYPACKET_X86)
+	const int width = RayPacket::preferredWidth();
+	if (width > 1) {
+		i = size() - size() % width;
+		closest = width == 8 ? findClosestAVX2(ray, *this, i, closestT) : findClosestSSE(ray, *this, i, closestT);
+	}
+#endif
+	for (; i < size(); i++) {
+		float t = ellipsoidT(ray, *this, i);
+		if (t < closestT && t > 0) {
+			closestT = t;
+			closest = i;
+		}
+	}
+	return closest;
+}
+
+/**
+ * @fn	bool EllipsoidPool::occludes(const Ray &ray, float tMax) const
+ * @brief	Determines if any ellipsoid blocks the ray in (0, tMax), several at a
+ * 			time as in findClosest.
+ * @param	ray 	The ray.
+ * @param	tMax	The farthest t of interest.
+ * @return	True iff some ellipsoid blocks the ray.
+ */
+
+bool EllipsoidPool::occludes(const Ray &ray, float tMax) const {
+	int i = 0;
+#if defined(RAYPACKET_X86)
+	const int width = RayPacket::preferredWidth();
+	if (width > 1) {
+		i = size() - size() % width;
+		if (width == 8 ? occludesAVX2(ray, *this, i, tMax) : occludesSSE(ray, *this, i, tMax)) {
+			return true;
+		}
+	}
+#endif
+	for (; i < size(); i++) {
+		if (ellipsoidT(ray, *this, i) < tMax) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	void PlanePool::add(const IPlane &plane, int object)
+ * @brief	Adds a plane to the pool.
+ * @param	plane 	The plane.
+ * @param	object	The object it belongs to.
+ */
+
+void PlanePool::add(const IPlane &plane, int object) {
+	pointX.push_back(0.0f);
+	pointY.push_back(0.0f);
+	pointZ.push_back(0.0f);
+	normalX.push_back(0.0f);
+	normalY.push_back(0.0f);
+	normalZ.push_back(0.0f);
+	objects.push_back(object);
+	set(size() - 1, plane);
+}
+
+/**
+ * @fn	void PlanePool::set(int i, const IPlane &plane)
+ * @brief	Copies a plane's point and normal into the pool.
+ * @param	i	 	Its place in the pool.
+ * @param	plane	The plane.
+ */
+
+void PlanePool::set(int i, const IPlane &plane) {
+	pointX[i] = plane.a.x;
+	pointY[i] = plane.a.y;
+	pointZ[i] = plane.a.z;
+	normalX[i] = plane.n.x;
+	normalY[i] = plane.n.y;
+	normalZ[i] = plane.n.z;
+}
+
+/**
+ * @fn	void PlanePool::clear()
+ * @brief	Removes all the planes.
+ */
+
+void PlanePool::clear() {
+	pointX.clear();
+	pointY.clear();
+	pointZ.clear();
+	normalX.clear();
+	normalY.clear();
+	normalZ.clear();
+	objects.clear();
+}
+
+/**
+ * @fn	void ShapePools::compile(const std::vector<VisibleIShapePtr> &objectList)
+ * @brief	Sorts the objects' shapes into the pools. Only shapes of exactly a
+ * 			pooled type go into its pool, since a subclass may intersect
+ * 			differently.
+ * @param	objectList	The objects.
+ */
+
+void ShapePools::compile(const std::vector<VisibleIShapePtr> &objectList) {
+	clear();
+	objects = objectList;
+	for (int i = 0; i < (int)objects.size(); i++) {
+		const IShape &shape = *objects[i]->shape;
+		Slot slot;
+		if (typeid(shape) == typeid(ISphere) || typeid(shape) == typeid(IEllipsoid)) {
+			slot.kind = ELLIPSOID;
+			slot.index = ellipsoids.size();
+			ellipsoids.add((const IQuadricSurface &)shape, i);
+		} else if (typeid(shape) == typeid(IPlane)) {
+			slot.kind = PLANE;
+			slot.index = planes.size();
+			planes.add((const IPlane &)shape, i);
+		} else {
+			slot.kind = OTHER;
+			slot.index = (int)others.size();
+			others.push_back(i);
+		}
+		slots.push_back(slot);
+	}
+}
+
+/**
+ * @fn	void ShapePools::update()
+ * @brief	Copies the shapes into the pools again, after they have moved or
+ * 			changed size.
+ */
+
+void ShapePools::update() {
+	for (int i = 0; i < ellipsoids.size(); i++) {
+		ellipsoids.set(i, (const IQuadricSurface &)*objects[ellipsoids.objects[i]]->shape);
+	}
+	for (int i = 0; i < planes.size(); i++) {
+		planes.set(i, (const IPlane &)*objects[planes.objects[i]]->shape);
+	}
+}
+
+/**
+ * @fn	void ShapePools::clear()
+ * @brief	Removes all the objects.
+ */
+
+void ShapePools::clear() {
+	objects.clear();
+	slots.clear();
+	ellipsoids.clear();
+	planes.clear();
+	others.clear();
+}
+
+/**
+ * @fn	bool ShapePools::updateClosestHit(const Ray &ray, ClosestHit &closest) const
+ * @brief	Intersects the ray with every object, pool by pool, and replaces
+ * 			closest with the nearest hit in front of the ray's origin that is
+ * 			closer than closest.
+ * @param 		  	ray	   	The ray.
+ * @param [in,out]	closest	The closest hit found so far.
+ * @return	True iff closest was replaced.
+ */
+
+bool ShapePools::updateClosestHit(const Ray &ray, ClosestHit &closest) const {
+	float closestT = closest.t;
+	int closestEllipsoid = ellipsoids.findClosest(ray, closestT);
+	int closestObject = closestEllipsoid >= 0 ? ellipsoids.objects[closestEllipsoid] : -1;
+	for (int i = 0; i < planes.size(); i++) {
+		float t = planeT(ray, planes, i);
+		if (t < closestT && t > 0) {
+			closestT = t;
+			closestObject = planes.objects[i];
+		}
+	}
+	bool replaced = closestObject >= 0;
+	if (replaced) {
+		closest.t = closestT;
+		closest.object = objects[closestObject];
+		closest.primitive = 0;
+	}
+	for (int i : others) {
+		replaced = objects[i]->updateClosestHit(ray, closest) || replaced;
+	}
+	return replaced;
+}
+
+/**
+ * @fn	bool ShapePools::updateClosestHit(int object, const Ray &ray, ClosestHit &closest) const
+ * @brief	Intersects the ray with one object, without a virtual call if its
+ * 			shape is pooled, and replaces closest if it is hit closer.
+ * @param 		  	object 	The object.
+ * @param 		  	ray	   	The ray.
+ * @param [in,out]	closest	The closest hit found so far.
+ * @return	True iff closest was replaced.
+ */
+
+bool ShapePools::updateClosestHit(int object, const Ray &ray, ClosestHit &closest) const {
+	const Slot &slot = slots[object];
+	float t;
+	switch (slot.kind) {
+	case ELLIPSOID:
+		t = ellipsoidT(ray, ellipsoids, slot.index);
+		break;
+	case PLANE:
+		t = planeT(ray, planes, slot.index);
+		break;
+	default:
+		return objects[object]->updateClosestHit(ray, closest);
+	}
+	if (t < closest.t && t > 0) {
+		closest.t = t;
+		closest.object = objects[object];
+		closest.primitive = 0;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @fn	bool ShapePools::occluded(const Ray &ray, float tMax) const
+ * @brief	Determines if any object blocks the ray in (0, tMax), pool by pool.
+ * @param	ray 	The ray.
+ * @param	tMax	The farthest t of interest (e.g., the distance to a light).
+ * @return	True iff some object blocks the ray.
+ */
+
+bool ShapePools::occluded(const Ray &ray, float tMax) const {
+	if (ellipsoids.occludes(ray, tMax)) {
+		return true;
+	}
+	for (int i = 0; i < planes.size(); i++) {
+		float t = planeT(ray, planes, i);
+		if (t > 0 && t < tMax) {
+			return true;
+		}
+	}
+	for (int i : others) {
+		if (objects[i]->occludes(ray, tMax)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	bool ShapePools::occludes(int object, const Ray &ray, float tMax) const
+ * @brief	Determines if one object blocks the ray in (0, tMax), without a
+ * 			virtual call if its shape is pooled.
+ * @param	object	The object.
+ * @param	ray   	The ray.
+ * @param	tMax  	The farthest t of interest.
+ * @return	True iff the object blocks the ray.
+ */
+
+bool ShapePools::occludes(int object, const Ray &ray, float tMax) const {
+	const Slot &slot = slots[object];
+	switch (slot.kind) {
+	case ELLIPSOID:
+		return ellipsoidT(ray, ellipsoids, slot.index) < tMax;
+	case PLANE: {
+		float t = planeT(ray, planes, slot.index);
+		return t > 0 && t < tMax;
+	}
+	default:
+		return objects[object]->occludes(ray, tMax);
+	}
+}
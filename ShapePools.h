@@ -0,0 +1,89 @@
+#pragma once
+#include <vector>
+#include "IShape.h"
+
+/**
+ * @struct	EllipsoidPool
+ * @brief	The spheres and axis-aligned ellipsoids of a scene, one coordinate
+ * 			per array. A sphere is kept as an ellipsoid with A = B = C = 1, which
+ * 			gives the same roots as ISphere, so both are intersected by one
+ * 			kernel, 4 or 8 at a time.
+ */
+
+struct EllipsoidPool {
+	std::vector<float> centerX;			//!< x of each center.
+	std::vector<float> centerY;			//!< y of each center.
+	std::vector<float> centerZ;			//!< z of each center.
+	std::vector<float> A;				//!< Quadric coefficient of x^2: 1/(semi-axis x)^2.
+	std::vector<float> B;				//!< Quadric coefficient of y^2.
+	std::vector<float> C;				//!< Quadric coefficient of z^2.
+	std::vector<float> J;				//!< Constant coefficient: -radius^2 for a sphere, -1 for an ellipsoid.
+	std::vector<int> objects;			//!< The object each ellipsoid belongs to (see ShapePools::objects).
+	int size() const { return (int)objects.size(); }
+	void add(const IQuadricSurface &quadric, int object);
+	void set(int i, const IQuadricSurface &quadric);
+	void clear();
+	int findClosest(const Ray &ray, float &closestT) const;
+	bool occludes(const Ray &ray, float tMax) const;
+};
+
+/**
+ * @struct	PlanePool
+ * @brief	The planes of a scene, one coordinate per array.
+ */
+
+struct PlanePool {
+	std::vector<float> pointX;			//!< x of a point on each plane.
+	std::vector<float> pointY;			//!< y of a point on each plane.
+	std::vector<float> pointZ;			//!< z of a point on each plane.
+	std::vector<float> normalX;			//!< x of each normal.
+	std::vector<float> normalY;			//!< y of each normal.
+	std::vector<float> normalZ;			//!< z of each normal.
+	std::vector<int> objects;			//!< The object each plane belongs to (see ShapePools::objects).
+	int size() const { return (int)objects.size(); }
+	void add(const IPlane &plane, int object);
+	void set(int i, const IPlane &plane);
+	void clear();
+};
+
+/**
+ * @struct	ShapePools
+ * @brief	A list of objects compiled for fast intersection. Shapes of the
+ * 			common types are copied into a pool per type, laid out one
+ * 			coordinate per array, and intersected type by type in tight loops
+ * 			with no virtual calls; the rest are intersected through IShape as
+ * 			before. The VisibleIShape objects remain the way scenes are
+ * 			described, and give the same hits: the pools repeat their
+ * 			arithmetic exactly.
+ */
+
+struct ShapePools {
+	/**
+	 * @enum	Kind
+	 * @brief	The pool an object's shape is in.
+	 */
+
+	enum Kind { ELLIPSOID, PLANE, OTHER };
+
+	/**
+	 * @struct	Slot
+	 * @brief	Where an object's shape is kept.
+	 */
+
+	struct Slot {
+		Kind kind;		//!< Its pool.
+		int index;		//!< Its place in that pool, or in others.
+	};
+	std::vector<VisibleIShapePtr> objects;	//!< The objects, in the order compiled.
+	std::vector<Slot> slots;				//!< Where each object's shape is kept.
+	EllipsoidPool ellipsoids;				//!< Objects whose shape is an ISphere or IEllipsoid.
+	PlanePool planes;						//!< Objects whose shape is an IPlane.
+	std::vector<int> others;				//!< Objects intersected through IShape.
+	void compile(const std::vector<VisibleIShapePtr> &objectList);
+	void update();
+	void clear();
+	bool updateClosestHit(const Ray &ray, ClosestHit &closest) const;
+	bool updateClosestHit(int object, const Ray &ray, ClosestHit &closest) const;
+	bool occluded(const Ray &ray, float tMax) const;
+	bool occludes(int object, const Ray &ray, float tMax) const;
+};
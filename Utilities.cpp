@@ -525,7 +525,9 @@ std::vector<float> quadratic(float A, float B, float C) {
  * @fn	int quadratic(float A, float B, float C, float roots[2])
  * @brief	Solves the quadratic equation, given A, B, and C.
  * 			0, 1, or 2 roots are inserted into the array 'roots'0.
- * 			The roots are sortecd in ascending order.
+ * 			The roots are sortecd in ascending order. Unlike the vector
+ * 			version, this does not allocate, so it is safe and cheap to
+ * 			call from the ray intersection code on any thread.
  * @param	A	 	A.
  * @param	B	 	B.
  * @param	C	 	C.
@@ -534,12 +536,32 @@ std::vector<float> quadratic(float A, float B, float C) {
 */
 
 int quadratic(float A, float B, float C, float roots[2]) {
-	std::vector<float> found_roots = quadratic(A, B, C);
+	// What's inside the sqrt
+	float inside = B * B - 4.0f * A * C;
+	if (inside < 0) {
+		return 0;
+	}
+
+	// Get the first root
+	float x_1 = (-1.0f * B + std::sqrt(inside)) / (2.0f * A);
+
+	// if inside is 0, the roots would be the same
+	if (inside == 0.0f) {
+		roots[0] = x_1;
+		return 1;
+	}
+
+	float x_2 = (-1.0f * B - std::sqrt(inside)) / (2.0f * A);
 
-	for (int i = 0; i < found_roots.size(); i++) {
-		roots[i] = found_roots.at(i);
+	// Sort in ascending order
+	if (x_1 > x_2) {
+		roots[0] = x_2;
+		roots[1] = x_1;
+	} else {
+		roots[0] = x_1;
+		roots[1] = x_2;
 	}
-	return found_roots.size();
+	return 2;
 }
 
 /**
@@ -1134,7 +1156,7 @@ std::string extractBaseFilename(const std::string &str) {
 	return str.substr(pos + 1);
 }
 
-bool DEBUG_PIXEL = false;
+thread_local bool DEBUG_PIXEL = false;
 int xDebug = -1, yDebug = -1;
 
 void mouseUtility(int b, int s, int x, int y) {
@@ -0,0 +1,170 @@
+#include "WorkStealingPool.h"
+
+/**
+ * @fn	WorkStealingPool::WorkStealingPool(int N)
+ * @brief	Creates a pool that runs tasks on N threads, one of which is always
+ * 			the thread that calls parallelFor.
+ * @param	N	Number of threads. Values less than 1 select defaultNumThreads().
+ */
+
+WorkStealingPool::WorkStealingPool(int N)
+	: numThreads(N > 0 ? N : defaultNumThreads()), currentTask(nullptr),
+	batchNumber(0), busyWorkers(0), shuttingDown(false) {
+	for (int i = 0; i < numThreads; i++) {
+		queues.push_back(std::unique_ptr<TaskQueue>(new TaskQueue()));
+	}
+	for (int i = 1; i < numThreads; i++) {
+		workers.push_back(std::thread(&WorkStealingPool::workerLoop, this, i));
+	}
+}
+
+/**
+ * @fn	WorkStealingPool::~WorkStealingPool()
+ * @brief	Stops and joins the worker threads.
+ */
+
+WorkStealingPool::~WorkStealingPool() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		shuttingDown = true;
+	}
+	wakeWorkers.notify_all();
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+}
+
+/**
+ * @fn	int WorkStealingPool::defaultNumThreads()
+ * @brief	The number of hardware threads, or 1 if that cannot be determined.
+ * @return	The default thread count.
+ */
+
+int WorkStealingPool::defaultNumThreads() {
+	unsigned int N = std::thread::hardware_concurrency();
+	return N > 0 ? (int)N : 1;
+}
+
+/**
+ * @fn	void WorkStealingPool::parallelFor(int numTasks, const std::function<void(int task)> &task)
+ * @brief	Runs task(0) ... task(numTasks - 1) across the pool and returns when
+ * 			all of them have completed. Tasks are dealt round-robin, so each
+ * 			thread starts with work spread over the whole index range. Not
+ * 			reentrant: only one thread may call it at a time, and tasks must
+ * 			not call it on the same pool.
+ * @param	numTasks	The number of tasks.
+ * @param	task		The function to run for each task index.
+ */
+
+void WorkStealingPool::parallelFor(int numTasks, const std::function<void(int task)> &task) {
+	if (numThreads == 1 || numTasks <= 1) {
+		for (int i = 0; i < numTasks; i++) {
+			task(i);
+		}
+		return;
+	}
+
+	for (int i = 0; i < numTasks; i++) {
+		queues[i % numThreads]->tasks.push_back(i);
+	}
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		currentTask = &task;
+		busyWorkers = numThreads - 1;
+		batchNumber++;
+	}
+	wakeWorkers.notify_all();
+
+	runTasks(0);
+
+	std::unique_lock<std::mutex> guard(lock);
+	batchFinished.wait(guard, [this] { return busyWorkers == 0; });
+	currentTask = nullptr;
+}
+
+/**
+ * @fn	void WorkStealingPool::workerLoop(int id)
+ * @brief	Body of each background thread. Sleeps until a batch starts, helps
+ * 			run it, then reports back.
+ * @param	id	Index of this thread's queue.
+ */
+
+void WorkStealingPool::workerLoop(int id) {
+	unsigned int lastBatch = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wakeWorkers.wait(guard, [&] { return shuttingDown || batchNumber != lastBatch; });
+			if (shuttingDown) {
+				return;
+			}
+			lastBatch = batchNumber;
+		}
+
+		runTasks(id);
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			busyWorkers--;
+		}
+		batchFinished.notify_one();
+	}
+}
+
+/**
+ * @fn	void WorkStealingPool::runTasks(int id)
+ * @brief	Runs tasks from this thread's queue, then steals from the others until
+ * 			every queue is empty. No task adds new tasks, so one unsuccessful
+ * 			sweep over all the queues means the batch is drained.
+ * @param	id	Index of this thread's queue.
+ */
+
+void WorkStealingPool::runTasks(int id) {
+	const std::function<void(int)> &task = *currentTask;
+	int next;
+	while (popTask(id, next) || stealTask(id, next)) {
+		task(next);
+	}
+}
+
+/**
+ * @fn	bool WorkStealingPool::popTask(int id, int &task)
+ * @brief	Takes the most recently queued task from this thread's own queue.
+ * @param 		  	id  	Index of this thread's queue.
+ * @param [in,out]	task	The task index, if one was found.
+ * @return	True iff a task was found.
+ */
+
+bool WorkStealingPool::popTask(int id, int &task) {
+	TaskQueue &q = *queues[id];
+	std::lock_guard<std::mutex> guard(q.lock);
+	if (q.tasks.empty()) {
+		return false;
+	}
+	task = q.tasks.back();
+	q.tasks.pop_back();
+	return true;
+}
+
+/**
+ * @fn	bool WorkStealingPool::stealTask(int thiefID, int &task)
+ * @brief	Takes the oldest task from another thread's queue. Victims are
+ * 			visited starting with the thief's neighbour so that thieves spread
+ * 			out over the queues.
+ * @param 		  	thiefID	Index of the stealing thread's queue.
+ * @param [in,out]	task   	The task index, if one was found.
+ * @return	True iff a task was stolen.
+ */
+
+bool WorkStealingPool::stealTask(int thiefID, int &task) {
+	for (int i = 1; i < numThreads; i++) {
+		TaskQueue &victim = *queues[(thiefID + i) % numThreads];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tasks.empty()) {
+			task = victim.tasks.front();
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
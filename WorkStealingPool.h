@@ -0,0 +1,49 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+/**
+ * @struct	WorkStealingPool
+ * @brief	A fixed pool of worker threads that runs a batch of independent tasks.
+ * 			Every thread owns a queue of task indices. It pops work from the back
+ * 			of its own queue and, once that runs dry, steals from the front of the
+ * 			other queues, so expensive tasks do not leave threads idle at the end.
+ */
+
+struct WorkStealingPool {
+	WorkStealingPool(int numThreads = 0);
+	~WorkStealingPool();
+	int getNumThreads() const { return numThreads; }
+	void parallelFor(int numTasks, const std::function<void(int task)> &task);
+	static int defaultNumThreads();
+protected:
+	/**
+	 * @struct	TaskQueue
+	 * @brief	The queue of task indices owned by a single thread.
+	 */
+
+	struct TaskQueue {
+		std::mutex lock;			//!< Guards tasks
+		std::deque<int> tasks;		//!< Indices of the tasks still to be run
+	};
+	int numThreads;									//!< Worker threads + the calling thread
+	std::vector<std::thread> workers;				//!< Background worker threads
+	std::vector<std::unique_ptr<TaskQueue>> queues;	//!< One queue per thread; 0 is the caller's
+	const std::function<void(int)> *currentTask;	//!< The batch being run, if any
+	std::mutex lock;								//!< Guards the fields below
+	std::condition_variable wakeWorkers;			//!< Signalled when a batch starts or on shutdown
+	std::condition_variable batchFinished;			//!< Signalled when a worker finishes a batch
+	unsigned int batchNumber;						//!< Incremented for each new batch
+	int busyWorkers;								//!< Workers still running the current batch
+	bool shuttingDown;								//!< True once the destructor has been called
+	void workerLoop(int id);
+	void runTasks(int id);
+	bool popTask(int id, int &task);
+	bool stealTask(int thiefID, int &task);
+};